@@ -1,199 +1,224 @@
-#include <windows.h>
-#include <cstdio>
-#include <iostream>
+#include "alerts.h"
+#include "logging.h"
+#include <cstdlib>
+#include <cstring>
 
-char* _format(char* fmt, va_list args)
+bool _debuggerPresent()
 {
-	#pragma warning(suppress: 28719)
-	int size = vsnprintf(nullptr, 0, fmt, args);
-	char* message = new char[size];
-	vsnprintf(message, size, fmt, args);
-	return message;
+#ifdef _WIN32
+	return IsDebuggerPresent() != 0;
+#else
+	return false;
+#endif
 }
 
-void _message(char* title, unsigned int flags, char* fmt, va_list args)
+// break into the debugger if there is one, make sure it has seen all messages first
+void _break()
 {
-	char* message = _format(fmt, args);
-	// TODO: throw more info, call stack with line nrs for example
-	if (IsDebuggerPresent())
+	if (!_debuggerPresent())
+		return;
+	flushLog();
+#ifdef _WIN32
+	DebugBreak();
+#endif
+}
+
+// break into the debugger if there is one, quit otherwise
+void _breakOrExit()
+{
+	if (_debuggerPresent())
 	{
-		OutputDebugStringA(message);
-		OutputDebugStringA("\r\n");
+		_break();
+		return;
 	}
+	flushLog();
+#ifdef _WIN32
+	ExitProcess(0);
+#else
+	exit(0);
+#endif
+}
+
+char* _format(const char* fmt, va_list args)
+{
+	// most messages fit on the stack, only format twice when they don't
+	char buffer[512];
+	va_list copy;
+	va_copy(copy, args);
+	int size = vsnprintf(buffer, sizeof(buffer), fmt, copy);
+	va_end(copy);
+	if (size < 0)
+		size = 0;
+	char* message = new char[size + 1];
+	if (size < (int)sizeof(buffer))
+		memcpy(message, buffer, size + 1);
 	else
-		MessageBoxA(0, message, title, flags);
-	delete message;
+		vsnprintf(message, size + 1, fmt, args);
+	return message;
 }
 
-void _messaged(char* title, char* fmt, va_list args)
+void _message(const char* title, unsigned int flags, const char* fmt, va_list args)
 {
-	char* message = _format(fmt, args);
 	// TODO: throw more info, call stack with line nrs for example
-	if (IsDebuggerPresent())
+#ifdef _WIN32
+	if (!_debuggerPresent())
 	{
-		OutputDebugStringA(message);
-		OutputDebugStringA("\r\n");
+		char* message = _format(fmt, args);
+		MessageBoxA(0, message, title, flags);
+		delete[] message;
+		return;
 	}
-	else
-		std::cout << title << ": " << message << std::endl;
-	delete message;
+#endif
+	logMessage(title, fmt, args);
 }
 
-char* format(char* fmt, ...)
+void _messaged(const char* title, const char* fmt, va_list args)
+{
+	// TODO: throw more info, call stack with line nrs for example
+	logMessage(title, fmt, args);
+}
+
+#ifndef _WIN32
+// only used as arguments to _message, which ignores them off Windows
+#define MB_OK 0
+#define MB_ICONINFORMATION 0
+#define MB_ICONWARNING 0
+#define MB_ICONEXCLAMATION 0
+#endif
+
+char* format(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	char* result = _format(fmt, args);
-	__crt_va_end(args);
+	va_end(args);
 	return result;
 }
 
-void info(char* fmt, ...)
+void info(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_message("Info", MB_OK | MB_ICONINFORMATION, fmt, args);
-	__crt_va_end(args);
+	va_end(args);
 }
 
-void warning(char* fmt, ...)
+void warning(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_message("Warning", MB_OK | MB_ICONWARNING, fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
+	va_end(args);
+	_break();
 }
 
-void error(char* fmt, ...)
+void error(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_message("Error", MB_OK | MB_ICONEXCLAMATION, fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
+	va_end(args);
+	_break();
 }
 
-void fatal(char* fmt, ...)
+void fatal(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_message("Error", MB_OK | MB_ICONEXCLAMATION, fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
-	else
-		ExitProcess(0);
+	va_end(args);
+	_breakOrExit();
 }
 
 void assert(bool expression)
 {
 	if (expression)
 		return;
-	if (IsDebuggerPresent())
-		DebugBreak();
+	_break();
 }
 
-void assert(bool expression, char* fmt, ...)
+void assert(bool expression, const char* fmt, ...)
 {
 	if (expression)
 		return;
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_message("Error", MB_OK | MB_ICONEXCLAMATION, fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
+	va_end(args);
+	_break();
 }
 
 void assertFatal(bool expression)
 {
 	if (expression)
 		return;
-	if (IsDebuggerPresent())
-		DebugBreak();
-	else
-		ExitProcess(0);
+	_breakOrExit();
 }
 
-void assertFatal(bool expression, char* fmt, ...)
+void assertFatal(bool expression, const char* fmt, ...)
 {
 	if (expression)
 		return;
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_message("Error", MB_OK | MB_ICONEXCLAMATION, fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
-	else
-		ExitProcess(0);
+	va_end(args);
+	_breakOrExit();
 }
 
-void infod(char* fmt, ...)
+void infod(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_messaged("Info", fmt, args);
-	__crt_va_end(args);
+	va_end(args);
 }
 
-void warningd(char* fmt, ...)
+void warningd(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_messaged("Warning", fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
+	va_end(args);
+	_break();
 }
 
-void errord(char* fmt, ...)
+void errord(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_messaged("Error", fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
+	va_end(args);
+	_break();
 }
 
-void fatald(char* fmt, ...)
+void fatald(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_messaged("Error", fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
-	else
-		ExitProcess(0);
+	va_end(args);
+	_breakOrExit();
 }
 
-void assertd(bool expression, char* fmt, ...)
+void assertd(bool expression, const char* fmt, ...)
 {
 	if (expression)
 		return;
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_messaged("Error", fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
+	va_end(args);
+	_break();
 }
 
-void assertFatald(bool expression, char* fmt, ...)
+void assertFatald(bool expression, const char* fmt, ...)
 {
 	if (expression)
 		return;
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	_messaged("Error", fmt, args);
-	__crt_va_end(args);
-	if (IsDebuggerPresent())
-		DebugBreak();
-	else
-		ExitProcess(0);
-}
\ No newline at end of file
+	va_end(args);
+	_breakOrExit();
+}
@@ -1,40 +1,45 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
+#include <cstdarg>
 #include <cstdio>
 
 // Internals, please ignore. only here due to templates
-char* _format(char* fmt, va_list args);
+char* _format(const char* fmt, va_list args);
 
 // String formatting utility, the templated version will assign a char* to the type and free internally allocated memory
-char* format(char* fmt, ...); // char* needs to be deleted by the user!
+char* format(const char* fmt, ...); // char* needs to be delete[]'d by the user!
 template<typename T>
-T format(char* fmt, ...)
+T format(const char* fmt, ...)
 {
 	va_list args;
-	__crt_va_start(args, fmt);
+	va_start(args, fmt);
 	char* message = _format(fmt, args);
-	__crt_va_end(args);
+	va_end(args);
 	T result = message;
-	delete message;
+	delete[] message;
 	return result;
 }
 
 // Message utilities
-// In DEBUG all these use OutputDebugString() and if IsDebuggerPresent(): DebugBreak()
-// In Release the messages suffixed 'd' will use stdout, the others will show MessageBox() instead
-void info(char* fmt, ...);
-void warning(char* fmt, ...);
-void error(char* fmt, ...);
-void fatal(char* fmt, ...); // will ExitProcess
-void assert(bool expression, char* fmt, ...);
-void assertFatal(bool expression, char* fmt, ...); // will ExitProcess
-void infod(char* fmt, ...);
-void warningd(char* fmt, ...);
-void errord(char* fmt, ...);
-void fatald(char* fmt, ...); // will ExitProcess
-void assertd(bool expression, char* fmt, ...); // error if(!(expression))
-void assertFatald(bool expression, char* fmt, ...); // error if(!(expression)), will ExitProcess
+// In DEBUG all these log (see logging.h) and if IsDebuggerPresent(): DebugBreak()
+// In Release the messages suffixed 'd' only log, the others will show MessageBox() instead
+// Logging is asynchronous, messages are written to OutputDebugString() when debugging and to stdout otherwise.
+// Off Windows there are no message boxes and no debugger breaks, everything is logged.
+void info(const char* fmt, ...);
+void warning(const char* fmt, ...);
+void error(const char* fmt, ...);
+void fatal(const char* fmt, ...); // will ExitProcess
+void assert(bool expression, const char* fmt, ...);
+void assertFatal(bool expression, const char* fmt, ...); // will ExitProcess
+void infod(const char* fmt, ...);
+void warningd(const char* fmt, ...);
+void errord(const char* fmt, ...);
+void fatald(const char* fmt, ...); // will ExitProcess
+void assertd(bool expression, const char* fmt, ...); // error if(!(expression))
+void assertFatald(bool expression, const char* fmt, ...); // error if(!(expression)), will ExitProcess
 
 void assert(bool expression); // no message, does nothing outside of debug
 void assertFatal(bool expression); // no message, will ExitProcess
@@ -0,0 +1,788 @@
+#include "batch.h"
+#include "alerts.h"
+#include "cache.h"
+#include "daemon.h"
+#include "framepipe.h"
+#include "gpugrader.h"
+#include "grading.h"
+#include "hdrimage.h"
+#include "hybrid.h"
+#include "lut.h"
+#include "lutfile.h"
+#include "renderthread.h"
+#include "shard.h"
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <thread>
+
+bool isBatchInvocation(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+		if (!strcmp(argv[i], "--batch") || !strcmp(argv[i], "--serve"))
+			return true;
+	return false;
+}
+
+bool isGpuBatchInvocation(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+		if (!strcmp(argv[i], "--engine=hybrid") || (!strcmp(argv[i], "--engine") && i + 1 < argc && !strcmp(argv[i + 1], "hybrid")))
+			return true;
+	return false;
+}
+
+static bool writeFile(const QString& filePath, const unsigned char* data, qint64 size)
+{
+	QFile fh(filePath);
+	return fh.open(QFile::WriteOnly) && fh.write((const char*)data, size) == size;
+}
+
+// the grade baked into a LUT, from the cache if it has been baked before. cached or baked hold the data.
+static Lut3D batchLut(const GradingSettings& settings, GradeCache* cache, CacheEntry& cached, std::vector<float>& baked)
+{
+	CacheKey lutKey = { QString("lut%1").arg(BAKED_LUT_SIZE), 0, hashGradingSettings(settings), GRADING_ENGINE_VERSION };
+	Lut3D lut = { BAKED_LUT_SIZE, nullptr };
+	if (cache)
+		cached = cache->find(lutKey);
+	// a truncated or corrupted entry is baked again, like lutfile.cpp checks its cached LUTs
+	qint64 lutBytes = (qint64)BAKED_LUT_SIZE * BAKED_LUT_SIZE * BAKED_LUT_SIZE * 3 * sizeof(float);
+	if (cached.valid() && cached.size() != lutBytes)
+		cached = CacheEntry();
+	if (cached.valid())
+		lut.data = (const float*)cached.data();
+	else
+	{
+		baked = bakeLut(settings, BAKED_LUT_SIZE);
+		lut.data = &baked[0];
+		if (cache)
+			cache->store(lutKey, &baked[0], baked.size() * sizeof(float));
+	}
+	return lut;
+}
+
+// grade a decoded image, through a baked LUT if the grade allows it
+static QImage gradeImage(const QImage& source, const GradingSettings& settings, GradeCache* cache, int threads)
+{
+	if (!isLutGrade(settings))
+	{
+		CpuGrader grader;
+		grader.setSource(FloatImage::fromQImage(source));
+		FloatImage graded;
+		grader.grade(settings, graded);
+		return graded.toQImage();
+	}
+
+	CacheEntry cached;
+	std::vector<float> baked;
+	Lut3D lut = batchLut(settings, cache, cached, baked);
+
+	QImage rgba = source.convertToFormat(QImage::Format_RGBA8888);
+	QImage result(rgba.width(), rgba.height(), QImage::Format_RGBA8888);
+	applyLutRows(lut, rgba.constBits(), rgba.bytesPerLine(), result.bits(), result.bytesPerLine(), rgba.width(), rgba.height(),
+		LutPixelFormat::rgba8, LutInterpolation::tetrahedral, threads);
+	return result;
+}
+
+// what every image of a batch is graded with
+struct BatchJob
+{
+	QStringList gradePaths;
+	std::vector<GradingSettings> grades;
+	std::vector<uint64_t> gradeHashes;
+	QDir output;
+	GradeCache* cache;
+	// for applying LUTs, 0 uses every core
+	int threads;
+};
+
+// the GPU side of a hybrid batch, lives on the thread with the GL context
+struct GpuBatchEngine
+{
+	GpuGrader grader;
+	float tolerance; // in 8 bit code values
+	// the GPU can not grade or its grade was off, the image has to be graded by the CPU
+	bool retired = false;
+
+	GpuBatchEngine(float tolerance) : tolerance(tolerance) {}
+};
+
+// PFM for HDR sources, PNG for everything else
+static QByteArray encodeGraded(const FloatImage& graded, bool hdr)
+{
+	if (hdr)
+		return encodePfm(graded);
+	QByteArray encoded;
+	QBuffer buffer(&encoded);
+	buffer.open(QIODevice::WriteOnly);
+	graded.toQImage().save(&buffer, "PNG");
+	return encoded;
+}
+
+// the 8 bit code value FloatImage::toQImage() writes
+static inline int codeValue(float value)
+{
+	return (int)(qBound(0.0f, value, 1.0f) * 255.0f + 0.5f);
+}
+
+// how far a GPU value is off the CPU value in 8 bit code values, of what ends up in the file:
+// 8 bit outputs after rounding, HDR outputs relative to values above 1
+static inline float valueDifference(float gpu, float cpu, bool hdr)
+{
+	if (hdr)
+		return fabsf(gpu - cpu) / qMax(1.0f, fabsf(cpu)) * 255.0f;
+	return (float)abs(codeValue(gpu) - codeValue(cpu));
+}
+
+/*
+The CPU engine's grades of an 8 bit source: grades that can be baked go through their baked LUT, the others per pixel.
+The path only depends on the grade, so a cache entry holds the same pixels whichever other grades were cached.
+*/
+static std::vector<QImage> gradeLdrOnCpu(const BatchJob& job, const QImage& source, const std::vector<int>& missing)
+{
+	std::vector<QImage> graded(missing.size());
+	std::vector<size_t> perPixel;
+	for (size_t n = 0; n < missing.size(); ++n)
+	{
+		if (isLutGrade(job.grades[missing[n]]))
+			graded[n] = gradeImage(source, job.grades[missing[n]], job.cache, job.threads);
+		else
+			perPixel.push_back(n);
+	}
+	if (perPixel.empty())
+		return graded;
+
+	// a wedge reads the source once for all grades
+	std::vector<GradingSettings> variants;
+	for (size_t n : perPixel)
+		variants.push_back(job.grades[missing[n]]);
+	CpuGrader grader;
+	grader.setSource(FloatImage::fromQImage(source));
+	std::vector<FloatImage> targets;
+	grader.gradeWedge(variants, targets);
+	for (size_t k = 0; k < perPixel.size(); ++k)
+		graded[perPixel[k]] = targets[k].toQImage();
+	return graded;
+}
+
+// the CPU engine's grades of an HDR source, always per pixel as the LUT path clamps to [0, 1]
+static std::vector<FloatImage> gradeHdrOnCpu(const BatchJob& job, const FloatImage& source, const std::vector<int>& missing)
+{
+	std::vector<GradingSettings> variants;
+	for (int i : missing)
+		variants.push_back(job.grades[i]);
+	CpuGrader grader;
+	grader.setSource(source);
+	std::vector<FloatImage> targets;
+	grader.gradeWedge(variants, targets);
+	return targets;
+}
+
+/*
+Largest difference of a GPU grade to what the CPU engine writes for the same image, in 8 bit code values.
+Grades the CPU bakes are checked on HYBRID_CHECK_GRID whole rows, through the same LUT the CPU applies to whole rows.
+The others at a grid of HYBRID_CHECK_GRID x HYBRID_CHECK_GRID pixels with CpuGrader::gradePixel(), reference holds the source.
+*/
+static float gpuGradeDifference(const BatchJob& job, const GradingSettings& settings, const QImage& rgba, CpuGrader& reference,
+	const FloatImage& graded, bool hdr)
+{
+	int width = graded.width;
+	int height = graded.height;
+	int rows = qMin(HYBRID_CHECK_GRID, height);
+	int columns = qMin(HYBRID_CHECK_GRID, width);
+	float largest = 0.0f;
+	if (!hdr && isLutGrade(settings))
+	{
+		CacheEntry cached;
+		std::vector<float> baked;
+		Lut3D lut = batchLut(settings, job.cache, cached, baked);
+		std::vector<unsigned char> expected((size_t)width * 4);
+		for (int row = 0; row < rows; ++row)
+		{
+			int y = (int)(((qint64)row * 2 + 1) * height / (rows * 2));
+			applyLutRows(lut, rgba.constScanLine(y), rgba.bytesPerLine(), &expected[0], width * 4, width, 1,
+				LutPixelFormat::rgba8, LutInterpolation::tetrahedral, 1);
+			const float* actual = graded.pixel(0, y);
+			// alpha is left out, the LUT keeps the source's and the grade writes 1
+			for (int x = 0; x < width; ++x)
+				for (int c = 0; c < 3; ++c)
+					largest = qMax(largest, (float)abs(codeValue(actual[x * 4 + c]) - expected[x * 4 + c]));
+		}
+		return largest;
+	}
+
+	for (int row = 0; row < rows; ++row)
+	{
+		int y = (int)(((qint64)row * 2 + 1) * height / (rows * 2));
+		for (int column = 0; column < columns; ++column)
+		{
+			int x = (int)(((qint64)column * 2 + 1) * width / (columns * 2));
+			float expected[4];
+			reference.gradePixel(settings, x, y, expected);
+			const float* actual = graded.pixel(x, y);
+			for (int c = 0; c < 3; ++c)
+				largest = qMax(largest, valueDifference(actual[c], expected[c], hdr));
+		}
+	}
+	return largest;
+}
+
+// grade one image with every grade of the job, returns the number of outputs that failed
+// with gpu the image is graded on the GPU, if that retires the GPU nothing is written
+static int gradeBatchImage(const BatchJob& job, const QString& sourcePath, GpuBatchEngine* gpu = nullptr)
+{
+	CONVERT_QSTRING(sourcePath, text);
+	int failures = 0;
+
+	uint64_t sourceHash;
+	if (!hashFile(sourcePath, sourceHash))
+	{
+		errord("Could not read '%s'", text);
+		return 1;
+	}
+
+	// PFM sources are graded to PFM so values above 1 survive, everything else to PNG
+	bool hdr = isHdrImageFile(sourcePath);
+	const char* kind = hdr ? "pfm" : "png";
+
+	// serve what is cached, collect the grades that still need to run
+	std::vector<int> missing;
+	std::vector<QString> targetPaths;
+	for (int i = 0; i < (int)job.grades.size(); ++i)
+	{
+		// the extension is kept, so a.png and a.jpg don't grade to the same file
+		QString name = QFileInfo(sourcePath).fileName();
+		if (job.grades.size() > 1)
+			name += "-" + QFileInfo(job.gradePaths[i]).completeBaseName();
+		targetPaths.push_back(job.output.filePath(name + "." + kind));
+
+		CacheEntry hit;
+		if (job.cache)
+			hit = job.cache->find({ kind, sourceHash, job.gradeHashes[i], GRADING_ENGINE_VERSION });
+		if (!hit.valid())
+			missing.push_back(i);
+		else if (!writeFile(targetPaths[i], hit.data(), hit.size()))
+		{
+			errord("Could not write output for '%s'", text);
+			++failures;
+		}
+	}
+	if (missing.empty())
+		return failures;
+
+	std::vector<QByteArray> encoded(missing.size());
+	if (gpu)
+	{
+		// decoded like loadFloatImage() does, 8 bit sources are kept for checking the LUT grades
+		QImage rgba;
+		FloatImage source;
+		bool loaded;
+		if (hdr)
+			loaded = loadFloatImage(sourcePath, source);
+		else
+		{
+			rgba = QImage(sourcePath);
+			loaded = !rgba.isNull();
+			if (loaded)
+			{
+				source = FloatImage::fromQImage(rgba);
+				rgba = rgba.convertToFormat(QImage::Format_RGBA8888);
+			}
+		}
+		if (!loaded)
+		{
+			errord("Could not decode '%s'", text);
+			return 1;
+		}
+		gpu->grader.setSource(source);
+		std::vector<FloatImage> graded(missing.size());
+		for (size_t n = 0; n < missing.size(); ++n)
+		{
+			if (!gpu->grader.grade(job.grades[missing[n]], graded[n]))
+			{
+				errord("The GPU can not grade into 32 bit floats, grading the rest on the CPU");
+				gpu->retired = true;
+				return 0;
+			}
+		}
+
+		// every GPU grade is checked against what the CPU engine would have written, before anything is written
+		CpuGrader reference;
+		reference.setSource(source);
+		for (size_t n = 0; n < missing.size(); ++n)
+		{
+			float difference = gpuGradeDifference(job, job.grades[missing[n]], rgba, reference, graded[n], hdr);
+			if (difference > gpu->tolerance)
+			{
+				errord("The GPU grade of '%s' is %.2f code values off the CPU grade, grading the rest on the CPU", text, difference);
+				gpu->retired = true;
+				return 0;
+			}
+		}
+		for (size_t n = 0; n < missing.size(); ++n)
+			encoded[n] = encodeGraded(graded[n], hdr);
+	}
+	else if (hdr)
+	{
+		FloatImage source;
+		if (!loadFloatImage(sourcePath, source))
+		{
+			errord("Could not decode '%s'", text);
+			return 1;
+		}
+		std::vector<FloatImage> targets = gradeHdrOnCpu(job, source, missing);
+		for (size_t n = 0; n < targets.size(); ++n)
+			encoded[n] = encodePfm(targets[n]);
+	}
+	else
+	{
+		QImage source(sourcePath);
+		if (source.isNull())
+		{
+			errord("Could not decode '%s'", text);
+			return 1;
+		}
+
+		std::vector<QImage> graded = gradeLdrOnCpu(job, source, missing);
+		for (size_t n = 0; n < missing.size(); ++n)
+		{
+			QBuffer buffer(&encoded[n]);
+			buffer.open(QIODevice::WriteOnly);
+			graded[n].save(&buffer, "PNG");
+		}
+	}
+
+	for (size_t n = 0; n < missing.size(); ++n)
+	{
+		int i = missing[n];
+		if (encoded[n].isEmpty())
+		{
+			errord("Could not encode output for '%s'", text);
+			++failures;
+			continue;
+		}
+		if (job.cache)
+			job.cache->store({ kind, sourceHash, job.gradeHashes[i], GRADING_ENGINE_VERSION }, encoded[n].constData(), encoded[n].size());
+		if (!writeFile(targetPaths[i], (const unsigned char*)encoded[n].constData(), encoded[n].size()))
+		{
+			errord("Could not write output for '%s'", text);
+			++failures;
+		}
+	}
+	return failures;
+}
+
+/*
+Grade the images with the GPU engine and CPU worker threads side by side, see hybrid.h.
+The GPU engine runs on a thread with a GL context of its own, the CPU workers apply LUTs on a core each.
+*/
+static int gradeHybrid(const BatchJob& job, const QStringList& images, int cpuWorkers, float tolerance)
+{
+	// baked before the workers start, so they don't all bake the same LUT
+	if (job.cache)
+	{
+		for (const GradingSettings& settings : job.grades)
+		{
+			if (!isLutGrade(settings))
+				continue;
+			CacheEntry cached;
+			std::vector<float> baked;
+			batchLut(settings, job.cache, cached, baked);
+		}
+	}
+
+	HybridScheduler scheduler(images.size());
+	int gpuEngine = scheduler.addEngine("GPU", 1);
+	int cpuEngine = scheduler.addEngine("CPU", cpuWorkers);
+	// the GPU checks against LUTs applied on one core, like the CPU workers apply them
+	BatchJob cpuJob = job;
+	cpuJob.threads = 1;
+
+	auto gradeFrames = [&](int engine, GpuBatchEngine* gpu)
+	{
+		for (int frame = scheduler.take(engine); frame != -1; frame = scheduler.take(engine))
+		{
+			QElapsedTimer timer;
+			timer.start();
+			int failures = gradeBatchImage(cpuJob, images[frame], gpu);
+			if (gpu && gpu->retired)
+			{
+				scheduler.retire(engine, frame);
+				return;
+			}
+			scheduler.done(engine, frame, timer.nsecsElapsed() / 1.0e9, failures != 0);
+		}
+	};
+
+	std::unique_ptr<GpuBatchEngine> gpu;
+	std::promise<void> gpuDone;
+	std::future<void> gpuDoneFuture = gpuDone.get_future();
+	RenderThread gpuThread(nullptr,
+		[&]()
+		{
+			if (!QOpenGLContext::currentContext() || !gl.initializeOpenGLFunctions())
+				errord("No OpenGL 4.5 context for the GPU engine, grading on the CPU only");
+			else
+				gpu.reset(new GpuBatchEngine(tolerance));
+		},
+		[&]()
+		{
+			if (gpu)
+				gradeFrames(gpuEngine, gpu.get());
+			else
+				scheduler.retire(gpuEngine, -1);
+			gpuDone.set_value();
+		},
+		[&]() { gpu.reset(); });
+	gpuThread.wake();
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < cpuWorkers; ++i)
+		workers.emplace_back(gradeFrames, cpuEngine, nullptr);
+	for (std::thread& worker : workers)
+		worker.join();
+	gpuDoneFuture.wait();
+
+	scheduler.report();
+	return scheduler.failed();
+}
+
+// hand the frames of a stream to a grading daemon, keeping its ring full while graded frames are written out
+static int gradeStreamWithDaemon(FrameReader& reader, FrameWriter& writer, const QString& name, const GradingSettings& settings)
+{
+	const FrameStreamFormat& format = reader.format();
+	DaemonConnection daemon;
+	uint32_t grade = 0;
+	if (!daemon.connect(name, format.width, format.height) || !(grade = daemon.addGrade(settings)))
+	{
+		CONVERT_QSTRING(name, text);
+		errord("Could not connect to grading daemon '%s'", text);
+		return 1;
+	}
+
+	// the daemon answers a client in order, the oldest frame in flight is always the next one done
+	std::deque<int> inFlight;
+	std::vector<int> freeSlots;
+	for (int slot = daemon.slots() - 1; slot >= 0; --slot)
+		freeSlots.push_back(slot);
+
+	int frames = 0;
+	bool reading = true;
+	for (;;)
+	{
+		while (reading && !freeSlots.empty())
+		{
+			if (!reader.read())
+			{
+				reading = false;
+				break;
+			}
+			int slot = freeSlots.back();
+			freeSlots.pop_back();
+			reader.toRgba8(daemon.input(slot));
+			if (!daemon.submit(slot, grade))
+			{
+				errord("Could not send frame %d to the grading daemon", frames + (int)inFlight.size());
+				return 1;
+			}
+			inFlight.push_back(slot);
+		}
+		if (inFlight.empty())
+			break;
+
+		int slot;
+		if (!daemon.waitDone(slot) || slot != inFlight.front())
+		{
+			errord("Lost the grading daemon at frame %d", frames);
+			return 1;
+		}
+		inFlight.pop_front();
+		if (!writer.write(daemon.output(slot)))
+		{
+			errord("Could not write frame %d", frames);
+			return 1;
+		}
+		freeSlots.push_back(slot);
+		++frames;
+	}
+	infod("Graded %d frames", frames);
+	return reader.failed() ? 1 : 0;
+}
+
+// grade every frame of a stream, 8 bit streams go through a baked LUT if the grade allows it
+static int gradeStream(const QString& inPath, FrameStreamFormat inFormat, const QString& outPath, FrameLayout outLayout,
+	const GradingSettings& settings, GradeCache* cache, const QString& daemonName)
+{
+	FrameReader reader;
+	if (!reader.open(inPath, inFormat))
+	{
+		CONVERT_QSTRING(inPath, text);
+		errord("Could not open input stream '%s'", text);
+		return 1;
+	}
+	FrameStreamFormat outFormat = reader.format();
+	outFormat.layout = outLayout;
+	FrameWriter writer;
+	if (!writer.open(outPath, outFormat))
+	{
+		CONVERT_QSTRING(outPath, text);
+		errord("Could not open output stream '%s'", text);
+		return 1;
+	}
+	if (!daemonName.isEmpty())
+		return gradeStreamWithDaemon(reader, writer, daemonName, settings);
+
+	// everything per frame lives in these, allocated once
+	int numPixels = outFormat.width * outFormat.height;
+	std::vector<unsigned char> source, graded;
+	FloatImage sourceFloat, gradedFloat;
+	CpuGrader grader;
+
+	CacheEntry cached;
+	std::vector<float> baked;
+	bool useLut = isLutGrade(settings) && !reader.isFloat() && outLayout != FrameLayout::rgba16f;
+	Lut3D lut = {};
+	if (useLut)
+	{
+		lut = batchLut(settings, cache, cached, baked);
+		source.resize(numPixels * 4);
+		graded.resize(numPixels * 4);
+	}
+
+	int frames = 0;
+	while (reader.read())
+	{
+		bool written;
+		if (useLut)
+		{
+			reader.toRgba8(&source[0]);
+			applyLutRows(lut, &source[0], outFormat.width * 4, &graded[0], outFormat.width * 4, outFormat.width, outFormat.height,
+				LutPixelFormat::rgba8, LutInterpolation::tetrahedral);
+			written = writer.write(&graded[0]);
+		}
+		else
+		{
+			reader.toFloat(sourceFloat);
+			grader.setSource(sourceFloat);
+			grader.grade(settings, gradedFloat);
+			written = writer.write(gradedFloat);
+		}
+		if (!written)
+		{
+			errord("Could not write frame %d", frames);
+			return 1;
+		}
+		++frames;
+	}
+	infod("Graded %d frames", frames);
+	return reader.failed() ? 1 : 0;
+}
+
+int runBatch(const QStringList& arguments)
+{
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Grade images without opening the UI.");
+	parser.addHelpOption();
+	QCommandLineOption batchOption("batch", "Grade to apply, saved from the preview with S. Repeat to grade a wedge of variants in one pass.", "grade.ini");
+	QCommandLineOption outputOption("output", "Directory to write the graded images to.", "directory", ".");
+	QCommandLineOption cacheOption("cache", "Directory to cache graded images and LUTs in.", "directory", "cache");
+	QCommandLineOption cacheSizeOption("cache-size", "Cache budget in megabytes.", "MB", "2048");
+	QCommandLineOption noCacheOption("no-cache", "Always grade, don't read or write the cache.");
+	parser.addOption(batchOption);
+	parser.addOption(outputOption);
+	parser.addOption(cacheOption);
+	parser.addOption(cacheSizeOption);
+	parser.addOption(noCacheOption);
+	QCommandLineOption streamInOption("stream-in", "Grade the frames of an uncompressed stream instead of images, - reads stdin.", "path");
+	QCommandLineOption streamOutOption("stream-out", "Where to write the graded stream, - writes to stdout.", "path", "-");
+	QCommandLineOption streamFormatOption("stream-format", "Layout of the input stream: rgb8, rgba8, rgba16f or y4m.", "layout", "y4m");
+	QCommandLineOption streamOutFormatOption("stream-out-format", "Layout of the output stream, the input layout by default.", "layout");
+	QCommandLineOption frameSizeOption("frame-size", "Size of raw frames, y4m streams carry their own.", "WxH");
+	QCommandLineOption serveOption("serve", "Run as a grading daemon that other invocations hand their streams to.", "name");
+	QCommandLineOption daemonOption("daemon", "Grade the stream with a running daemon instead of in this process.", "name");
+	parser.addOption(streamInOption);
+	parser.addOption(streamOutOption);
+	parser.addOption(streamFormatOption);
+	parser.addOption(streamOutFormatOption);
+	parser.addOption(frameSizeOption);
+	parser.addOption(serveOption);
+	parser.addOption(daemonOption);
+	QCommandLineOption imageListOption("image-list", "File with the paths of more images to grade, one per line.", "file");
+	QCommandLineOption workersOption("workers", "Split the images over this many worker processes.", "count", "1");
+	QCommandLineOption shardWorkerOption("shard-worker", "Grade the ranges of images a coordinator hands out on stdin.");
+	shardWorkerOption.setFlags(QCommandLineOption::HiddenFromHelp);
+	parser.addOption(imageListOption);
+	parser.addOption(workersOption);
+	parser.addOption(shardWorkerOption);
+	QCommandLineOption exportLutOption("export-lut", "Bake the grade into a .cube or .3dl file for other tools instead of grading images.", "file");
+	QCommandLineOption lutSizeOption("lut-size", "Points per axis of the exported LUT.", "points", "33");
+	parser.addOption(exportLutOption);
+	parser.addOption(lutSizeOption);
+	QCommandLineOption engineOption("engine", "cpu, or hybrid to grade on the GPU and CPU worker threads side by side.", "engine", "cpu");
+	QCommandLineOption cpuWorkersOption("cpu-workers", "CPU worker threads of a hybrid batch, 0 grades on the GPU only. One less than there are cores by default.", "count");
+	QCommandLineOption toleranceOption("engine-tolerance", "How far the GPU grade may be off the CPU grade, in 8 bit code values, before a hybrid batch stops using the GPU.", "code values", "1");
+	parser.addOption(engineOption);
+	parser.addOption(cpuWorkersOption);
+	parser.addOption(toleranceOption);
+	parser.addPositionalArgument("images", "Images to grade.", "images...");
+	parser.process(arguments);
+
+	if (parser.isSet(serveOption))
+		return runDaemon(parser.value(serveOption));
+
+	QStringList gradePaths = parser.values(batchOption);
+	std::vector<GradingSettings> grades;
+	std::vector<uint64_t> gradeHashes;
+	for (const QString& gradePath : gradePaths)
+	{
+		GradingSettings settings = defaultGradingSettings();
+		if (!QFileInfo(gradePath).exists() || !loadGradingSettings(gradePath, settings))
+		{
+			CONVERT_QSTRING(gradePath, text);
+			errord("Could not read grade '%s'", text);
+			return 1;
+		}
+		grades.push_back(settings);
+		gradeHashes.push_back(hashGradingSettings(settings));
+	}
+
+	if (parser.isSet(exportLutOption))
+	{
+		QString lutPath = parser.value(exportLutOption);
+		int size = parser.value(lutSizeOption).toInt();
+		if (grades.empty() || size < 2 || size > 256)
+		{
+			errord("--export-lut needs a grade and a --lut-size between 2 and 256");
+			return 1;
+		}
+		if (!isLutGrade(grades[0]))
+			warningd("The unsharp mask and clarity can not be baked, they are left out of the LUT");
+		std::vector<float> baked = bakeLut(grades[0], size);
+		Lut3D lut = { size, &baked[0] };
+		if (!saveLutFile(lutPath, lut, QFileInfo(gradePaths[0]).completeBaseName()))
+		{
+			CONVERT_QSTRING(lutPath, text);
+			errord("Could not write LUT to '%s'", text);
+			return 1;
+		}
+		return 0;
+	}
+
+	std::unique_ptr<GradeCache> cache;
+	if (!parser.isSet(noCacheOption))
+		cache.reset(new GradeCache(parser.value(cacheOption), parser.value(cacheSizeOption).toLongLong() * 1024 * 1024));
+
+	if (parser.isSet(streamInOption))
+	{
+		FrameStreamFormat inFormat = { FrameLayout::y4m, 0, 0 };
+		FrameLayout outLayout;
+		QStringList size = parser.value(frameSizeOption).split('x');
+		if (size.size() == 2)
+		{
+			inFormat.width = size[0].toInt();
+			inFormat.height = size[1].toInt();
+		}
+		if (!parseFrameLayout(parser.value(streamFormatOption), inFormat.layout)
+			|| !parseFrameLayout(parser.isSet(streamOutFormatOption) ? parser.value(streamOutFormatOption) : parser.value(streamFormatOption), outLayout))
+		{
+			errord("Unknown stream layout, use rgb8, rgba8, rgba16f or y4m");
+			return 1;
+		}
+		if (inFormat.layout != FrameLayout::y4m && (inFormat.width <= 0 || inFormat.height <= 0))
+		{
+			errord("Raw streams need --frame-size");
+			return 1;
+		}
+		if (grades.size() > 1)
+			warningd("Streams are graded with the first grade only");
+		int result = gradeStream(parser.value(streamInOption), inFormat, parser.value(streamOutOption), outLayout, grades[0], cache.get(), parser.value(daemonOption));
+		flushLog();
+		return result;
+	}
+
+	// shard workers are one of several processes that share the cores already
+	BatchJob job = { gradePaths, grades, gradeHashes, QDir(parser.value(outputOption)), cache.get(), parser.isSet(shardWorkerOption) ? 1 : 0 };
+	QDir().mkpath(job.output.absolutePath());
+
+	QStringList images = parser.positionalArguments();
+	if (parser.isSet(imageListOption))
+	{
+		QFile list(parser.value(imageListOption));
+		if (!list.open(QFile::ReadOnly | QFile::Text))
+		{
+			errord("Could not read the image list");
+			return 1;
+		}
+		while (!list.atEnd())
+		{
+			QString line = QString::fromUtf8(list.readLine()).trimmed();
+			if (!line.isEmpty())
+				images.push_back(line);
+		}
+	}
+
+	QString engine = parser.value(engineOption);
+	if (engine != "cpu" && engine != "hybrid")
+	{
+		errord("Unknown engine, use cpu or hybrid");
+		return 1;
+	}
+
+	int failures = 0;
+	int workers = parser.value(workersOption).toInt();
+	if (engine == "hybrid" && workers > 1)
+		warningd("--engine hybrid is not used with --workers, the workers grade on the CPU");
+	if (parser.isSet(shardWorkerOption))
+		failures = runShardWorker([&](int frame) { return frame < images.size() && gradeBatchImage(job, images[frame]) == 0; });
+	else if (workers > 1 && images.size() > 1)
+	{
+		// workers run this executable with the same command line, so they see the same images and share the cache directory
+		QStringList workerArguments;
+		for (int i = 1; i < arguments.size(); ++i)
+		{
+			if (arguments[i] == "--workers" || arguments[i] == "--cache-size")
+				++i;
+			else if (!arguments[i].startsWith("--workers=") && !arguments[i].startsWith("--cache-size="))
+				workerArguments.push_back(arguments[i]);
+		}
+		workerArguments.push_back("--shard-worker");
+		// every worker trims only what it sees, so each gets a share of the budget to keep the directory within it.
+		// the index is saved by every worker on exit, the last one wins and the others' use order is lost
+		workerArguments.push_back("--cache-size");
+		workerArguments.push_back(QString::number(qMax(1LL, parser.value(cacheSizeOption).toLongLong() / workers)));
+		// ours is not used, it would save the index it loaded after the workers saved theirs
+		job.cache = nullptr;
+		cache.reset();
+
+		std::vector<std::unique_ptr<ShardWorker>> transports;
+		for (int i = 0; i < workers; ++i)
+			transports.emplace_back(new ProcessShardWorker(QCoreApplication::applicationFilePath(), workerArguments));
+		ShardCoordinator coordinator(images.size(), std::move(transports));
+		failures = coordinator.run();
+		// the workers report their own cache use
+		flushLog();
+		return failures ? 1 : 0;
+	}
+	else if (engine == "hybrid")
+	{
+		// feeding the GPU takes a core
+		int cores = (int)std::thread::hardware_concurrency();
+		int cpuWorkers = parser.isSet(cpuWorkersOption) ? parser.value(cpuWorkersOption).toInt() : qMax(1, cores - 1);
+		failures = gradeHybrid(job, images, qMax(0, cpuWorkers), parser.value(toleranceOption).toFloat());
+	}
+	else
+		for (const QString& sourcePath : images)
+			failures += gradeBatchImage(job, sourcePath);
+
+	if (cache)
+		infod("Cache: %d hits, %d misses, %lld MB", cache->hits(), cache->misses(), cache->totalBytes() / (1024 * 1024));
+	flushLog();
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QStringList>
+
+// True if the command line asks for headless grading or the grading daemon instead of the UI
+bool isBatchInvocation(int argc, char* argv[]);
+// True if a batch grades on the GPU, which needs a QGuiApplication for its GL context
+bool isGpuBatchInvocation(int argc, char* argv[]);
+
+/*
+Grade images without the UI, with the CPU engine.
+
+ColorGrading --batch grade.ini [--output dir] [--cache dir] [--cache-size MB] [--no-cache] images...
+
+Results are cached by source content, grade and engine version, re-running a batch only grades what changed.
+Grades without spatial effects (unsharp mask, clarity) are baked into a cached LUT and applied with that.
+With several --batch grades every image is graded with all of them in one pass over its pixels, see CpuGrader::gradeWedge().
+With --stream-in the frames of an uncompressed stream are graded instead, see framepipe.h.
+--daemon hands the frames of a stream to a daemon started with --serve, see daemon.h.
+--workers splits the images over worker processes, see shard.h.
+--engine hybrid grades on the GPU and CPU worker threads side by side from one queue, see hybrid.h.
+*/
+int runBatch(const QStringList& arguments);
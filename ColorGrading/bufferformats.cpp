@@ -151,3 +151,31 @@ GLenum formatDataType(ColorBufferFormat format)
 	error("Unexpected ColorBufferFormat, either not all enum cases are handled or an illegal cast has happened.");
 	return GL_RGBA;
 }
+
+int formatPixelBytes(ColorBufferFormat format)
+{
+	GLenum dataType = formatDataType(format);
+	switch (dataType)
+	{
+	// packed types hold all channels in one value
+	case GL_UNSIGNED_INT_10F_11F_11F_REV:
+	case GL_UNSIGNED_INT_5_9_9_9_REV:
+	case GL_UNSIGNED_INT_2_10_10_10_REV:
+	case GL_UNSIGNED_INT_24_8:
+		return 4;
+	case GL_FLOAT_32_UNSIGNED_INT_24_8_REV:
+		return 8;
+	}
+	int channels = highLevelFormatChannels(highLevelFormat(format));
+	switch (dataType)
+	{
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return channels;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:
+		return channels * 2;
+	}
+	return channels * 4;
+}
@@ -75,6 +75,8 @@ enum class ColorBufferFormat : GLenum
 GLenum highLevelFormat(ColorBufferFormat format);
 int highLevelFormatChannels(GLenum highLevelFormat);
 GLenum formatDataType(ColorBufferFormat format);
+// bytes per pixel as uploaded, drivers may pad 3 channel formats
+int formatPixelBytes(ColorBufferFormat format);
 
 enum class RenderBufferFormat : GLenum
 {
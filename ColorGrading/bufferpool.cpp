@@ -0,0 +1,107 @@
+#include "bufferpool.h"
+
+BufferPool bufferPool;
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) :
+	_pool(other._pool), _data(other._data), _size(other._size), _capacity(other._capacity)
+{
+	other._pool = nullptr;
+	other._data = nullptr;
+	other._size = 0;
+	other._capacity = 0;
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other)
+{
+	if (this == &other)
+		return *this;
+	release();
+	_pool = other._pool;
+	_data = other._data;
+	_size = other._size;
+	_capacity = other._capacity;
+	other._pool = nullptr;
+	other._data = nullptr;
+	other._size = 0;
+	other._capacity = 0;
+	return *this;
+}
+
+void PooledBuffer::release()
+{
+	if (_data)
+		_pool->_release(_data, _capacity);
+	_pool = nullptr;
+	_data = nullptr;
+	_size = 0;
+	_capacity = 0;
+}
+
+BufferPool::~BufferPool()
+{
+	trim();
+}
+
+size_t BufferPool::sizeClass(size_t bytes)
+{
+	// 4 steps per power of two: 1, 1.25, 1.5 and 1.75 times
+	for (size_t octave = BUFFER_POOL_MIN_BLOCK; ; octave *= 2)
+		for (size_t step = 0; step < 4; ++step)
+			if (bytes <= octave + step * (octave / 4))
+				return octave + step * (octave / 4);
+}
+
+PooledBuffer BufferPool::lease(size_t bytes)
+{
+	size_t capacity = sizeClass(bytes);
+	unsigned char* data = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_counters.leases;
+		_counters.leasedBytes += capacity;
+		auto it = _free.find(capacity);
+		if (it != _free.end() && !it->second.empty())
+		{
+			data = it->second.back();
+			it->second.pop_back();
+			_counters.idleBytes -= capacity;
+			++_counters.reuses;
+		}
+		else
+			++_counters.allocations;
+	}
+	if (!data)
+		data = new unsigned char[capacity];
+	return PooledBuffer(this, data, bytes, capacity);
+}
+
+void BufferPool::_release(unsigned char* data, size_t capacity)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_counters.leasedBytes -= capacity;
+		if (_counters.idleBytes + (int64_t)capacity <= (int64_t)_maxIdle)
+		{
+			_free[capacity].push_back(data);
+			_counters.idleBytes += capacity;
+			return;
+		}
+	}
+	delete[] data;
+}
+
+void BufferPool::trim()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto& it : _free)
+		for (unsigned char* data : it.second)
+			delete[] data;
+	_free.clear();
+	_counters.idleBytes = 0;
+}
+
+BufferPoolCounters BufferPool::counters() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _counters;
+}
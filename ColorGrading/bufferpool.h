@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/*
+Recycles the host memory of GPU readbacks and staging copies.
+
+Blocks are handed out in size classes, 4 per power of two from 4 KB up, so a block is at most 25% larger than asked for.
+A lease gives its block back to the free list of its class when it goes out of scope, the next request of that class
+reuses it instead of going to the heap. Reading back the same texture every frame settles on one block.
+Idle blocks are kept up to a limit, past that released blocks are freed.
+*/
+
+const size_t BUFFER_POOL_MIN_BLOCK = 4096;
+const size_t BUFFER_POOL_MAX_IDLE = 256 * 1024 * 1024;
+
+class BufferPool;
+
+// a block leased from a pool, move-only
+class PooledBuffer
+{
+protected:
+	friend class BufferPool;
+	BufferPool* _pool = nullptr;
+	unsigned char* _data = nullptr;
+	size_t _size = 0;
+	size_t _capacity = 0; // size of the block
+
+	PooledBuffer(BufferPool* pool, unsigned char* data, size_t size, size_t capacity) : _pool(pool), _data(data), _size(size), _capacity(capacity) {}
+
+public:
+	PooledBuffer() {}
+	PooledBuffer(PooledBuffer&& other);
+	PooledBuffer& operator=(PooledBuffer&& other);
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+	~PooledBuffer() { release(); }
+
+	// give the block back early
+	void release();
+
+	template<typename T = unsigned char> inline T* data() const { return (T*)_data; }
+	// bytes asked for, the block may be larger
+	inline size_t size() const { return _size; }
+	inline explicit operator bool() const { return _data != nullptr; }
+};
+
+struct BufferPoolCounters
+{
+	int64_t leases = 0; // since startup
+	int64_t reuses = 0; // leases served from a free list
+	int64_t allocations = 0; // leases that went to the heap
+	int64_t leasedBytes = 0; // blocks that are out now
+	int64_t idleBytes = 0; // blocks waiting in the free lists
+};
+
+class BufferPool
+{
+protected:
+	friend class PooledBuffer;
+	mutable std::mutex _mutex;
+	std::map<size_t, std::vector<unsigned char*>> _free; // by block size
+	size_t _maxIdle;
+	BufferPoolCounters _counters;
+
+	void _release(unsigned char* data, size_t capacity);
+
+public:
+	BufferPool(size_t maxIdleBytes = BUFFER_POOL_MAX_IDLE) : _maxIdle(maxIdleBytes) {}
+	~BufferPool();
+
+	// the block size a request is served with
+	static size_t sizeClass(size_t bytes);
+
+	// contents are undefined, like new[]
+	PooledBuffer lease(size_t bytes);
+	// free all idle blocks
+	void trim();
+
+	BufferPoolCounters counters() const;
+};
+
+// the pool the buffer readbacks use
+extern BufferPool bufferPool;
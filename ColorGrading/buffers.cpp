@@ -34,6 +34,9 @@ void ColorBufferObject2DBase::_sizeChanged()
 		if (!mipLevel && _data.size() > 1)
 			_generateMipMaps();
 	}
+	// mips made with generateMipMaps() from the data, made again when the texture is uploaded after an eviction
+	if (_data.size() == 1 && _mipLevels > 1)
+		_generateMipMaps();
 }
 
 void ColorBufferObject2DBase::_initialize()
@@ -46,12 +49,17 @@ void ColorBufferObject2DBase::_initialize()
 	else
 		glTexParameteri(_textureType(), GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	_tilingSet();
+	if (!_keepData)
+		_data.clear();
+	residency.allocated(this);
 }
 
 void ColorBufferObject2DBase::_uninitialize()
 {
+	residency.released(this);
 	glDeleteTextures(1, (GLuint*)_handle);
 	delete[] _handle;
+	_handle = nullptr;
 }
 
 void ColorBufferObject2DBase::_tilingSet()
@@ -103,18 +111,93 @@ void ColorBufferObject2DBase::generateMipMaps(int levels)
 		_generateMipMaps();
 }
 
-void ColorBufferObject2DBase::bindLoadStore(GLenum layout, GLenum mode)
+void ColorBufferObject2DBase::bindLoadStore(GLenum layout, GLenum mode, int mipLevel)
+{
+	gl.glBindImageTexture(layout, handle<GLuint>(), mipLevel, false, 0, mode, (GLenum)_internalFormat);
+	_lastUse = residency.frame();
+}
+
+ResidencyType ColorBufferObject2DBase::residencyType()
+{
+	switch (_textureType())
+	{
+	case GL_TEXTURE_3D: return ResidencyType::texture3D;
+	case GL_TEXTURE_2D_ARRAY: return ResidencyType::texture2DArray;
+	case GL_TEXTURE_CUBE_MAP: return ResidencyType::textureCube;
+	}
+	return ResidencyType::texture2D;
+}
+
+int64_t ColorBufferObject2DBase::gpuBytes()
+{
+	int64_t pixels = 0;
+	for (int mipLevel = 0; mipLevel < _mipLevels; ++mipLevel)
+		pixels += _numPixels(1 << mipLevel);
+	return pixels * formatPixelBytes(format());
+}
+
+int64_t ColorBufferObject2DBase::shadowBytes()
 {
-	gl.glBindImageTexture(layout, handle<GLuint>(), 0, false, 0, mode, (GLenum)_internalFormat);
+	int64_t bytes = 0;
+	for (const std::vector<unsigned char>& level : _data)
+		bytes += level.size();
+	return bytes;
+}
+
+void ColorBufferObject2DBase::evict()
+{
+	assert(evictable(), "Evicting a texture without data or an owner to fill it again would lose its contents.");
+	if (_handle)
+		_uninitialize();
+}
+
+void ColorBufferObject2DBase::setKeepData(bool keepData)
+{
+	_keepData = keepData;
+	if (!_keepData && _handle)
+		_data.clear();
 }
 
 ColorBufferObject2DBase::ColorBufferObject2DBase(ColorBufferFormat internalFormat, int width, int height, std::vector<std::vector<unsigned char>> dataPerMipLevel) :
-	BufferObject2DBase((GLenum)internalFormat, width, height), _data(dataPerMipLevel), _tiling(false), _mipLevels((int)dataPerMipLevel.size())
+	BufferObject2DBase((GLenum)internalFormat, width, height), _data(std::move(dataPerMipLevel)), _tiling(false), _mipLevels((int)_data.size())
 {
 	if (!_mipLevels)
 		_mipLevels = 1;
 }
 
+ColorBufferObject2DBase::ColorBufferObject2DBase(ColorBufferObject2DBase&& other) :
+	BufferObject2DBase(std::move(other)), _data(std::move(other._data)), _mipLevels(other._mipLevels), _tiling(other._tiling),
+	_keepData(other._keepData), _reloadable(other._reloadable), _lastUse(other._lastUse)
+{
+	residency.moved(&other, this);
+}
+
+ColorBufferObject2DBase& ColorBufferObject2DBase::operator=(ColorBufferObject2DBase&& other)
+{
+	if (this == &other)
+		return *this;
+	if (_handle)
+		_uninitialize();
+	residency.released(this);
+	BufferObject2DBase::operator=(std::move(other));
+	_data = std::move(other._data);
+	_mipLevels = other._mipLevels;
+	_tiling = other._tiling;
+	_keepData = other._keepData;
+	_reloadable = other._reloadable;
+	_lastUse = other._lastUse;
+	residency.moved(&other, this);
+	return *this;
+}
+
+ColorBufferObject2DBase::~ColorBufferObject2DBase()
+{
+	if (_handle)
+		_uninitialize();
+	// an evicted texture is still known for its data
+	residency.released(this);
+}
+
 void ColorBufferObject2DBase::setSize(int width, int height)
 {
 	assertFatal(_data.size() == 0, "Can not resize a texture that was initialized with data. The data dictates the required resolution.");
@@ -122,7 +205,7 @@ void ColorBufferObject2DBase::setSize(int width, int height)
 }
 
 ColorBufferObject2D::ColorBufferObject2D(ColorBufferFormat internalFormat, int width, int height, std::vector<std::vector<unsigned char>> dataPerMipLevel) :
-	ColorBufferObject2DBase(internalFormat, width, height, dataPerMipLevel)
+	ColorBufferObject2DBase(internalFormat, width, height, std::move(dataPerMipLevel))
 {
 	_mipLevels = 1;
 }
@@ -131,24 +214,24 @@ ColorBufferObject2D ColorBufferObject2D::fromQImage(const QImage& img, bool tile
 {
 	std::vector<std::vector<unsigned char>> data;
 	int numBytes = img.width() * img.height() * 4;
-	data.push_back(std::vector<unsigned char>(numBytes));
-	CopyMemory(&data[0][0], img.bits(), numBytes);
+	data.emplace_back(img.constBits(), img.constBits() + numBytes);
 	ColorBufferObject2D buf(srgb ? ColorBufferFormat::SRGB8_ALPHA8 : ColorBufferFormat::RGBA8,
-		img.width(), img.height(), data);
+		img.width(), img.height(), std::move(data));
 	buf.setTiling(tile);
 	return buf;
 }
 
 QImage ColorBufferObject2D::toQImage(int mipLevel)
 {
-	unsigned char* bytes = readBytes(mipLevel);
-	QImage img(bytes, _width, _height, QImage::Format_ARGB32);
-	delete bytes;
+	PooledBuffer bytes = readBytes(mipLevel);
+	int factor = 1 << mipLevel;
+	// img only wraps bytes, convert before they go back to the pool
+	QImage img(bytes.data(), _width / factor, _height / factor, QImage::Format_ARGB32);
 	return QGLWidget::convertToGLFormat(img); // this function can be applied to GL data to get Qt data again
 }
 
 ColorBufferObject3D::ColorBufferObject3D(ColorBufferFormat internalFormat, int width, int height, int depth, std::vector<std::vector<unsigned char>> dataPerMipLevel) :
-	_depth(depth), ColorBufferObject2DBase(internalFormat, width, height, dataPerMipLevel)
+	_depth(depth), ColorBufferObject2DBase(internalFormat, width, height, std::move(dataPerMipLevel))
 {
 }
 
@@ -183,6 +266,46 @@ void ColorBufferObject3D::_sizeChanged()
 		if (!mipLevel && _data.size() > 1)
 			_generateMipMaps();
 	}
+	if (_data.size() == 1 && _mipLevels > 1)
+		_generateMipMaps();
+}
+
+ColorBufferObject2DArray::ColorBufferObject2DArray(ColorBufferFormat internalFormat, int width, int height, int layers) :
+	_layers(layers), ColorBufferObject2DBase(internalFormat, width, height, {})
+{
+}
+
+void ColorBufferObject2DArray::setSize(int width, int height, int layers)
+{
+	if (width == _width && height == _height && layers == _layers)
+		return;
+	_width = width;
+	_height = height;
+	_layers = layers;
+	if (_handle != nullptr)
+		_sizeChanged();
+}
+
+void ColorBufferObject2DArray::_sizeChanged()
+{
+	// never called before initialize()
+
+	// reallocate with new size, layers are filled in later
+	glBindTexture(_textureType(), *(GLuint*)_handle);
+	for (int mipLevel = 0; mipLevel < _mipLevels; ++mipLevel)
+	{
+		// the short side of a wide image runs out of texels first, levels stay at least 1 texel so the texture is complete
+		int width = _width >> mipLevel;
+		int height = _height >> mipLevel;
+		gl.glTexImage3D(_textureType(), mipLevel, _internalFormat, width < 1 ? 1 : width, height < 1 ? 1 : height, _layers, 0, highLevelFormat(format()), formatDataType(format()), nullptr);
+	}
+}
+
+void ColorBufferObject2DArray::setLayer(int layer, const void* data)
+{
+	assert(0 <= layer && layer < _layers, "Layer %d is out of range.", layer);
+	bind();
+	gl.glTexSubImage3D(_textureType(), 0, 0, 0, layer, _width, _height, 1, highLevelFormat(format()), formatDataType(format()), data);
 }
 
 RenderBufferObject::RenderBufferObject(RenderBufferFormat internalFormat, int width, int height) :
@@ -208,6 +331,23 @@ void RenderBufferObject::_uninitialize()
 {
 	gl.glDeleteRenderbuffers(1, (GLuint*)_handle);
 	delete[] _handle;
+	_handle = nullptr;
+}
+
+RenderBufferObject& RenderBufferObject::operator=(RenderBufferObject&& other)
+{
+	if (this == &other)
+		return *this;
+	if (_handle)
+		_uninitialize();
+	BufferObject2DBase::operator=(std::move(other));
+	return *this;
+}
+
+RenderBufferObject::~RenderBufferObject()
+{
+	if (_handle)
+		_uninitialize();
 }
 
 void RenderBufferObject::bind()
@@ -215,15 +355,81 @@ void RenderBufferObject::bind()
 	gl.glBindRenderbuffer(GL_RENDERBUFFER, *(GLuint*)_handle);
 }
 
+void FrameBufferObject::_initialize()
+{
+	_handle = new GLint[1];
+	gl.glGenFramebuffers(1, (GLuint*)_handle);
+}
+
+void FrameBufferObject::_uninitialize()
+{
+	gl.glDeleteFramebuffers(1, (GLuint*)_handle);
+	delete[] _handle;
+	_handle = nullptr;
+}
+
+FrameBufferObject& FrameBufferObject::operator=(FrameBufferObject&& other)
+{
+	if (this == &other)
+		return *this;
+	if (_handle)
+		_uninitialize();
+	GraphicsHandleBase::operator=(std::move(other));
+	return *this;
+}
+
+FrameBufferObject::~FrameBufferObject()
+{
+	if (_handle)
+		_uninitialize();
+}
+
+bool FrameBufferObject::bind(ColorBufferObject2D& target)
+{
+	gl.glBindFramebuffer(GL_FRAMEBUFFER, handle<GLuint>());
+	gl.glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.handle<GLuint>(), 0);
+	glViewport(0, 0, target.width(), target.height());
+	return gl.glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void FrameBufferObject::unbind(GLuint framebuffer)
+{
+	gl.glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
 ShaderStorageBufferObject::ShaderStorageBufferObject(int size, char* data) :
 	_size(size),
 	_data(data)
 {
 }
 
+ShaderStorageBufferObject::ShaderStorageBufferObject(ShaderStorageBufferObject&& other) :
+	GraphicsHandleBase(std::move(other)),
+	_size(other._size),
+	_data(other._data)
+{
+	other._data = nullptr;
+}
+
+ShaderStorageBufferObject& ShaderStorageBufferObject::operator=(ShaderStorageBufferObject&& other)
+{
+	if (this == &other)
+		return *this;
+	if (_handle)
+		_uninitialize();
+	delete[] _data;
+	GraphicsHandleBase::operator=(std::move(other));
+	_size = other._size;
+	_data = other._data;
+	other._data = nullptr;
+	return *this;
+}
+
 ShaderStorageBufferObject::~ShaderStorageBufferObject()
 {
-	delete _data;
+	if (_handle)
+		_uninitialize();
+	delete[] _data;
 }
 
 void ShaderStorageBufferObject::_initialize()
@@ -240,13 +446,14 @@ void ShaderStorageBufferObject::_uninitialize()
 {
 	gl.glDeleteBuffers(1, (GLuint*)_handle);
 	delete[] _handle;
+	_handle = nullptr;
 }
 
 void ShaderStorageBufferObject::setSize(int size)
 {
 	assertFatal(!_data, "Resizing SSBO that is cerated from user data would lose the user data.");
 	_size = size;
-	delete _data;
+	delete[] _data;
 	_data = nullptr;
 	if (_handle)
 	{
@@ -258,7 +465,9 @@ void ShaderStorageBufferObject::setSize(int size)
 
 void ShaderStorageBufferObject::setData(int dataSize, char* data)
 {
-	delete _data;
+	// _initialize() uploads the data the buffer already owns
+	if (data != _data)
+		delete[] _data;
 	_size = dataSize;
 	_data = data;
 	if (_handle)
@@ -281,7 +490,7 @@ void ShaderStorageBufferObject::unbindAll()
 }
 
 ColorBufferObjectCube::ColorBufferObjectCube(ColorBufferFormat internalFormat, int size, std::vector<std::vector<unsigned char>> dataPerMipLevelPerFace) :
-	ColorBufferObject2DBase(internalFormat, size, size, dataPerMipLevelPerFace)
+	ColorBufferObject2DBase(internalFormat, size, size, std::move(dataPerMipLevelPerFace))
 {
 }
 
@@ -292,6 +501,14 @@ void ColorBufferObjectCube::setSize(int width, int height)
 	ColorBufferObject2DBase::setSize(width, height);
 }
 
+int64_t ColorBufferObjectCube::gpuBytes()
+{
+	int64_t pixels = 0;
+	for (int mipLevel = 0; mipLevel < _mipLevels; ++mipLevel)
+		pixels += 6 * (int64_t)(_width >> mipLevel) * (_height >> mipLevel);
+	return pixels * formatPixelBytes(format());
+}
+
 void ColorBufferObjectCube::_sizeChanged()
 {
 	// reallocate with the new size
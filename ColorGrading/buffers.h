@@ -2,7 +2,14 @@
 
 #include "bufferformats.h"
 #include "alerts.h"
+#include "bufferpool.h"
+#include "residency.h"
 
+/*
+Owns GL names, created on first use. Handles can be moved but not copied, so a GL name is deleted exactly once.
+The base destructor can not reach _uninitialize() of a subclass, every subclass that creates names deletes them in its own destructor.
+_uninitialize() must leave _handle null.
+*/
 class GraphicsHandleBase
 {
 protected:
@@ -10,7 +17,21 @@ protected:
 	virtual void _initialize() = 0;
 	virtual void _uninitialize() {};
 
+	// takes the handle of other, subclasses release their own handle before assigning
+	GraphicsHandleBase(GraphicsHandleBase&& other) : _handle(other._handle) { other._handle = nullptr; }
+	GraphicsHandleBase& operator=(GraphicsHandleBase&& other)
+	{
+		_handle = other._handle;
+		other._handle = nullptr;
+		return *this;
+	}
+
 public:
+	GraphicsHandleBase() {}
+	GraphicsHandleBase(const GraphicsHandleBase&) = delete;
+	GraphicsHandleBase& operator=(const GraphicsHandleBase&) = delete;
+	virtual ~GraphicsHandleBase() {}
+
 	template<typename T>
 	T handle()
 	{
@@ -18,8 +39,6 @@ public:
 			_initialize();
 		return *_handle;
 	}
-
-	virtual ~GraphicsHandleBase() { _uninitialize(); }
 };
 
 class BufferObject2DBase : public GraphicsHandleBase
@@ -44,9 +63,14 @@ public:
 class ColorBufferObject2DBase : public BufferObject2DBase
 {
 protected:
+	friend class ResidencyManager;
+
 	std::vector<std::vector<unsigned char>> _data;
 	int _mipLevels;
 	bool _tiling;
+	bool _keepData = true;
+	bool _reloadable = false;
+	uint64_t _lastUse = 0; // residency frame
 
 	virtual GLenum _textureType() = 0;
 
@@ -59,18 +83,22 @@ protected:
 	virtual int _numPixels(int factor) { return (_width * _height) / (factor * factor); }
 
 	template<typename T>
-	T* _read(GLenum format, int mipLevel = 0)
+	PooledBuffer _read(GLenum format, int mipLevel = 0)
 	{
 		int factor = 1 << mipLevel;
 		int bufferSize = highLevelFormatChannels(highLevelFormat((ColorBufferFormat)_internalFormat)) * _numPixels(factor);
-		T* result = new T[bufferSize];
+		PooledBuffer result = bufferPool.lease(bufferSize * sizeof(T));
 		bind();
-		glGetTexImage(_textureType(), mipLevel, highLevelFormat((ColorBufferFormat)_internalFormat), format, result);
+		glGetTexImage(_textureType(), mipLevel, highLevelFormat((ColorBufferFormat)_internalFormat), format, result.data());
 		return result;
 	}
 
 public:
+	// pass the data with std::move to hand it over without a copy
 	ColorBufferObject2DBase(ColorBufferFormat internalFormat, int width, int height, std::vector<std::vector<unsigned char>> dataPerMipLevel);
+	ColorBufferObject2DBase(ColorBufferObject2DBase&& other);
+	ColorBufferObject2DBase& operator=(ColorBufferObject2DBase&& other);
+	virtual ~ColorBufferObject2DBase();
 
 	virtual void setSize(int width, int height) override;
 
@@ -81,12 +109,34 @@ public:
 	inline bool tiling() { return _tiling; }
 
 	void setTiling(bool tiling);
-	inline void bind() { glBindTexture(_textureType(), handle<GLuint>()); }
+	/*
+	Without keepData the CPU copy is freed once it is uploaded, which halves the host memory of a texture made from an image.
+	The texture can not be evicted after that, see residency.h. Freed right away if the texture is on the GPU already.
+	*/
+	void setKeepData(bool keepData);
+	inline bool keepData() { return _keepData; }
+	inline void bind() { glBindTexture(_textureType(), handle<GLuint>()); _lastUse = residency.frame(); }
 	void generateMipMaps(int levels = 0);
-	void bindLoadStore(GLenum layout, GLenum mode = GL_WRITE_ONLY);
-
-	inline float* readFloats(int mipLevel = 0) { return _read<float>(GL_FLOAT, mipLevel); }
-	inline unsigned char* readBytes(int mipLevel = 0) { return _read<unsigned char>(GL_UNSIGNED_BYTE, mipLevel); }
+	void bindLoadStore(GLenum layout, GLenum mode = GL_WRITE_ONLY, int mipLevel = 0);
+
+	// the pixels in a block of bufferPool, it goes back to the pool with the lease
+	inline PooledBuffer readFloats(int mipLevel = 0) { return _read<float>(GL_FLOAT, mipLevel); }
+	inline PooledBuffer readBytes(int mipLevel = 0) { return _read<unsigned char>(GL_UNSIGNED_BYTE, mipLevel); }
+	// IEEE half floats, half the bandwidth of readFloats() and exact for 16F textures
+	inline PooledBuffer readHalves(int mipLevel = 0) { return _read<uint16_t>(GL_HALF_FLOAT, mipLevel); }
+
+	// residency, see residency.h
+	ResidencyType residencyType();
+	// all mip levels, an estimate as drivers may pad
+	virtual int64_t gpuBytes();
+	int64_t shadowBytes();
+	// the owner fills the texture again when it finds it evicted, see SourceBin::layer()
+	inline void setReloadable(bool reloadable) { _reloadable = reloadable; }
+	inline bool resident() { return _handle != nullptr; }
+	// only the buffers that were created from data or that their owner fills again can be evicted
+	inline bool evictable() { return !_data.empty() || _reloadable; }
+	// delete the GPU storage, the next use uploads the data again
+	void evict();
 };
 
 class ColorBufferObject2D : public ColorBufferObject2DBase
@@ -96,6 +146,7 @@ protected:
 
 public:
 	ColorBufferObject2D(ColorBufferFormat internalFormat, int width, int height, std::vector<std::vector<unsigned char>> dataPerMipLevel);
+	// the pixels are copied once, call setKeepData(false) on the result to free them after the upload
 	static ColorBufferObject2D fromQImage(const QImage& img, bool tile = false, bool srgb = false);
 	QImage toQImage(int mipLevel = 0);
 };
@@ -116,6 +167,28 @@ public:
 	void setSize(int width, int height, int depth);
 };
 
+/*
+Equally sized layers in one allocation, filled one layer at a time with setLayer().
+Mip levels only shrink the width and height, never the number of layers.
+*/
+class ColorBufferObject2DArray : public ColorBufferObject2DBase
+{
+protected:
+	int _layers;
+	inline virtual GLenum _textureType() override { return GL_TEXTURE_2D_ARRAY; }
+	virtual int _numPixels(int factor) override { return (_width * _height) / (factor * factor) * _layers; }
+	virtual void _sizeChanged() override;
+
+public:
+	ColorBufferObject2DArray(ColorBufferFormat internalFormat, int width, int height, int layers);
+
+	inline int layers() { return _layers; }
+
+	void setSize(int width, int height, int layers);
+	// upload the first mip level of a layer, data is width x height pixels laid out like the format
+	void setLayer(int layer, const void* data);
+};
+
 class RenderBufferObject : public BufferObject2DBase
 {
 protected:
@@ -125,10 +198,34 @@ protected:
 
 public:
 	RenderBufferObject(RenderBufferFormat internalFormat, int width, int height);
+	RenderBufferObject(RenderBufferObject&& other) = default;
+	RenderBufferObject& operator=(RenderBufferObject&& other);
+	virtual ~RenderBufferObject();
 	inline RenderBufferFormat format() { return (RenderBufferFormat)_internalFormat; }
 	void bind();
 };
 
+/*
+Draws into the first mip level of a texture instead of the window, e.g. to grade at full resolution into half floats.
+Unbind with the id of the framebuffer to go back to, QOpenGLWidget draws into its own.
+*/
+class FrameBufferObject : public GraphicsHandleBase
+{
+protected:
+	virtual void _initialize() override;
+	virtual void _uninitialize() override;
+
+public:
+	FrameBufferObject() {}
+	FrameBufferObject(FrameBufferObject&& other) : GraphicsHandleBase(std::move(other)) {}
+	FrameBufferObject& operator=(FrameBufferObject&& other);
+	virtual ~FrameBufferObject();
+
+	// attach the texture as the only color target and cover it with the viewport, false if the driver can not draw into it
+	bool bind(ColorBufferObject2D& target);
+	static void unbind(GLuint framebuffer);
+};
+
 class ShaderStorageBufferObject : public GraphicsHandleBase
 {
 protected:
@@ -139,7 +236,10 @@ protected:
 	virtual void _uninitialize() override;
 
 public:
+	// the buffer owns data, it has to come from new[]
 	ShaderStorageBufferObject(int size, char* data = nullptr);
+	ShaderStorageBufferObject(ShaderStorageBufferObject&& other);
+	ShaderStorageBufferObject& operator=(ShaderStorageBufferObject&& other);
 	virtual ~ShaderStorageBufferObject();
 	void setSize(int size);
 	void setData(int dataSize, char* data);
@@ -148,14 +248,15 @@ public:
 
 	inline int sizeInBytes() { return _size; }
 
-	template<typename T> T* read()
+	// the contents in a block of bufferPool, read it with data<T>()
+	PooledBuffer read()
 	{
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, *(GLuint*)_handle);
-		char* ptr = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-		int bufferSize = _size / sizeof(T);
-		T* buffer = new T[bufferSize];
-		CopyMemory(buffer, ptr, _size);
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		PooledBuffer buffer = bufferPool.lease(_size);
+		gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, handle<GLuint>());
+		void* ptr = gl.glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+		CopyMemory(buffer.data(), ptr, _size);
+		gl.glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 		return buffer;
 	}
 };
@@ -170,16 +271,18 @@ protected:
 	inline virtual GLenum _textureType() override { return GL_TEXTURE_CUBE_MAP; }
 
 	virtual int _numPixels(int factor) { return (_width * _width * _width) / (factor * factor * factor); }
+	virtual int64_t gpuBytes() override;
 
 	template<typename T>
-	T* _read(GLenum format, int face, int mipLevel = 0)
+	PooledBuffer _read(GLenum format, int face, int mipLevel = 0)
 	{
 		assert(0 <= mipLevel && mipLevel < _mipLevels);
 		int factor = 1 << mipLevel;
-		int bufferSize = highLevelFormatChannels(highLevelFormat((ColorBufferFormat)_internalFormat)) * _numPixels(factor);
-		T* result = new T[bufferSize];
+		// one face
+		int bufferSize = highLevelFormatChannels(highLevelFormat((ColorBufferFormat)_internalFormat)) * (_width / factor) * (_height / factor);
+		PooledBuffer result = bufferPool.lease(bufferSize * sizeof(T));
 		bind();
-		glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mipLevel, highLevelFormat((ColorBufferFormat)_internalFormat), format, result);
+		glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mipLevel, highLevelFormat((ColorBufferFormat)_internalFormat), format, result.data());
 		return result;
 	}
 
@@ -191,6 +294,6 @@ public:
 	inline void setSize(int size) { setSize(size, size); }
 	virtual void setSize(int width, int height) override;
 
-	inline float* readFloats(int face, int mipLevel = 0) { return _read<float>(GL_FLOAT, face, mipLevel); }
-	inline unsigned char* readBytes(int face, int mipLevel = 0) { return _read<unsigned char>(GL_UNSIGNED_BYTE, face, mipLevel); }
+	inline PooledBuffer readFloats(int face, int mipLevel = 0) { return _read<float>(GL_FLOAT, face, mipLevel); }
+	inline PooledBuffer readBytes(int face, int mipLevel = 0) { return _read<unsigned char>(GL_UNSIGNED_BYTE, face, mipLevel); }
 };
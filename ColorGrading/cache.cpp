@@ -0,0 +1,182 @@
+#include "cache.h"
+#include "hashing.h"
+#include "alerts.h"
+#include <QDir>
+#include <QSaveFile>
+#include <QTextStream>
+
+const char* CACHE_INDEX_NAME = "index.txt";
+
+QString CacheKey::name() const
+{
+	return QString("%1-%2-%3-v%4")
+		.arg(kind)
+		.arg(source, 16, 16, QChar('0'))
+		.arg(settings, 16, 16, QChar('0'))
+		.arg(version);
+}
+
+CacheEntry::CacheEntry(std::unique_ptr<QFile> file, const unsigned char* data, qint64 size) :
+	_file(std::move(file)), _data(data), _size(size)
+{
+}
+
+GradeCache::GradeCache(const QString& directory, qint64 maxBytes) :
+	_directory(directory), _maxBytes(maxBytes)
+{
+	QDir().mkpath(_directory);
+	_loadIndex();
+}
+
+GradeCache::~GradeCache()
+{
+	_saveIndex();
+}
+
+void GradeCache::_loadIndex()
+{
+	// files on disk are the truth, the index only adds the use order
+	QDir dir(_directory);
+	for (const QFileInfo& info : dir.entryInfoList(QDir::Files))
+	{
+		if (info.fileName() == CACHE_INDEX_NAME)
+			continue;
+		_items[info.fileName()] = { info.size(), 0 };
+		_useOrder.insert(std::make_pair((qint64)0, info.fileName()));
+		_totalBytes += info.size();
+	}
+
+	QFile fh(dir.filePath(CACHE_INDEX_NAME));
+	if (!fh.open(QFile::ReadOnly | QFile::Text))
+		return;
+	QTextStream stream(&fh);
+	while (!stream.atEnd())
+	{
+		QStringList parts = stream.readLine().split(' ');
+		if (parts.size() != 2)
+			continue;
+		auto it = _items.find(parts[0]);
+		if (it == _items.end())
+			continue;
+		_setLastUse(it, parts[1].toLongLong());
+		if (it->second.lastUse > _clock)
+			_clock = it->second.lastUse;
+	}
+}
+
+void GradeCache::_saveIndex()
+{
+	QSaveFile fh(QDir(_directory).filePath(CACHE_INDEX_NAME));
+	if (!fh.open(QFile::WriteOnly | QFile::Text))
+		return;
+	QTextStream stream(&fh);
+	for (const auto& it : _items)
+		stream << it.first << ' ' << it.second.lastUse << '\n';
+	stream.flush();
+	fh.commit();
+}
+
+void GradeCache::_remove(const QString& name)
+{
+	auto it = _items.find(name);
+	if (it == _items.end())
+		return;
+	QFile::remove(QDir(_directory).filePath(name));
+	_totalBytes -= it->second.size;
+	_useOrder.erase(std::make_pair(it->second.lastUse, name));
+	_items.erase(it);
+}
+
+void GradeCache::_setLastUse(std::map<QString, Item>::iterator it, qint64 lastUse)
+{
+	_useOrder.erase(std::make_pair(it->second.lastUse, it->first));
+	it->second.lastUse = lastUse;
+	_useOrder.insert(std::make_pair(lastUse, it->first));
+}
+
+CacheEntry GradeCache::find(const CacheKey& key)
+{
+	QString name = key.name();
+	std::lock_guard<std::mutex> guard(_mutex);
+	auto it = _items.find(name);
+	if (it == _items.end() || it->second.size == 0)
+	{
+		++_misses;
+		return CacheEntry();
+	}
+
+	std::unique_ptr<QFile> fh(new QFile(QDir(_directory).filePath(name)));
+	const unsigned char* data = nullptr;
+	if (fh->open(QFile::ReadOnly))
+		data = fh->map(0, fh->size());
+	if (!data)
+	{
+		// deleted or corrupted behind our back
+		_remove(name);
+		++_misses;
+		return CacheEntry();
+	}
+
+	_setLastUse(it, ++_clock);
+	++_hits;
+	qint64 size = fh->size();
+	return CacheEntry(std::move(fh), data, size);
+}
+
+bool GradeCache::store(const CacheKey& key, const void* data, qint64 size)
+{
+	QString name = key.name();
+	// write to a temporary file and rename, so other processes never map a half written entry
+	QSaveFile fh(QDir(_directory).filePath(name));
+	if (!fh.open(QFile::WriteOnly) || fh.write((const char*)data, size) != size || !fh.commit())
+	{
+		CONVERT_QSTRING(name, text);
+		warningd("Could not write cache entry '%s'", text);
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(_mutex);
+	auto existing = _items.find(name);
+	if (existing != _items.end())
+		_totalBytes -= existing->second.size;
+	else
+		existing = _items.insert(std::make_pair(name, Item{ size, 0 })).first;
+	existing->second.size = size;
+	_setLastUse(existing, ++_clock);
+	_totalBytes += size;
+	_trim();
+	return true;
+}
+
+void GradeCache::trim()
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+	_trim();
+}
+
+void GradeCache::_trim()
+{
+	while (_totalBytes > _maxBytes && !_useOrder.empty())
+	{
+		// a copy, _remove() erases the entry it points at
+		QString oldest = _useOrder.begin()->second;
+		_remove(oldest);
+	}
+}
+
+bool hashFile(const QString& filePath, uint64_t& hash)
+{
+	QFile fh(filePath);
+	if (!fh.open(QFile::ReadOnly))
+		return false;
+	if (fh.size() == 0)
+	{
+		hash = hashBytes(nullptr, 0);
+		return true;
+	}
+	const unsigned char* data = fh.map(0, fh.size());
+	if (!data)
+		return false;
+	hash = hashBytes(data, (size_t)fh.size());
+	fh.unmap((uchar*)data);
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QFile>
+#include <QString>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+// Everything a cached result depends on
+struct CacheKey
+{
+	QString kind; // what is stored, e.g. "png" or "lut33"
+	uint64_t source; // hash of the source content, 0 if there is no source
+	uint64_t settings; // hashGradingSettings()
+	uint32_t version; // GRADING_ENGINE_VERSION
+
+	QString name() const;
+};
+
+// Read only view of a cache file, mapped into memory. Invalid on a cache miss.
+class CacheEntry
+{
+protected:
+	std::unique_ptr<QFile> _file;
+	const unsigned char* _data = nullptr;
+	qint64 _size = 0;
+
+public:
+	CacheEntry() {}
+	CacheEntry(std::unique_ptr<QFile> file, const unsigned char* data, qint64 size);
+
+	inline bool valid() const { return _data != nullptr; }
+	inline const unsigned char* data() const { return _data; }
+	inline qint64 size() const { return _size; }
+};
+
+/*
+Content addressed disk cache for graded frames and baked LUTs.
+
+Files are named after their key, so a hit is a file lookup and a memory map, nothing gets parsed or copied.
+The least recently used files are deleted when the total size exceeds the budget,
+use order survives between runs in an index file next to the entries.
+Threads of one batch can share a cache, see hybrid.h.
+*/
+class GradeCache
+{
+protected:
+	struct Item
+	{
+		qint64 size;
+		qint64 lastUse;
+	};
+
+	QString _directory;
+	qint64 _maxBytes;
+	qint64 _totalBytes = 0;
+	qint64 _clock = 0;
+	std::map<QString, Item> _items;
+	// (lastUse, name) of every item, least recently used first, so trimming doesn't search
+	std::set<std::pair<qint64, QString>> _useOrder;
+	int _hits = 0;
+	int _misses = 0;
+	std::mutex _mutex;
+
+	void _loadIndex();
+	void _saveIndex();
+	void _remove(const QString& name);
+	void _setLastUse(std::map<QString, Item>::iterator it, qint64 lastUse);
+	void _trim();
+
+public:
+	GradeCache(const QString& directory, qint64 maxBytes);
+	~GradeCache();
+
+	CacheEntry find(const CacheKey& key);
+	// stores the data and trims the cache back to its budget
+	bool store(const CacheKey& key, const void* data, qint64 size);
+	void trim();
+
+	inline qint64 totalBytes() const { return _totalBytes; }
+	inline int hits() const { return _hits; }
+	inline int misses() const { return _misses; }
+};
+
+// Hash of a file's content, mapped instead of read. Returns false if the file can not be read.
+bool hashFile(const QString& filePath, uint64_t& hash);
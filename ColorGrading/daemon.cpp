@@ -0,0 +1,373 @@
+#include "daemon.h"
+#include "alerts.h"
+#include "lut.h"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QtEndian>
+#include <deque>
+#include <map>
+#include <vector>
+
+// LUTs the daemon keeps baked across clients, about 3 MB each
+const int DAEMON_MAX_LUTS = 64;
+// messages only carry settings and slots, frames go through the ring
+const quint32 DAEMON_MAX_MESSAGE_SIZE = 64 * 1024;
+
+static QByteArray frameMessage(const QByteArray& payload)
+{
+	QByteArray message(4, 0);
+	qToBigEndian<quint32>(payload.size(), (uchar*)message.data());
+	return message + payload;
+}
+
+// pop the next complete message off what has been received so far.
+// invalid is set for a length no peer of this protocol sends, the connection can not be trusted after that
+static bool takeMessage(QByteArray& inbox, QByteArray& payload, bool& invalid)
+{
+	invalid = false;
+	if (inbox.size() < 4)
+		return false;
+	quint32 size = qFromBigEndian<quint32>((const uchar*)inbox.constData());
+	if (size > DAEMON_MAX_MESSAGE_SIZE)
+	{
+		invalid = true;
+		return false;
+	}
+	if ((quint32)inbox.size() - 4 < size)
+		return false;
+	payload = inbox.mid(4, (int)size);
+	inbox.remove(0, 4 + (int)size);
+	return true;
+}
+
+struct DaemonSession
+{
+	QLocalSocket* socket;
+	QByteArray inbox;
+	QSharedMemory ring;
+	int width = 0;
+	int height = 0;
+	int slots = 0;
+	std::map<quint32, GradingSettings> grades;
+	std::deque<std::pair<int, quint32>> queue;
+	// warm per client, grades that can't be baked run through these
+	CpuGrader grader;
+	FloatImage source;
+	FloatImage graded;
+
+	inline int frameBytes() const { return width * height * 4; }
+};
+
+class GradingDaemon
+{
+protected:
+	QLocalServer _server;
+	std::vector<std::unique_ptr<DaemonSession>> _sessions;
+	size_t _next = 0;
+	bool _pumpScheduled = false;
+	std::map<uint64_t, std::vector<float>> _luts;
+
+	void _accept()
+	{
+		while (QLocalSocket* socket = _server.nextPendingConnection())
+		{
+			DaemonSession* session = new DaemonSession();
+			session->socket = socket;
+			_sessions.emplace_back(session);
+			QObject::connect(socket, &QLocalSocket::readyRead, [=]() { _receive(session); });
+			QObject::connect(socket, &QLocalSocket::disconnected, [=]() { _drop(session); });
+		}
+	}
+
+	void _drop(DaemonSession* session)
+	{
+		for (size_t i = 0; i < _sessions.size(); ++i)
+		{
+			if (_sessions[i].get() != session)
+				continue;
+			session->socket->deleteLater();
+			_sessions.erase(_sessions.begin() + i);
+			_next = _sessions.empty() ? 0 : _next % _sessions.size();
+			return;
+		}
+	}
+
+	void _send(DaemonSession* session, DaemonMessage type, int slot, const char* error = nullptr)
+	{
+		QByteArray payload;
+		QDataStream stream(&payload, QIODevice::WriteOnly);
+		stream << (quint8)type;
+		if (type == DaemonMessage::done)
+			stream << (qint32)slot;
+		else
+			stream << QString(error);
+		session->socket->write(frameMessage(payload));
+	}
+
+	void _receive(DaemonSession* session)
+	{
+		session->inbox += session->socket->readAll();
+		QByteArray payload;
+		bool invalid;
+		while (takeMessage(session->inbox, payload, invalid))
+			_handle(session, payload);
+		if (invalid)
+		{
+			warningd("Grading daemon: dropping a client that sent a message of more than %u bytes", DAEMON_MAX_MESSAGE_SIZE);
+			// the signals would reach the session after it is gone
+			QObject::disconnect(session->socket, nullptr, nullptr, nullptr);
+			session->socket->abort();
+			_drop(session);
+		}
+	}
+
+	void _handle(DaemonSession* session, const QByteArray& payload)
+	{
+		QDataStream stream(payload);
+		quint8 type;
+		stream >> type;
+		switch ((DaemonMessage)type)
+		{
+		case DaemonMessage::attach:
+		{
+			QString key;
+			qint32 width, height, slots;
+			stream >> key >> width >> height >> slots;
+			// a new ring replaces the old one, frames queued for the old one are dropped
+			if (session->ring.isAttached())
+				session->ring.detach();
+			session->queue.clear();
+			session->width = session->height = session->slots = 0;
+			if (stream.status() != QDataStream::Ok || width <= 0 || height <= 0 || slots <= 0
+				|| width > DAEMON_MAX_FRAME_SIZE || height > DAEMON_MAX_FRAME_SIZE || slots > DAEMON_MAX_RING_SLOTS)
+			{
+				_send(session, DaemonMessage::error, 0, "Invalid frame ring size");
+				return;
+			}
+			session->ring.setKey(key);
+			if (!session->ring.attach() || (qint64)session->ring.size() < (qint64)slots * 2 * width * height * 4)
+			{
+				if (session->ring.isAttached())
+					session->ring.detach();
+				_send(session, DaemonMessage::error, 0, "Could not attach to the frame ring");
+				return;
+			}
+			session->width = width;
+			session->height = height;
+			session->slots = slots;
+			break;
+		}
+		case DaemonMessage::grade:
+		{
+			quint32 id;
+			float values[GRADING_SETTINGS_VALUES];
+			stream >> id;
+			for (float& value : values)
+				stream >> value;
+			session->grades[id] = unpackGradingSettings(values);
+			break;
+		}
+		case DaemonMessage::frame:
+		{
+			qint32 slot;
+			quint32 grade;
+			stream >> slot >> grade;
+			if (slot < 0 || slot >= session->slots || !session->grades.count(grade))
+			{
+				_send(session, DaemonMessage::error, slot, "Frame refers to an unknown slot or grade");
+				return;
+			}
+			session->queue.push_back(std::make_pair((int)slot, grade));
+			_schedule();
+			break;
+		}
+		default:
+			_send(session, DaemonMessage::error, 0, "Unknown message");
+		}
+	}
+
+	// grade from the event loop, so messages keep flowing between frames
+	void _schedule()
+	{
+		if (_pumpScheduled)
+			return;
+		_pumpScheduled = true;
+		QTimer::singleShot(0, [=]() { _pump(); });
+	}
+
+	void _pump()
+	{
+		_pumpScheduled = false;
+
+		// one frame of the next client with work, in turn
+		size_t count = _sessions.size();
+		for (size_t n = 0; n < count; ++n)
+		{
+			size_t index = (_next + n) % count;
+			DaemonSession* session = _sessions[index].get();
+			if (session->queue.empty())
+				continue;
+			_next = (index + 1) % count;
+			std::pair<int, quint32> job = session->queue.front();
+			session->queue.pop_front();
+			_grade(session, job.first, session->grades[job.second]);
+			_send(session, DaemonMessage::done, job.first);
+			break;
+		}
+
+		for (auto& session : _sessions)
+			if (!session->queue.empty())
+				_schedule();
+	}
+
+	void _grade(DaemonSession* session, int slot, const GradingSettings& settings)
+	{
+		const unsigned char* input = (const unsigned char*)session->ring.constData() + (size_t)slot * 2 * session->frameBytes();
+		unsigned char* output = (unsigned char*)session->ring.data() + ((size_t)slot * 2 + 1) * session->frameBytes();
+		if (isLutGrade(settings))
+		{
+			applyLutRows(_lut(settings), input, session->width * 4, output, session->width * 4, session->width, session->height,
+				LutPixelFormat::rgba8, LutInterpolation::tetrahedral);
+			return;
+		}
+		session->source.setRgba8(input, session->width, session->height);
+		session->grader.setSource(session->source);
+		session->grader.grade(settings, session->graded);
+		session->graded.toRgba8(output);
+	}
+
+	Lut3D _lut(const GradingSettings& settings)
+	{
+		uint64_t hash = hashGradingSettings(settings);
+		if (!_luts.count(hash))
+		{
+			// forget old LUTs instead of growing forever
+			if (_luts.size() >= DAEMON_MAX_LUTS)
+				_luts.clear();
+			_luts[hash] = bakeLut(settings, BAKED_LUT_SIZE);
+		}
+		return { BAKED_LUT_SIZE, &_luts[hash][0] };
+	}
+
+public:
+	bool listen(const QString& name)
+	{
+		// a daemon that crashed can leave its socket file behind
+		QLocalServer::removeServer(name);
+		QObject::connect(&_server, &QLocalServer::newConnection, [=]() { _accept(); });
+		return _server.listen(name);
+	}
+};
+
+int runDaemon(const QString& name)
+{
+	GradingDaemon daemon;
+	CONVERT_QSTRING(name, text);
+	if (!daemon.listen(name))
+	{
+		errord("Could not listen on '%s'", text);
+		return 1;
+	}
+	infod("Grading daemon listening on '%s'", text);
+	return QCoreApplication::exec();
+}
+
+DaemonConnection::DaemonConnection()
+{
+}
+
+DaemonConnection::~DaemonConnection()
+{
+	if (_socket)
+		_socket->disconnectFromServer();
+}
+
+bool DaemonConnection::_send(const QByteArray& payload)
+{
+	_socket->write(frameMessage(payload));
+	while (_socket->bytesToWrite())
+		if (!_socket->waitForBytesWritten(DAEMON_TIMEOUT_MS))
+			return false;
+	return true;
+}
+
+bool DaemonConnection::connect(const QString& name, int width, int height, int slots)
+{
+	_socket.reset(new QLocalSocket());
+	_socket->connectToServer(name);
+	if (!_socket->waitForConnected(DAEMON_TIMEOUT_MS))
+		return false;
+
+	static int rings = 0;
+	QString key = QString("%1-%2-%3").arg(name).arg(QCoreApplication::applicationPid()).arg(rings++);
+	_frameBytes = width * height * 4;
+	_slots = slots;
+	_ring.setKey(key);
+	if (!_ring.create(slots * 2 * _frameBytes))
+		return false;
+
+	QByteArray payload;
+	QDataStream stream(&payload, QIODevice::WriteOnly);
+	stream << (quint8)DaemonMessage::attach << key << (qint32)width << (qint32)height << (qint32)slots;
+	return _send(payload);
+}
+
+uint32_t DaemonConnection::addGrade(const GradingSettings& settings)
+{
+	float values[GRADING_SETTINGS_VALUES];
+	packGradingSettings(settings, values);
+	uint32_t id = ++_nextGrade;
+
+	QByteArray payload;
+	QDataStream stream(&payload, QIODevice::WriteOnly);
+	stream << (quint8)DaemonMessage::grade << (quint32)id;
+	for (float value : values)
+		stream << value;
+	return _send(payload) ? id : 0;
+}
+
+bool DaemonConnection::submit(int slot, uint32_t grade)
+{
+	QByteArray payload;
+	QDataStream stream(&payload, QIODevice::WriteOnly);
+	stream << (quint8)DaemonMessage::frame << (qint32)slot << (quint32)grade;
+	return _send(payload);
+}
+
+bool DaemonConnection::waitDone(int& slot)
+{
+	for (;;)
+	{
+		QByteArray payload;
+		bool invalid;
+		if (takeMessage(_inbox, payload, invalid))
+		{
+			QDataStream stream(payload);
+			quint8 type;
+			stream >> type;
+			if ((DaemonMessage)type == DaemonMessage::done)
+			{
+				qint32 done;
+				stream >> done;
+				slot = done;
+				return true;
+			}
+			QString error;
+			stream >> error;
+			CONVERT_QSTRING(error, text);
+			errord("Grading daemon: %s", text);
+			return false;
+		}
+		if (invalid)
+		{
+			errord("Grading daemon: sent a message of more than %u bytes", DAEMON_MAX_MESSAGE_SIZE);
+			return false;
+		}
+		if (!_socket->waitForReadyRead(-1))
+			return false;
+		_inbox += _socket->readAll();
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "grading.h"
+#include <QByteArray>
+#include <QSharedMemory>
+#include <QString>
+#include <cstdint>
+#include <memory>
+
+class QLocalSocket;
+
+// Frames a client can have in flight unless it asks for more
+const int DAEMON_RING_SLOTS = 4;
+const int DAEMON_TIMEOUT_MS = 5000;
+// The largest rings the daemon attaches to, per side of a frame and in slots
+const int DAEMON_MAX_FRAME_SIZE = 16384;
+const int DAEMON_MAX_RING_SLOTS = 64;
+
+/*
+Long running grading service, started with --serve <name>, that keeps the CPU engine and baked LUTs warm between jobs.
+
+Clients connect to a QLocalServer (a unix socket, a named pipe on windows) and exchange frames through
+a shared memory ring they create. The socket only carries small messages, each a quint32 size followed by
+a QDataStream of the message type and its fields:
+
+	client -> daemon
+	attach	key, width, height, slots	the ring to grade in
+	grade	id, GRADING_SETTINGS_VALUES floats	a grade later frames refer to by id
+	frame	slot, grade id	the input half of the slot holds a frame to grade
+	daemon -> client
+	done	slot	the output half of the slot holds the graded frame
+	error	text
+
+A ring slot holds an RGBA8 input frame followed by the RGBA8 output frame.
+Clients can't have more frames in flight than their ring has slots, which is their backpressure.
+The daemon grades one frame per client in turn, so a client with a long queue can't starve the others.
+*/
+enum class DaemonMessage : quint8
+{
+	attach,
+	grade,
+	frame,
+	done,
+	error,
+};
+
+// Serve until the application quits, requires a QCoreApplication
+int runDaemon(const QString& name);
+
+// Client side of the daemon protocol, blocking and meant for a single thread
+class DaemonConnection
+{
+protected:
+	std::unique_ptr<QLocalSocket> _socket;
+	QSharedMemory _ring;
+	int _frameBytes = 0;
+	int _slots = 0;
+	uint32_t _nextGrade = 0;
+	QByteArray _inbox;
+
+	bool _send(const QByteArray& payload);
+
+public:
+	DaemonConnection();
+	~DaemonConnection();
+
+	bool connect(const QString& name, int width, int height, int slots = DAEMON_RING_SLOTS);
+
+	inline int slots() const { return _slots; }
+	inline unsigned char* input(int slot) { return (unsigned char*)_ring.data() + slot * 2 * _frameBytes; }
+	inline const unsigned char* output(int slot) const { return (const unsigned char*)_ring.constData() + (slot * 2 + 1) * _frameBytes; }
+
+	// send a grade once and refer to it by the returned id, 0 if it could not be sent
+	uint32_t addGrade(const GradingSettings& settings);
+	// grade the frame in input(slot)
+	bool submit(int slot, uint32_t grade);
+	// block until a frame is done, false if the daemon went away or reported an error
+	bool waitDone(int& slot);
+};
@@ -0,0 +1,408 @@
+#include "framepipe.h"
+#include "alerts.h"
+#include <QtCore/qfloat16.h>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+bool parseFrameLayout(const QString& name, FrameLayout& layout)
+{
+	if (name == "rgb8")
+		layout = FrameLayout::rgb8;
+	else if (name == "rgba8")
+		layout = FrameLayout::rgba8;
+	else if (name == "rgba16f")
+		layout = FrameLayout::rgba16f;
+	else if (name == "y4m")
+		layout = FrameLayout::y4m;
+	else
+		return false;
+	return true;
+}
+
+// stdin and stdout translate line endings on windows unless told otherwise
+static bool openStandardStream(QFile& file, FILE* fh, QIODevice::OpenMode mode)
+{
+#ifdef _WIN32
+	_setmode(_fileno(fh), _O_BINARY);
+#endif
+	return file.open(fh, mode | QIODevice::Unbuffered);
+}
+
+static inline int chromaWidth(const FrameStreamFormat& format) { return format.chroma420 ? (format.width + 1) / 2 : format.width; }
+static inline int chromaHeight(const FrameStreamFormat& format) { return format.chroma420 ? (format.height + 1) / 2 : format.height; }
+
+// in 64 bit, rgba16f frames of the largest size are 2 GB
+static qint64 frameBytes(const FrameStreamFormat& format)
+{
+	qint64 pixels = (qint64)format.width * format.height;
+	switch (format.layout)
+	{
+	case FrameLayout::rgb8: return pixels * 3;
+	case FrameLayout::rgba8: return pixels * 4;
+	case FrameLayout::rgba16f: return pixels * 8;
+	case FrameLayout::y4m: return pixels + 2 * chromaWidth(format) * chromaHeight(format);
+	}
+	return 0;
+}
+
+// pipes can return less than asked for, keep going until the frame is complete.
+// returns the bytes read, less than size if the stream ended first and -1 if reading failed
+static qint64 readFully(QFile& file, unsigned char* data, qint64 size)
+{
+	qint64 total = 0;
+	while (total < size)
+	{
+		qint64 read = file.read((char*)data + total, size - total);
+		if (read < 0)
+			return -1;
+		if (read == 0)
+			break;
+		total += read;
+	}
+	return total;
+}
+
+static bool writeFully(QFile& file, const unsigned char* data, qint64 size)
+{
+	while (size > 0)
+	{
+		qint64 written = file.write((const char*)data, size);
+		if (written <= 0)
+			return false;
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+static inline unsigned char clampByte(float value) { return value <= 0.0f ? 0 : (value >= 255.0f ? 255 : (unsigned char)(value + 0.5f)); }
+
+// BT.709 luma coefficients
+const float KR = 0.2126f;
+const float KB = 0.0722f;
+
+static void yuvToRgb(float y, float cb, float cr, bool fullRange, unsigned char* rgb)
+{
+	// to 0-1 luma and -0.5-0.5 chroma
+	if (fullRange)
+	{
+		y = y / 255.0f;
+		cb = (cb - 128.0f) / 255.0f;
+		cr = (cr - 128.0f) / 255.0f;
+	}
+	else
+	{
+		y = (y - 16.0f) / 219.0f;
+		cb = (cb - 128.0f) / 224.0f;
+		cr = (cr - 128.0f) / 224.0f;
+	}
+	float r = y + 2.0f * (1.0f - KR) * cr;
+	float b = y + 2.0f * (1.0f - KB) * cb;
+	float g = (y - KR * r - KB * b) / (1.0f - KR - KB);
+	rgb[0] = clampByte(r * 255.0f);
+	rgb[1] = clampByte(g * 255.0f);
+	rgb[2] = clampByte(b * 255.0f);
+}
+
+static void rgbToYuv(const unsigned char* rgb, bool fullRange, float& y, float& cb, float& cr)
+{
+	float r = rgb[0] / 255.0f;
+	float g = rgb[1] / 255.0f;
+	float b = rgb[2] / 255.0f;
+	y = KR * r + (1.0f - KR - KB) * g + KB * b;
+	cb = (b - y) / (2.0f * (1.0f - KB));
+	cr = (r - y) / (2.0f * (1.0f - KR));
+	if (fullRange)
+	{
+		y = y * 255.0f;
+		cb = cb * 255.0f + 128.0f;
+		cr = cr * 255.0f + 128.0f;
+	}
+	else
+	{
+		y = y * 219.0f + 16.0f;
+		cb = cb * 224.0f + 128.0f;
+		cr = cr * 224.0f + 128.0f;
+	}
+}
+
+static inline float halfToFloat(const unsigned char* data)
+{
+	qfloat16 half;
+	memcpy(&half, data, sizeof(half));
+	return (float)half;
+}
+
+static inline void floatToHalf(float value, unsigned char* data)
+{
+	qfloat16 half(value);
+	memcpy(data, &half, sizeof(half));
+}
+
+bool FrameReader::open(const QString& path, const FrameStreamFormat& format)
+{
+	_format = format;
+	bool opened;
+	if (path == "-")
+		opened = openStandardStream(_file, stdin, QIODevice::ReadOnly);
+	else
+	{
+		_file.setFileName(path);
+		opened = _file.open(QIODevice::ReadOnly);
+	}
+	if (!opened || (_format.layout == FrameLayout::y4m && !_readHeader()))
+		return false;
+	if (_format.width <= 0 || _format.height <= 0 || _format.width > FRAME_STREAM_MAX_SIZE || _format.height > FRAME_STREAM_MAX_SIZE)
+	{
+		errord("Frame size %dx%d is not supported, at most %dx%d", _format.width, _format.height, FRAME_STREAM_MAX_SIZE, FRAME_STREAM_MAX_SIZE);
+		return false;
+	}
+	_buffer.resize((size_t)frameBytes(_format));
+	return true;
+}
+
+bool FrameReader::_readHeader()
+{
+	QByteArray header = _file.readLine().trimmed();
+	if (!header.startsWith("YUV4MPEG2"))
+	{
+		errord("Not a y4m stream");
+		return false;
+	}
+	_format.chroma420 = true; // the default when there is no C parameter
+	for (const QByteArray& token : header.split(' '))
+	{
+		if (token.isEmpty())
+			continue;
+		QByteArray value = token.mid(1);
+		switch (token[0])
+		{
+		case 'W': _format.width = value.toInt(); break;
+		case 'H': _format.height = value.toInt(); break;
+		case 'F': _format.frameRate = value; break;
+		case 'X': _format.fullRange = _format.fullRange || value == "COLORRANGE=FULL"; break;
+		case 'C':
+			if (value == "444")
+				_format.chroma420 = false;
+			else if (!value.startsWith("420") || value.contains("p1"))
+			{
+				errord("Unsupported y4m chroma format '%s', use 444 or 420 with 8 bits", value.constData());
+				return false;
+			}
+			break;
+		}
+	}
+	return true;
+}
+
+bool FrameReader::read()
+{
+	if (_format.layout == FrameLayout::y4m)
+	{
+		// FRAME, optionally followed by parameters. nothing at all is the end of the stream
+		QByteArray frameHeader = _file.readLine();
+		if (frameHeader.isEmpty())
+			return false;
+		if (!frameHeader.startsWith("FRAME"))
+		{
+			errord("Expected a y4m FRAME header");
+			_failed = true;
+			return false;
+		}
+	}
+	qint64 size = (qint64)_buffer.size();
+	qint64 read = readFully(_file, &_buffer[0], size);
+	if (read == size)
+		return true;
+	// the end of the stream is only between frames, a y4m frame header promises a whole frame
+	if (read == 0 && _format.layout != FrameLayout::y4m)
+		return false;
+	if (read < 0)
+		errord("Could not read the stream");
+	else
+		errord("The stream ends in a truncated frame, %lld of %lld bytes", read, size);
+	_failed = true;
+	return false;
+}
+
+void FrameReader::toRgba8(unsigned char* rgba) const
+{
+	int pixels = _format.width * _format.height;
+	const unsigned char* src = &_buffer[0];
+	switch (_format.layout)
+	{
+	case FrameLayout::rgb8:
+		for (int i = 0; i < pixels; ++i, src += 3, rgba += 4)
+		{
+			rgba[0] = src[0];
+			rgba[1] = src[1];
+			rgba[2] = src[2];
+			rgba[3] = 255;
+		}
+		break;
+	case FrameLayout::rgba8:
+		memcpy(rgba, src, pixels * 4);
+		break;
+	case FrameLayout::rgba16f:
+		for (int i = 0; i < pixels * 4; ++i, src += 2)
+			rgba[i] = clampByte(halfToFloat(src) * 255.0f);
+		break;
+	case FrameLayout::y4m:
+	{
+		const unsigned char* u = src + pixels;
+		const unsigned char* v = u + chromaWidth(_format) * chromaHeight(_format);
+		int shift = _format.chroma420 ? 1 : 0;
+		for (int y = 0; y < _format.height; ++y)
+		{
+			int chromaRow = (y >> shift) * chromaWidth(_format);
+			for (int x = 0; x < _format.width; ++x, rgba += 4)
+			{
+				int c = chromaRow + (x >> shift);
+				yuvToRgb(src[y * _format.width + x], u[c], v[c], _format.fullRange, rgba);
+				rgba[3] = 255;
+			}
+		}
+		break;
+	}
+	}
+}
+
+void FrameReader::toFloat(FloatImage& image) const
+{
+	if (_format.layout != FrameLayout::rgba16f)
+	{
+		// 8 bit values are srgb encoded, decode them like the RGBA8 path would
+		_rgba.resize(_format.width * _format.height * 4);
+		toRgba8(&_rgba[0]);
+		image.setRgba8(&_rgba[0], _format.width, _format.height);
+		return;
+	}
+
+	// half floats are sRGB encoded like 8 bit frames, alpha is not
+	image.width = _format.width;
+	image.height = _format.height;
+	image.pixels.resize(_format.width * _format.height * 4);
+	const unsigned char* src = &_buffer[0];
+	for (size_t i = 0; i < image.pixels.size(); ++i, src += 2)
+		image.pixels[i] = (i & 3) == 3 ? halfToFloat(src) : srgbToLinear(halfToFloat(src));
+}
+
+bool FrameWriter::open(const QString& path, const FrameStreamFormat& format)
+{
+	_format = format;
+	bool opened;
+	if (path == "-")
+		opened = openStandardStream(_file, stdout, QIODevice::WriteOnly);
+	else
+	{
+		_file.setFileName(path);
+		opened = _file.open(QIODevice::WriteOnly);
+	}
+	if (!opened)
+		return false;
+	_buffer.resize((size_t)frameBytes(_format));
+
+	if (_format.layout == FrameLayout::y4m)
+	{
+		// the 2x2 average in write() sites the chroma in the center of its block, whatever the input's siting was
+		QByteArray header = QString("YUV4MPEG2 W%1 H%2 F%3 Ip A1:1 %4%5\n")
+			.arg(_format.width).arg(_format.height).arg(QString(_format.frameRate))
+			.arg(_format.chroma420 ? "C420jpeg" : "C444")
+			.arg(_format.fullRange ? " XCOLORRANGE=FULL" : "").toLatin1();
+		return writeFully(_file, (const unsigned char*)header.constData(), header.size());
+	}
+	return true;
+}
+
+bool FrameWriter::_write()
+{
+	if (_format.layout == FrameLayout::y4m && !writeFully(_file, (const unsigned char*)"FRAME\n", 6))
+		return false;
+	return writeFully(_file, &_buffer[0], _buffer.size()) && _file.flush();
+}
+
+bool FrameWriter::write(const unsigned char* rgba)
+{
+	int pixels = _format.width * _format.height;
+	unsigned char* dst = &_buffer[0];
+	switch (_format.layout)
+	{
+	case FrameLayout::rgb8:
+		for (int i = 0; i < pixels; ++i, rgba += 4, dst += 3)
+		{
+			dst[0] = rgba[0];
+			dst[1] = rgba[1];
+			dst[2] = rgba[2];
+		}
+		break;
+	case FrameLayout::rgba8:
+		memcpy(dst, rgba, pixels * 4);
+		break;
+	case FrameLayout::rgba16f:
+		for (int i = 0; i < pixels * 4; ++i, dst += 2)
+			floatToHalf(rgba[i] / 255.0f, dst);
+		break;
+	case FrameLayout::y4m:
+	{
+		int cw = chromaWidth(_format);
+		int ch = chromaHeight(_format);
+		unsigned char* u = dst + pixels;
+		unsigned char* v = u + cw * ch;
+		if (!_format.chroma420)
+		{
+			for (int i = 0; i < pixels; ++i)
+			{
+				float y, cb, cr;
+				rgbToYuv(rgba + i * 4, _format.fullRange, y, cb, cr);
+				dst[i] = clampByte(y);
+				u[i] = clampByte(cb);
+				v[i] = clampByte(cr);
+			}
+			break;
+		}
+		// luma per pixel, chroma averaged over 2x2 blocks
+		std::vector<float>& sums = _chromaSums;
+		sums.assign(cw * ch * 3, 0.0f);
+		for (int y = 0; y < _format.height; ++y)
+		{
+			for (int x = 0; x < _format.width; ++x)
+			{
+				float luma, cb, cr;
+				rgbToYuv(rgba + (y * _format.width + x) * 4, _format.fullRange, luma, cb, cr);
+				dst[y * _format.width + x] = clampByte(luma);
+				float* sum = &sums[((y >> 1) * cw + (x >> 1)) * 3];
+				sum[0] += cb;
+				sum[1] += cr;
+				sum[2] += 1.0f;
+			}
+		}
+		for (int i = 0; i < cw * ch; ++i)
+		{
+			u[i] = clampByte(sums[i * 3] / sums[i * 3 + 2]);
+			v[i] = clampByte(sums[i * 3 + 1] / sums[i * 3 + 2]);
+		}
+		break;
+	}
+	}
+	return _write();
+}
+
+bool FrameWriter::write(const FloatImage& image)
+{
+	if (_format.layout != FrameLayout::rgba16f)
+	{
+		_rgba.resize(image.width * image.height * 4);
+		image.toRgba8(&_rgba[0]);
+		return write(&_rgba[0]);
+	}
+
+	// graded values are display encoded already, stored as is without clamping
+	unsigned char* dst = &_buffer[0];
+	for (size_t i = 0; i < image.pixels.size(); ++i, dst += 2)
+		floatToHalf(image.pixels[i], dst);
+	return _write();
+}
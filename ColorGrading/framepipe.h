@@ -0,0 +1,97 @@
+#pragma once
+
+#include "grading.h"
+#include <QFile>
+#include <QString>
+#include <vector>
+
+/*
+Uncompressed frame streams for piping frames from a decoder and into an encoder.
+
+rgb8 and rgba8 are tightly packed 8 bit frames, rgba16f is tightly packed half floats (like ffmpeg's rgba64le
+but with IEEE halves). The size of raw frames has to be known up front, y4m streams carry their own in the header.
+y4m supports 8 bit 4:4:4 and 4:2:0 with BT.709 coefficients, limited range unless the header says XCOLORRANGE=FULL.
+
+Every layout carries the same encoding, rgba16f only drops the 8 bit rounding and the clamp to [0, 1]:
+frames that are read are sRGB encoded and decoded to linear for the grade, with the curve continued past 1
+for half floats. Frames that are written are the grade after its output transform, sRGB encoded by default,
+so an identity grade writes what it read.
+
+4:2:0 input of any chroma siting repeats every chroma sample over its 2x2 block. 4:2:0 output averages 2x2 blocks,
+which puts the chroma in the center of the block, the header says C420jpeg for that.
+
+Frames are read and written through buffers that are allocated once per stream and reused for every frame.
+*/
+
+// Largest width and height of a stream, larger y4m headers and frame sizes are rejected before anything is allocated
+const int FRAME_STREAM_MAX_SIZE = 16384;
+
+enum class FrameLayout
+{
+	rgb8,
+	rgba8,
+	rgba16f,
+	y4m,
+};
+
+// "rgb8", "rgba8", "rgba16f" or "y4m", false for anything else
+bool parseFrameLayout(const QString& name, FrameLayout& layout);
+
+struct FrameStreamFormat
+{
+	FrameLayout layout;
+	int width;
+	int height;
+	// y4m only
+	bool chroma420 = true;
+	bool fullRange = false;
+	QByteArray frameRate = "25:1";
+};
+
+class FrameReader
+{
+protected:
+	QFile _file;
+	FrameStreamFormat _format;
+	std::vector<unsigned char> _buffer;
+	mutable std::vector<unsigned char> _rgba;
+	bool _failed = false;
+
+	bool _readHeader();
+
+public:
+	// path is a file or named pipe, "-" reads stdin. For y4m the size in format is replaced with the header's.
+	bool open(const QString& path, const FrameStreamFormat& format);
+	inline const FrameStreamFormat& format() const { return _format; }
+
+	// read the next frame, false at the end of the stream or when the stream is broken
+	bool read();
+	// true if read() stopped at a truncated or malformed frame instead of the end of the stream
+	inline bool failed() const { return _failed; }
+
+	// the frame that was read last. 8 bit layouts convert to RGBA8 directly, without a float round trip.
+	inline bool isFloat() const { return _format.layout == FrameLayout::rgba16f; }
+	void toRgba8(unsigned char* rgba) const;
+	void toFloat(FloatImage& image) const;
+};
+
+class FrameWriter
+{
+protected:
+	QFile _file;
+	FrameStreamFormat _format;
+	std::vector<unsigned char> _buffer;
+	std::vector<unsigned char> _rgba;
+	std::vector<float> _chromaSums;
+
+	bool _write();
+
+public:
+	// path is a file or named pipe, "-" writes to stdout
+	bool open(const QString& path, const FrameStreamFormat& format);
+	inline const FrameStreamFormat& format() const { return _format; }
+
+	// frames have to match the size the stream was opened with
+	bool write(const unsigned char* rgba);
+	bool write(const FloatImage& image);
+};
@@ -0,0 +1,155 @@
+#include "gpugrader.h"
+#include <cstring>
+
+GpuGrader::GpuGrader()
+{
+	// the same shaders as the preview, see CCPreview::initializeRenderer()
+	Shader gradeShader("../grading.glsl", ProgramStage::frag);
+	_gradeProgram = Program(gradeShader);
+	Shader blurShader("../blur.glsl", ProgramStage::compute);
+	_blurProgram = Program(blurShader);
+	Shader blurSourceShader("../blur.glsl", ProgramStage::compute, { "SOURCE_ARRAY" });
+	_blurSourceProgram = Program(blurSourceShader);
+	Shader pyramidShader("../pyramid.glsl", ProgramStage::compute);
+	_pyramidProgram = Program(pyramidShader);
+	Shader pyramidSourceShader("../pyramid.glsl", ProgramStage::compute, { "SOURCE_ARRAY" });
+	_pyramidSourceProgram = Program(pyramidSourceShader);
+}
+
+void GpuGrader::setSource(const FloatImage& source)
+{
+	if (source.width != width() || source.height != height())
+	{
+		_source.setSize(source.width, source.height, 1);
+		_blurred.setSize(source.width, source.height);
+		_blurTemp.setSize(source.width, source.height);
+		_pyramid.setSize(source.width, source.height);
+		_target.setSize(source.width, source.height);
+		// the number of pyramid levels follows the size
+		_pyramid.generateMipMaps();
+	}
+
+	// GL rows go bottom to top
+	int rowBytes = source.width * 4 * (int)sizeof(float);
+	PooledBuffer staging = bufferPool.lease((size_t)rowBytes * source.height);
+	for (int y = 0; y < source.height; ++y)
+		memcpy(staging.data() + (size_t)y * rowBytes, source.pixel(0, source.height - 1 - y), rowBytes);
+	_source.setLayer(0, staging.data());
+	_blurredRadius = -1;
+	_pyramidBuilt = false;
+}
+
+void GpuGrader::_blurPass(Program& pass, ColorBufferObject2DBase& source, ColorBufferObject2DBase& target, int axisX, int axisY, int radius)
+{
+	pass.bind();
+	pass.set("uSource", 0, source);
+	pass.set("uSourceLayer", 0);
+	pass.set("uAxis", axisX, axisY);
+	pass.set("uRadius", radius);
+	pass.set("uRegion", 0, 0, width(), height());
+	target.bindLoadStore(0, GL_WRITE_ONLY);
+	int lines = axisX ? height() : width();
+	pass.dispatch((lines + 63) / 64);
+	gl.glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void GpuGrader::_updateBlur(int radius)
+{
+	if (_blurredRadius == radius)
+		return;
+	for (int i = 0; i < UNSHARP_BLUR_ITERATIONS; ++i)
+	{
+		if (!i)
+			_blurPass(_blurSourceProgram, _source, _blurTemp, 1, 0, radius);
+		else
+			_blurPass(_blurProgram, _blurred, _blurTemp, 1, 0, radius);
+		_blurPass(_blurProgram, _blurTemp, _blurred, 0, 1, radius);
+	}
+	_blurredRadius = radius;
+}
+
+void GpuGrader::_pyramidPass(Program& pass, ColorBufferObject2DBase& source, int sourceLevel, int targetLevel, bool downsample)
+{
+	int levelWidth = qMax(1, width() >> targetLevel);
+	int levelHeight = qMax(1, height() >> targetLevel);
+	pass.bind();
+	pass.set("uSource", 0, source);
+	pass.set("uSourceLayer", 0);
+	pass.set("uSourceLevel", sourceLevel);
+	pass.set("uDownsample", downsample ? 1 : 0);
+	pass.set("uRegion", 0, 0, levelWidth, levelHeight);
+	_pyramid.bindLoadStore(0, GL_WRITE_ONLY, targetLevel);
+	pass.dispatch((levelWidth + 7) / 8, (levelHeight + 7) / 8);
+	gl.glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void GpuGrader::_updatePyramid()
+{
+	if (_pyramidBuilt)
+		return;
+	_pyramidPass(_pyramidSourceProgram, _source, 0, 0, false);
+	int levels = qMin(CLARITY_BANDS, _pyramid.mipLevels() - 1);
+	for (int level = 1; level <= levels; ++level)
+		_pyramidPass(_pyramidProgram, _pyramid, level - 1, level, true);
+	_pyramidBuilt = true;
+}
+
+bool GpuGrader::grade(const GradingSettings& settings, FloatImage& target)
+{
+	// like the preview, shaders edited while a batch runs apply from the next image on
+	rebuildChangedShaders();
+	// the grade reads the blur even without an unsharp mask, it is multiplied by 0 then
+	_updateBlur(unsharpRadiusPixels(settings));
+	if (settings.clarity != 0.0f)
+		_updatePyramid();
+
+	if (_outputShaperTransform != settings.output)
+	{
+		const unsigned char* data = (const unsigned char*)outputShaper(settings.output);
+		std::vector<unsigned char> bytes(data, data + OUTPUT_SHAPER_SIZE * sizeof(float));
+		_outputShaper.reset(new ColorBufferObject2D(ColorBufferFormat::R32F, OUTPUT_SHAPER_SIZE, 1, { bytes }));
+		_outputShaperTransform = settings.output;
+	}
+
+	_gradeProgram.bind();
+	_gradeProgram.set("uImageOrigin", 0.0f, 0.0f);
+	_gradeProgram.set("uImageSize", (float)width(), (float)height());
+	_gradeProgram.set("uSources", 0, _source);
+	_gradeProgram.set("uSourceLayer", 0);
+	_gradeProgram.set("uBlurred", 1, _blurred);
+	_gradeProgram.set("uClarity", settings.clarity != 0.0f ? 1 : 0);
+	if (settings.clarity != 0.0f)
+	{
+		std::vector<float> gains(CLARITY_BANDS);
+		clarityBandGains(settings.clarity, &gains[0]);
+		_gradeProgram.set("uPyramid", 2, _pyramid);
+		_gradeProgram.set("uClarityGains", gains);
+	}
+	_gradeProgram.set("uLift", settings.lift);
+	_gradeProgram.set("uGamma", settings.gamma);
+	_gradeProgram.set("uGain", settings.gain);
+	_gradeProgram.set("uOffset", settings.offset);
+	_gradeProgram.set("uContrast", settings.contrast);
+	_gradeProgram.set("uContrastPivot", settings.pivot);
+	_gradeProgram.set("uSaturation", settings.saturation);
+	_gradeProgram.set("uHue", settings.hueShift);
+	_gradeProgram.set("uTemperature", settings.temperature);
+	_gradeProgram.set("uUnsharpMask", settings.unsharpMask);
+	_gradeProgram.set("uOutputShaper", 4, *_outputShaper);
+	// batch grades have no look, samplers of different types can not share a unit even when unused
+	_gradeProgram.set("uLookSize", 0);
+	_gradeProgram.set("uLook", 3);
+
+	if (!_framebuffer.bind(_target))
+		return false;
+	glRectf(-1.0f, -1.0f, 1.0f, 1.0f);
+	FrameBufferObject::unbind(0);
+
+	// reading back waits for the draw
+	PooledBuffer pixels = _target.readFloats();
+	target = FloatImage(width(), height());
+	int rowFloats = width() * 4;
+	for (int y = 0; y < height(); ++y)
+		memcpy(target.pixel(0, y), (const float*)pixels.data() + (size_t)(height() - 1 - y) * rowFloats, rowFloats * sizeof(float));
+	return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "grading.h"
+#include "materials.h"
+#include <memory>
+
+/*
+The GLSL engine without a window, the GPU counterpart of CpuGrader for batch grading.
+
+Grades whole images 1:1 with the shaders of the preview, like CCPreview::gradeOffscreen().
+The source is uploaded as 32 bit floats, exactly what CpuGrader grades, and the grade is read back as 32 bit floats,
+so the two engines only differ by the half float blur and pyramid and the GPU's transcendentals.
+The blur and pyramid are kept for the source like CpuGrader does.
+
+Needs a current GL context on the calling thread for its whole life, see RenderThread.
+*/
+class GpuGrader
+{
+protected:
+	ColorBufferObject2DArray _source = ColorBufferObject2DArray(ColorBufferFormat::RGBA32F, 1, 1, 1);
+	ColorBufferObject2D _blurred = ColorBufferObject2D(ColorBufferFormat::RGBA16F, 1, 1, {});
+	ColorBufferObject2D _blurTemp = ColorBufferObject2D(ColorBufferFormat::RGBA16F, 1, 1, {});
+	ColorBufferObject2D _pyramid = ColorBufferObject2D(ColorBufferFormat::RGBA16F, 1, 1, {});
+	ColorBufferObject2D _target = ColorBufferObject2D(ColorBufferFormat::RGBA32F, 1, 1, {});
+	FrameBufferObject _framebuffer;
+	std::unique_ptr<ColorBufferObject2D> _outputShaper;
+	OutputTransform _outputShaperTransform = OutputTransform::count;
+	int _blurredRadius = -1;
+	bool _pyramidBuilt = false;
+
+	Program _gradeProgram;
+	Program _blurProgram;
+	Program _blurSourceProgram;
+	Program _pyramidProgram;
+	Program _pyramidSourceProgram;
+
+	void _blurPass(Program& pass, ColorBufferObject2DBase& source, ColorBufferObject2DBase& target, int axisX, int axisY, int radius);
+	void _updateBlur(int radius);
+	void _pyramidPass(Program& pass, ColorBufferObject2DBase& source, int sourceLevel, int targetLevel, bool downsample);
+	void _updatePyramid();
+
+public:
+	GpuGrader();
+
+	inline int width() { return _source.width(); }
+	inline int height() { return _source.height(); }
+
+	void setSource(const FloatImage& source);
+	// false if the driver can not draw into 32 bit floats
+	bool grade(const GradingSettings& settings, FloatImage& target);
+};
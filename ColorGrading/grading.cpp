@@ -0,0 +1,620 @@
+#include "grading.h"
+#include "hashing.h"
+#include <QSettings>
+#include <cmath>
+#include <map>
+
+GradingSettings defaultGradingSettings()
+{
+	GradingSettings settings;
+	settings.lift = QVector3D(0.0f, 0.0f, 0.0f);
+	settings.gamma = QVector3D(0.0f, 0.0f, 0.0f);
+	settings.gain = QVector3D(0.0f, 0.0f, 0.0f);
+	settings.offset = QVector3D(0.0f, 0.0f, 0.0f);
+	settings.contrast = 1.0f;
+	settings.pivot = 0.435f;
+	settings.saturation = 1.0f;
+	settings.hueShift = 0.0f;
+	settings.temperature = 66.0f;
+	settings.unsharpMask = 0.0f;
+	settings.unsharpRadius = 1.0f;
+	settings.clarity = 0.0f;
+	settings.output = OutputTransform::srgb;
+	return settings;
+}
+
+bool saveGradingSettings(const QString& filePath, const GradingSettings& settings)
+{
+	QSettings ini(filePath, QSettings::IniFormat);
+	ini.setValue("lift", settings.lift);
+	ini.setValue("gamma", settings.gamma);
+	ini.setValue("gain", settings.gain);
+	ini.setValue("offset", settings.offset);
+	ini.setValue("contrast", settings.contrast);
+	ini.setValue("pivot", settings.pivot);
+	ini.setValue("saturation", settings.saturation);
+	ini.setValue("hueShift", settings.hueShift);
+	ini.setValue("temperature", settings.temperature);
+	ini.setValue("unsharpMask", settings.unsharpMask);
+	ini.setValue("unsharpRadius", settings.unsharpRadius);
+	ini.setValue("clarity", settings.clarity);
+	ini.setValue("output", outputTransformName(settings.output));
+	ini.sync();
+	return ini.status() == QSettings::NoError;
+}
+
+bool loadGradingSettings(const QString& filePath, GradingSettings& settings)
+{
+	QSettings ini(filePath, QSettings::IniFormat);
+	if (ini.status() != QSettings::NoError)
+		return false;
+	settings.lift = ini.value("lift", settings.lift).value<QVector3D>();
+	settings.gamma = ini.value("gamma", settings.gamma).value<QVector3D>();
+	settings.gain = ini.value("gain", settings.gain).value<QVector3D>();
+	settings.offset = ini.value("offset", settings.offset).value<QVector3D>();
+	settings.contrast = ini.value("contrast", settings.contrast).toFloat();
+	settings.pivot = ini.value("pivot", settings.pivot).toFloat();
+	settings.saturation = ini.value("saturation", settings.saturation).toFloat();
+	settings.hueShift = ini.value("hueShift", settings.hueShift).toFloat();
+	settings.temperature = ini.value("temperature", settings.temperature).toFloat();
+	settings.unsharpMask = ini.value("unsharpMask", settings.unsharpMask).toFloat();
+	settings.unsharpRadius = ini.value("unsharpRadius", settings.unsharpRadius).toFloat();
+	settings.clarity = ini.value("clarity", settings.clarity).toFloat();
+	// unknown names keep the default, grades saved before there was a choice are sRGB
+	QByteArray output = ini.value("output").toString().toLatin1();
+	parseOutputTransform(output.constData(), settings.output);
+	return true;
+}
+
+uint64_t hashGradingSettings(const GradingSettings& settings)
+{
+	// hashing the struct directly would include padding and treat -0 and 0 as different values
+	float values[] = {
+		settings.lift.x(), settings.lift.y(), settings.lift.z(),
+		settings.gamma.x(), settings.gamma.y(), settings.gamma.z(),
+		settings.gain.x(), settings.gain.y(), settings.gain.z(),
+		settings.offset.x(), settings.offset.y(), settings.offset.z(),
+		settings.contrast,
+		settings.pivot,
+		settings.saturation,
+		settings.hueShift,
+		settings.temperature,
+		settings.unsharpMask,
+		(float)unsharpRadiusPixels(settings),
+		settings.clarity,
+		(float)settings.output,
+	};
+	for (float& value : values)
+		if (value == 0.0f)
+			value = 0.0f;
+	return hashBytes(values, sizeof(values));
+}
+
+void packGradingSettings(const GradingSettings& settings, float* values)
+{
+	const QVector3D* wheels[] = { &settings.lift, &settings.gamma, &settings.gain, &settings.offset };
+	for (const QVector3D* wheel : wheels)
+	{
+		*values++ = wheel->x();
+		*values++ = wheel->y();
+		*values++ = wheel->z();
+	}
+	*values++ = settings.contrast;
+	*values++ = settings.pivot;
+	*values++ = settings.saturation;
+	*values++ = settings.hueShift;
+	*values++ = settings.temperature;
+	*values++ = settings.unsharpMask;
+	*values++ = settings.unsharpRadius;
+	*values++ = settings.clarity;
+	*values++ = (float)settings.output;
+}
+
+GradingSettings unpackGradingSettings(const float* values)
+{
+	GradingSettings settings;
+	QVector3D* wheels[] = { &settings.lift, &settings.gamma, &settings.gain, &settings.offset };
+	for (QVector3D* wheel : wheels)
+	{
+		*wheel = QVector3D(values[0], values[1], values[2]);
+		values += 3;
+	}
+	settings.contrast = *values++;
+	settings.pivot = *values++;
+	settings.saturation = *values++;
+	settings.hueShift = *values++;
+	settings.temperature = *values++;
+	settings.unsharpMask = *values++;
+	settings.unsharpRadius = *values++;
+	settings.clarity = *values++;
+	int output = (int)*values++;
+	settings.output = output >= 0 && output < (int)OutputTransform::count ? (OutputTransform)output : OutputTransform::srgb;
+	return settings;
+}
+
+// the helpers below mirror the GLSL built-ins used by grading.glsl
+
+static inline float sat(float x) { return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x); }
+static inline float fract(float x) { return x - floorf(x); }
+static inline float mix(float a, float b, float t) { return a + (b - a) * t; }
+
+static void rgb2hsv(const float* c, float* result)
+{
+	float p[4], q[4];
+	if (c[1] >= c[2]) { p[0] = c[1]; p[1] = c[2]; p[2] = 0.0f; p[3] = -1.0f / 3.0f; }
+	else { p[0] = c[2]; p[1] = c[1]; p[2] = -1.0f; p[3] = 2.0f / 3.0f; }
+	if (c[0] >= p[0]) { q[0] = c[0]; q[1] = p[1]; q[2] = p[2]; q[3] = p[0]; }
+	else { q[0] = p[0]; q[1] = p[1]; q[2] = p[3]; q[3] = c[0]; }
+	float d = q[0] - fminf(q[3], q[1]);
+	const float e = 1.0e-10f;
+	result[0] = fabsf(q[2] + (q[3] - q[1]) / (6.0f * d + e));
+	result[1] = d / (q[0] + e);
+	result[2] = q[0];
+}
+
+static void hsv2rgb(const float* c, float* result)
+{
+	const float k[3] = { 1.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	for (int i = 0; i < 3; ++i)
+		result[i] = c[2] * mix(1.0f, sat(fabsf(fract(k[i] + c[0]) * 6.0f - 3.0f) - 1.0f), c[1]);
+}
+
+// from http://www.tannerhelland.com/4435/convert-temperature-rgb-algorithm-code/
+void colorFromKelvin(float temperature, float* result)
+{
+	if (temperature <= 66.0f)
+	{
+		result[0] = 1.0f;
+		result[1] = sat((99.4708025861f * logf(temperature) - 161.1195681661f) / 255.0f);
+		if (temperature < 19.0f)
+			result[2] = 0.0f;
+		else
+			result[2] = sat((138.5177312231f * logf(temperature - 10.0f) - 305.0447927307f) / 255.0f);
+	}
+	else
+	{
+		result[0] = sat((329.698727446f / 255.0f) * powf(temperature - 60.0f, -0.1332047592f));
+		result[1] = sat((288.1221695283f / 255.0f) * powf(temperature - 60.0f, -0.0755148492f));
+		result[2] = 1.0f;
+	}
+}
+
+float srgbToLinear(float c)
+{
+	if (c <= 0.04045f)
+		return c / 12.92f;
+	return powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+FloatImage FloatImage::fromQImage(const QImage& img, bool srgb)
+{
+	// RGBA8888 rows are never padded
+	QImage rgba = img.convertToFormat(QImage::Format_RGBA8888);
+	FloatImage result;
+	result.setRgba8(rgba.constBits(), rgba.width(), rgba.height(), srgb);
+	return result;
+}
+
+QImage FloatImage::toQImage() const
+{
+	QImage result(width, height, QImage::Format_RGBA8888);
+	toRgba8(result.bits());
+	return result;
+}
+
+void FloatImage::setRgba8(const unsigned char* rgba, int width, int height, bool srgb)
+{
+	float table[256];
+	for (int i = 0; i < 256; ++i)
+		table[i] = srgb ? srgbToLinear(i / 255.0f) : i / 255.0f;
+
+	this->width = width;
+	this->height = height;
+	pixels.resize(width * height * 4);
+	const unsigned char* src = rgba;
+	float* dst = &pixels[0];
+	for (int i = 0; i < width * height * 4; i += 4)
+	{
+		dst[i] = table[src[i]];
+		dst[i + 1] = table[src[i + 1]];
+		dst[i + 2] = table[src[i + 2]];
+		dst[i + 3] = src[i + 3] / 255.0f; // alpha is never srgb
+	}
+}
+
+void FloatImage::toRgba8(unsigned char* rgba) const
+{
+	for (int i = 0; i < width * height * 4; ++i)
+		rgba[i] = (unsigned char)(sat(pixels[i]) * 255.0f + 0.5f);
+}
+
+// one horizontal pass, a running sum walks every row
+static void boxBlurRows(const FloatImage& source, FloatImage& target, int radius)
+{
+	float norm = 1.0f / (radius * 2 + 1);
+	int last = source.width - 1;
+	for (int y = 0; y < source.height; ++y)
+	{
+		const float* src = source.pixel(0, y);
+		float* dst = target.pixel(0, y);
+		float sum[4] = {};
+		for (int i = -radius; i <= radius; ++i)
+		{
+			const float* s = src + (i < 0 ? 0 : (i > last ? last : i)) * 4;
+			for (int c = 0; c < 4; ++c)
+				sum[c] += s[c];
+		}
+		for (int x = 0; x < source.width; ++x)
+		{
+			for (int c = 0; c < 4; ++c)
+				dst[x * 4 + c] = sum[c] * norm;
+			int add = x + radius + 1;
+			int remove = x - radius;
+			const float* a = src + (add > last ? last : add) * 4;
+			const float* r = src + (remove < 0 ? 0 : remove) * 4;
+			for (int c = 0; c < 4; ++c)
+				sum[c] += a[c] - r[c];
+		}
+	}
+}
+
+// one vertical pass, keeps a running sum for every column at once so rows are read in order
+static void boxBlurColumns(const FloatImage& source, FloatImage& target, int radius)
+{
+	float norm = 1.0f / (radius * 2 + 1);
+	int last = source.height - 1;
+	int rowSize = source.width * 4;
+	std::vector<float> sums(rowSize, 0.0f);
+	for (int i = -radius; i <= radius; ++i)
+	{
+		const float* s = source.pixel(0, i < 0 ? 0 : (i > last ? last : i));
+		for (int x = 0; x < rowSize; ++x)
+			sums[x] += s[x];
+	}
+	for (int y = 0; y < source.height; ++y)
+	{
+		float* dst = target.pixel(0, y);
+		for (int x = 0; x < rowSize; ++x)
+			dst[x] = sums[x] * norm;
+		int add = y + radius + 1;
+		int remove = y - radius;
+		const float* a = source.pixel(0, add > last ? last : add);
+		const float* r = source.pixel(0, remove < 0 ? 0 : remove);
+		for (int x = 0; x < rowSize; ++x)
+			sums[x] += a[x] - r[x];
+	}
+}
+
+void boxBlur(const FloatImage& source, FloatImage& target, int radius, int iterations)
+{
+	FloatImage tmp(source.width, source.height);
+	target = FloatImage(source.width, source.height);
+	const FloatImage* input = &source;
+	for (int i = 0; i < iterations; ++i)
+	{
+		boxBlurRows(*input, tmp, radius);
+		boxBlurColumns(tmp, target, radius);
+		input = &target;
+	}
+	if (!iterations)
+		target = source;
+}
+
+void clarityBandGains(float clarity, float* gains)
+{
+	const float weights[CLARITY_BANDS] = { 0.25f, 0.5f, 1.0f, 1.0f, 0.75f, 0.5f };
+	for (int i = 0; i < CLARITY_BANDS; ++i)
+		gains[i] = 1.0f + clarity * weights[i];
+}
+
+void pyramidDownsample(const FloatImage& source, FloatImage& target)
+{
+	target = FloatImage(source.width > 1 ? source.width / 2 : 1, source.height > 1 ? source.height / 2 : 1);
+	const float weights[4] = { 1.0f, 3.0f, 3.0f, 1.0f };
+	int lastX = source.width - 1;
+	int lastY = source.height - 1;
+	for (int y = 0; y < target.height; ++y)
+	{
+		for (int x = 0; x < target.width; ++x)
+		{
+			float sum[4] = {};
+			for (int j = 0; j < 4; ++j)
+			{
+				int sy = y * 2 + j - 1;
+				sy = sy < 0 ? 0 : (sy > lastY ? lastY : sy);
+				for (int i = 0; i < 4; ++i)
+				{
+					int sx = x * 2 + i - 1;
+					sx = sx < 0 ? 0 : (sx > lastX ? lastX : sx);
+					const float* src = source.pixel(sx, sy);
+					float w = weights[i] * weights[j];
+					for (int c = 0; c < 4; ++c)
+						sum[c] += src[c] * w;
+				}
+			}
+			float* dst = target.pixel(x, y);
+			for (int c = 0; c < 4; ++c)
+				dst[c] = sum[c] / 64.0f;
+		}
+	}
+}
+
+void sampleBilinear(const FloatImage& image, float u, float v, float* result)
+{
+	float x = u * image.width - 0.5f;
+	float y = v * image.height - 0.5f;
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	float tx = x - x0;
+	float ty = y - y0;
+	int lastX = image.width - 1;
+	int lastY = image.height - 1;
+	int xa = x0 < 0 ? 0 : (x0 > lastX ? lastX : x0);
+	int xb = x0 + 1 < 0 ? 0 : (x0 + 1 > lastX ? lastX : x0 + 1);
+	int ya = y0 < 0 ? 0 : (y0 > lastY ? lastY : y0);
+	int yb = y0 + 1 < 0 ? 0 : (y0 + 1 > lastY ? lastY : y0 + 1);
+	const float* a = image.pixel(xa, ya);
+	const float* b = image.pixel(xb, ya);
+	const float* c = image.pixel(xa, yb);
+	const float* d = image.pixel(xb, yb);
+	for (int i = 0; i < 4; ++i)
+		result[i] = mix(mix(a[i], b[i], tx), mix(c[i], d[i], tx), ty);
+}
+
+float contrastCurve(const GradingSettings& s, float value)
+{
+	// above white the curve goes on as a straight line, HDR highlights keep their distance to it
+	if (value > 1.0f)
+		return contrastCurve(s, 1.0f) + (value - 1.0f) * sat(s.contrast);
+	float p = 1.0f / sat(2.0f - s.contrast);
+	float ip = 1.0f - s.pivot;
+	float c = mix(s.pivot, value, sat(s.contrast));
+	if (c > s.pivot)
+		return 1.0f - powf(1.0f / ip - c / ip, p) * ip;
+	return powf(c / s.pivot, p) * s.pivot;
+}
+
+void gradeColor(const GradingSettings& s, const float* color, const float* blurred, float* result)
+{
+	float v[3];
+
+	// unsharp mask, overshoots are clipped at white, HDR values brighter than that are only kept from growing
+	for (int i = 0; i < 3; ++i)
+		v[i] = fminf(fmaxf(color[i] + (color[i] - blurred[i]) * s.unsharpMask, 0.0f), fmaxf(color[i], 1.0f));
+
+	// contrast
+	for (int i = 0; i < 3; ++i)
+		v[i] = contrastCurve(s, v[i]);
+
+	// saturation
+	float luma = v[0] * 0.2126f + v[1] * 0.7152f + v[2] * 0.0722f;
+	for (int i = 0; i < 3; ++i)
+		v[i] = mix(luma, v[i], s.saturation);
+
+	// hue shift
+	float hsv[3];
+	rgb2hsv(v, hsv);
+	hsv[0] += fract(s.hueShift / 6.0f);
+	hsv2rgb(hsv, v);
+
+	// white balance
+	float white[3];
+	colorFromKelvin(s.temperature, white);
+	for (int i = 0; i < 3; ++i)
+		v[i] *= 1.0f / white[i];
+
+	// three way color corrector
+	const float lift[3] = { s.lift.x(), s.lift.y(), s.lift.z() };
+	const float gamma[3] = { s.gamma.x(), s.gamma.y(), s.gamma.z() };
+	const float gain[3] = { s.gain.x(), s.gain.y(), s.gain.z() };
+	const float offset[3] = { s.offset.x(), s.offset.y(), s.offset.z() };
+	for (int i = 0; i < 3; ++i)
+		v[i] = powf(fmaxf(0.0f, v[i] * (1.0f + gain[i] - lift[i]) + lift[i] + offset[i]), fmaxf(0.0f, 1.0f - gamma[i]));
+
+	// output transform
+	const float* shaper = outputShaper(s.output);
+	for (int i = 0; i < 3; ++i)
+		result[i] = shapeOutput(shaper, v[i]);
+}
+
+std::vector<float> bakeLut(const GradingSettings& settings, int size)
+{
+	std::vector<float> lut(size * size * size * 3);
+	GradingSettings spatialless = settings;
+	spatialless.unsharpMask = 0.0f;
+	float* dst = &lut[0];
+	for (int b = 0; b < size; ++b)
+	{
+		for (int g = 0; g < size; ++g)
+		{
+			for (int r = 0; r < size; ++r)
+			{
+				float color[3] = {
+					srgbToLinear(r / (float)(size - 1)),
+					srgbToLinear(g / (float)(size - 1)),
+					srgbToLinear(b / (float)(size - 1)) };
+				gradeColor(spatialless, color, color, dst);
+				dst += 3;
+			}
+		}
+	}
+	return lut;
+}
+
+void CpuGrader::setSource(const FloatImage& source)
+{
+	_source = source;
+	_blurredRadius = -1;
+	_pyramid.clear();
+}
+
+std::vector<GradingSettings> wedgeSweep(const GradingSettings& base, int columns, int rows)
+{
+	const float CONTRAST_RANGE = 0.5f;
+	const float TEMPERATURE_RANGE = 1.25f;
+
+	std::vector<GradingSettings> variants;
+	for (int row = 0; row < rows; ++row)
+	{
+		for (int column = 0; column < columns; ++column)
+		{
+			// -1 to 1, 0 in the middle
+			float c = columns > 1 ? column * 2.0f / (columns - 1) - 1.0f : 0.0f;
+			float r = rows > 1 ? row * 2.0f / (rows - 1) - 1.0f : 0.0f;
+			GradingSettings variant = base;
+			// the contrast slider goes from 0 to 2
+			variant.contrast = sat((base.contrast + c * CONTRAST_RANGE) * 0.5f) * 2.0f;
+			variant.temperature = base.temperature * pow(TEMPERATURE_RANGE, r);
+			variants.push_back(variant);
+		}
+	}
+	return variants;
+}
+
+const std::vector<FloatImage>& CpuGrader::pyramid()
+{
+	if (_pyramid.empty())
+	{
+		_pyramid.resize(CLARITY_BANDS + 1);
+		_pyramid[0] = _source;
+		for (int i = 1; i <= CLARITY_BANDS; ++i)
+			pyramidDownsample(_pyramid[i - 1], _pyramid[i]);
+	}
+	return _pyramid;
+}
+
+const FloatImage& CpuGrader::blurred(int radius)
+{
+	if (radius != _blurredRadius)
+	{
+		boxBlur(_source, _blurred, radius);
+		_blurredRadius = radius;
+	}
+	return _blurred;
+}
+
+// clarity, every laplacian band (the difference between 2 pyramid levels) gets its own gain
+static inline void addClarity(const std::vector<FloatImage>& levels, const float* gains, int x, int y, float* color)
+{
+	float u = (x + 0.5f) / levels[0].width;
+	float v = (y + 0.5f) / levels[0].height;
+	float finer[4], coarser[4];
+	sampleBilinear(levels[0], u, v, coarser);
+	for (int i = 0; i < CLARITY_BANDS; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			finer[c] = coarser[c];
+		sampleBilinear(levels[i + 1], u, v, coarser);
+		for (int c = 0; c < 3; ++c)
+			color[c] += (finer[c] - coarser[c]) * (gains[i] - 1.0f);
+	}
+}
+
+void CpuGrader::grade(const GradingSettings& settings, FloatImage& target)
+{
+	const FloatImage& blur = blurred(unsharpRadiusPixels(settings));
+	const std::vector<FloatImage>* levels = settings.clarity != 0.0f ? &pyramid() : nullptr;
+	float gains[CLARITY_BANDS];
+	clarityBandGains(settings.clarity, gains);
+
+	if (target.width != _source.width || target.height != _source.height)
+		target = FloatImage(_source.width, _source.height);
+	for (int y = 0; y < _source.height; ++y)
+	{
+		for (int x = 0; x < _source.width; ++x)
+		{
+			const float* src = _source.pixel(x, y);
+			float color[4] = { src[0], src[1], src[2], src[3] };
+			if (levels)
+				addClarity(*levels, gains, x, y, color);
+
+			float* dst = target.pixel(x, y);
+			gradeColor(settings, color, blur.pixel(x, y), dst);
+			dst[3] = 1.0f;
+		}
+	}
+}
+
+void CpuGrader::gradePixel(const GradingSettings& settings, int x, int y, float* result)
+{
+	const float* src = _source.pixel(x, y);
+	float color[4] = { src[0], src[1], src[2], src[3] };
+	if (settings.clarity != 0.0f)
+	{
+		float gains[CLARITY_BANDS];
+		clarityBandGains(settings.clarity, gains);
+		addClarity(pyramid(), gains, x, y, color);
+	}
+	// the blur is multiplied by 0 without an unsharp mask, it is only computed for one
+	const float* blur = settings.unsharpMask != 0.0f ? blurred(unsharpRadiusPixels(settings)).pixel(x, y) : color;
+	gradeColor(settings, color, blur, result);
+	result[3] = 1.0f;
+}
+
+void CpuGrader::gradeWedge(const std::vector<GradingSettings>& variants, std::vector<FloatImage>& targets)
+{
+	int numVariants = (int)variants.size();
+
+	// one blur per distinct radius
+	std::map<int, FloatImage> blurs;
+	std::vector<const FloatImage*> variantBlurs(numVariants);
+	std::vector<float> gains(numVariants * CLARITY_BANDS);
+	bool anyClarity = false;
+	for (int i = 0; i < numVariants; ++i)
+	{
+		int radius = unsharpRadiusPixels(variants[i]);
+		if (!blurs.count(radius))
+			blurs[radius] = blurred(radius);
+		variantBlurs[i] = &blurs[radius];
+		clarityBandGains(variants[i].clarity, &gains[i * CLARITY_BANDS]);
+		anyClarity = anyClarity || variants[i].clarity != 0.0f;
+	}
+	const std::vector<FloatImage>* levels = anyClarity ? &pyramid() : nullptr;
+
+	targets.resize(numVariants);
+	for (FloatImage& target : targets)
+		if (target.width != _source.width || target.height != _source.height)
+			target = FloatImage(_source.width, _source.height);
+
+	for (int y = 0; y < _source.height; ++y)
+	{
+		for (int x = 0; x < _source.width; ++x)
+		{
+			const float* src = _source.pixel(x, y);
+
+			// laplacian bands are shared, only their gains differ per variant
+			float bands[CLARITY_BANDS][3];
+			if (levels)
+			{
+				float u = (x + 0.5f) / _source.width;
+				float v = (y + 0.5f) / _source.height;
+				float finer[4], coarser[4];
+				sampleBilinear((*levels)[0], u, v, coarser);
+				for (int i = 0; i < CLARITY_BANDS; ++i)
+				{
+					for (int c = 0; c < 3; ++c)
+						finer[c] = coarser[c];
+					sampleBilinear((*levels)[i + 1], u, v, coarser);
+					for (int c = 0; c < 3; ++c)
+						bands[i][c] = finer[c] - coarser[c];
+				}
+			}
+
+			for (int n = 0; n < numVariants; ++n)
+			{
+				float color[4] = { src[0], src[1], src[2], src[3] };
+				if (levels && variants[n].clarity != 0.0f)
+				{
+					const float* variantGains = &gains[n * CLARITY_BANDS];
+					for (int i = 0; i < CLARITY_BANDS; ++i)
+						for (int c = 0; c < 3; ++c)
+							color[c] += bands[i][c] * (variantGains[i] - 1.0f);
+				}
+
+				float* dst = targets[n].pixel(x, y);
+				gradeColor(variants[n], color, variantBlurs[n]->pixel(x, y), dst);
+				dst[3] = 1.0f;
+			}
+		}
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "outputtransform.h"
+#include <QImage>
+#include <QString>
+#include <QVector3D>
+#include <cstdint>
+#include <vector>
+
+// Utility to batch pass all color correction settings through a signal
+struct GradingSettings
+{
+	QVector3D lift;
+	QVector3D gamma;
+	QVector3D gain;
+	QVector3D offset;
+	float contrast;
+	float pivot;
+	float saturation;
+	float hueShift;
+	float temperature;
+	float unsharpMask;
+	float unsharpRadius;
+	float clarity;
+	OutputTransform output;
+};
+
+// Bump when the grading math changes, so cached results of older versions are not used
+const uint32_t GRADING_ENGINE_VERSION = 4;
+
+// The values of the UI controls when they are reset
+GradingSettings defaultGradingSettings();
+
+// Save and load settings as an ini file, missing values are left at their defaults
+bool saveGradingSettings(const QString& filePath, const GradingSettings& settings);
+bool loadGradingSettings(const QString& filePath, GradingSettings& settings);
+
+// Hash of the settings values in a fixed order, -0 and 0 hash the same
+uint64_t hashGradingSettings(const GradingSettings& settings);
+
+// Settings as a flat array of floats in a fixed order, to send them to other processes
+const int GRADING_SETTINGS_VALUES = 21;
+void packGradingSettings(const GradingSettings& settings, float* values);
+GradingSettings unpackGradingSettings(const float* values);
+
+// Iterations of the box blur used by the unsharp mask, 3 box blurs are close to a gaussian
+const int UNSHARP_BLUR_ITERATIONS = 3;
+
+inline int unsharpRadiusPixels(const GradingSettings& settings) { return settings.unsharpRadius < 1.0f ? 1 : (int)(settings.unsharpRadius + 0.5f); }
+
+// Number of laplacian bands the clarity control recombines, must match grading.glsl
+const int CLARITY_BANDS = 6;
+
+// Gain per laplacian band, finest first. Clarity mostly targets the mid frequencies.
+void clarityBandGains(float clarity, float* gains);
+
+/*
+Variants of a grade for a contact sheet, in rows of columns with the base grade in the middle.
+Contrast varies along the columns and white balance along the rows.
+*/
+std::vector<GradingSettings> wedgeSweep(const GradingSettings& base, int columns, int rows);
+
+// sRGB decoding, the curve continues past 1 for float values
+float srgbToLinear(float c);
+
+/*
+Linear RGBA float image, rows top to bottom like QImage.
+*/
+struct FloatImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;
+
+	FloatImage() {}
+	// sizes are int, the pixel count is not
+	FloatImage(int width, int height) : width(width), height(height), pixels((size_t)width * height * 4) {}
+
+	inline float* pixel(int x, int y) { return &pixels[((size_t)y * width + x) * 4]; }
+	inline const float* pixel(int x, int y) const { return &pixels[((size_t)y * width + x) * 4]; }
+
+	// srgb decodes the 8 bit values like an SRGB8_ALPHA8 texture would
+	static FloatImage fromQImage(const QImage& img, bool srgb = true);
+	// values are clamped and stored as is, grading already ends in gamma space
+	QImage toQImage() const;
+
+	// same as above for tightly packed RGBA8 pixels, keeps the storage when the size does not change
+	void setRgba8(const unsigned char* rgba, int width, int height, bool srgb = true);
+	void toRgba8(unsigned char* rgba) const;
+};
+
+/*
+Box blur that keeps a running sum per row and per column,
+every pixel costs the same regardless of the radius. Edges are clamped.
+Matches blur.glsl.
+*/
+void boxBlur(const FloatImage& source, FloatImage& target, int radius, int iterations = UNSHARP_BLUR_ITERATIONS);
+
+/*
+Half resolution pass with a separable [1 3 3 1] / 8 kernel, the next level of a gaussian pyramid.
+Matches pyramid.glsl.
+*/
+void pyramidDownsample(const FloatImage& source, FloatImage& target);
+
+// bilinear lookup with normalized coordinates and clamped edges, like texture() on a GL_LINEAR texture
+void sampleBilinear(const FloatImage& image, float u, float v, float* result);
+
+// white point of a color temperature in hundreds of kelvin, the grade divides by it
+void colorFromKelvin(float temperature, float* result);
+
+// contrast curve of the grade, the same for every channel
+float contrastCurve(const GradingSettings& settings, float value);
+
+// grade a single linear color, blurred is the same pixel from the unsharp mask blur
+void gradeColor(const GradingSettings& settings, const float* color, const float* blurred, float* result);
+
+/*
+Bake the per pixel part of a grade into a size^3 RGB float LUT, red varies fastest.
+The LUT is indexed with the sRGB encoded source color and contains display values,
+the spatial parts of the grade (unsharp mask and clarity) can not be baked and are left out.
+*/
+std::vector<float> bakeLut(const GradingSettings& settings, int size);
+
+// Size LUTs get baked at for 8 bit output, fine enough that interpolation errors stay below a code value
+const int BAKED_LUT_SIZE = 65;
+
+// True if bakeLut() captures the whole grade
+inline bool isLutGrade(const GradingSettings& settings) { return settings.unsharpMask == 0.0f && settings.clarity == 0.0f; }
+
+/*
+CPU implementation of grading.glsl.
+Keeps the blurred source around, it is only recomputed when the source or the unsharp radius changes.
+The gaussian pyramid for clarity is built once per source.
+*/
+class CpuGrader
+{
+protected:
+	FloatImage _source;
+	FloatImage _blurred;
+	int _blurredRadius = -1;
+	std::vector<FloatImage> _pyramid;
+
+public:
+	void setSource(const FloatImage& source);
+	inline const FloatImage& source() const { return _source; }
+	const FloatImage& blurred(int radius);
+	// level 0 is the source, followed by CLARITY_BANDS smaller levels
+	const std::vector<FloatImage>& pyramid();
+
+	void grade(const GradingSettings& settings, FloatImage& target);
+	// one pixel of grade(), to check another engine at a few pixels without grading the whole image
+	void gradePixel(const GradingSettings& settings, int x, int y, float* result);
+	// grade all variants in one pass, every source pixel and its clarity bands are read once for all of them
+	void gradeWedge(const std::vector<GradingSettings>& variants, std::vector<FloatImage>& targets);
+};
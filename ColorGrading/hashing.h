@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit non-cryptographic hash (MurmurHash64A), reads 8 bytes at a time so hashing whole image files is cheap
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// combine 2 hashes into one, order matters
+inline uint64_t hashCombine(uint64_t lhs, uint64_t rhs) { return lhs ^ (rhs + 0x9e3779b97f4a7c15ull + (lhs << 6) + (lhs >> 2)); }
@@ -0,0 +1,184 @@
+#include "hdrimage.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// largest size a QByteArray holds, less its header and terminator
+static const qint64 MAX_ENCODED_SIZE = std::numeric_limits<int>::max() - 64;
+
+bool isHdrImageFile(const QString& filePath)
+{
+	return QFileInfo(filePath).suffix().toLower() == "pfm";
+}
+
+struct PfmHeader
+{
+	int channels;
+	int width;
+	int height;
+	bool littleEndian;
+	qint64 dataOffset;
+};
+
+// "PF" (RGB) or "Pf" (grey), the width, height and scale separated by white space, then a single white space character
+static bool parsePfmHeader(const unsigned char* data, qint64 size, PfmHeader& header)
+{
+	char fields[4][32];
+	qint64 pos = 0;
+	for (int field = 0; field < 4; ++field)
+	{
+		while (pos < size && isspace(data[pos]))
+			++pos;
+		int length = 0;
+		while (pos < size && !isspace(data[pos]) && length < 31)
+			fields[field][length++] = (char)data[pos++];
+		fields[field][length] = 0;
+		if (!length)
+			return false;
+	}
+	// the one white space character after the scale
+	if (pos >= size)
+		return false;
+	header.dataOffset = pos + 1;
+
+	if (!strcmp(fields[0], "PF"))
+		header.channels = 3;
+	else if (!strcmp(fields[0], "Pf"))
+		header.channels = 1;
+	else
+		return false;
+	// checked before they are stored, atoi() of a number out of range is undefined
+	long long width = strtoll(fields[1], nullptr, 10);
+	long long height = strtoll(fields[2], nullptr, 10);
+	if (width <= 0 || height <= 0 || width > PFM_MAX_SIZE || height > PFM_MAX_SIZE)
+		return false;
+	header.width = (int)width;
+	header.height = (int)height;
+	// negative scales are little endian, the magnitude is not used
+	header.littleEndian = atof(fields[3]) < 0.0;
+	return true;
+}
+
+bool decodePfm(const unsigned char* data, qint64 size, FloatImage& image)
+{
+	PfmHeader header;
+	if (!parsePfmHeader(data, size, header))
+		return false;
+	// at most 65535 x 65535 x 3 floats, so this can not overflow in 64 bit
+	qint64 rowFloats = (qint64)header.width * header.channels;
+	if (size - header.dataOffset < rowFloats * header.height * (qint64)sizeof(float))
+		return false;
+
+	image = FloatImage(header.width, header.height);
+	const unsigned char* src = data + header.dataOffset;
+	const uint16_t one = 1;
+	bool swap = header.littleEndian != (*(const unsigned char*)&one == 1);
+	for (int y = 0; y < header.height; ++y)
+	{
+		// rows are stored bottom to top
+		float* dst = image.pixel(0, header.height - 1 - y);
+		for (int x = 0; x < header.width; ++x, dst += 4)
+		{
+			for (int c = 0; c < header.channels; ++c, src += 4)
+			{
+				unsigned char bytes[4] = { src[0], src[1], src[2], src[3] };
+				if (swap)
+				{
+					bytes[0] = src[3];
+					bytes[1] = src[2];
+					bytes[2] = src[1];
+					bytes[3] = src[0];
+				}
+				memcpy(&dst[c], bytes, sizeof(float));
+			}
+			if (header.channels == 1)
+				dst[1] = dst[2] = dst[0];
+			dst[3] = 1.0f;
+		}
+	}
+	return true;
+}
+
+static QByteArray pfmHeader(const FloatImage& image)
+{
+	return QString("PF\n%1 %2\n-1.0\n").arg(image.width).arg(image.height).toLatin1();
+}
+
+// row y of the image as PFM stores it, RGB without alpha
+static void pfmRow(const FloatImage& image, int y, float* dst)
+{
+	const float* src = image.pixel(0, y);
+	for (int x = 0; x < image.width; ++x, src += 4, dst += 3)
+		memcpy(dst, src, 3 * sizeof(float));
+}
+
+QByteArray encodePfm(const FloatImage& image)
+{
+	QByteArray header = pfmHeader(image);
+	qint64 rowBytes = (qint64)image.width * 3 * sizeof(float);
+	qint64 size = header.size() + rowBytes * image.height;
+	if (size > MAX_ENCODED_SIZE)
+		return QByteArray();
+	QByteArray result((int)size, Qt::Uninitialized);
+	memcpy(result.data(), header.constData(), header.size());
+	char* dst = result.data() + header.size();
+	for (int y = image.height - 1; y >= 0; --y, dst += rowBytes)
+		pfmRow(image, y, (float*)dst);
+	return result;
+}
+
+QSize pfmSize(const QString& filePath)
+{
+	QFile fh(filePath);
+	if (!fh.open(QFile::ReadOnly))
+		return QSize();
+	QByteArray start = fh.read(128);
+	PfmHeader header;
+	if (!parsePfmHeader((const unsigned char*)start.constData(), start.size(), header))
+		return QSize();
+	return QSize(header.width, header.height);
+}
+
+bool loadFloatImage(const QString& filePath, FloatImage& image)
+{
+	if (!isHdrImageFile(filePath))
+	{
+		QImage decoded(filePath);
+		if (decoded.isNull())
+			return false;
+		image = FloatImage::fromQImage(decoded);
+		return true;
+	}
+	QFile fh(filePath);
+	if (!fh.open(QFile::ReadOnly) || !fh.size())
+		return false;
+	const unsigned char* data = fh.map(0, fh.size());
+	if (!data)
+		return false;
+	bool decoded = decodePfm(data, fh.size(), image);
+	fh.unmap((uchar*)data);
+	return decoded;
+}
+
+// row by row, so there is no limit to the size like encodePfm() has
+bool savePfm(const QString& filePath, const FloatImage& image)
+{
+	QByteArray header = pfmHeader(image);
+	QFile fh(filePath);
+	if (!fh.open(QFile::WriteOnly) || fh.write(header) != header.size())
+		return false;
+	std::vector<float> row((size_t)image.width * 3);
+	qint64 rowBytes = (qint64)row.size() * sizeof(float);
+	for (int y = image.height - 1; y >= 0; --y)
+	{
+		pfmRow(image, y, &row[0]);
+		if (fh.write((const char*)&row[0], rowBytes) != rowBytes)
+			return false;
+	}
+	return true;
+}
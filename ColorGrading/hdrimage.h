@@ -0,0 +1,31 @@
+#pragma once
+
+#include "grading.h"
+#include <QByteArray>
+#include <QSize>
+#include <QString>
+
+/*
+High dynamic range images as linear floats, for plates that 8 bit files would clip.
+
+The format is PFM (portable float map): a short text header followed by 32 bit float RGB rows, bottom to top.
+Most HDR tools write it and it is read without a decoder library. Values are kept as they are, above 1 included.
+*/
+
+// Largest width and height a PFM header may give, larger files are rejected before anything is allocated
+const int PFM_MAX_SIZE = 65535;
+
+// true for files that are read with decodePfm() instead of QImage
+bool isHdrImageFile(const QString& filePath);
+
+// alpha is set to 1, PFM has none
+bool decodePfm(const unsigned char* data, qint64 size, FloatImage& image);
+// little endian, alpha is dropped. empty if the file would be larger than a QByteArray holds, 2 GB
+QByteArray encodePfm(const FloatImage& image);
+
+// from the header alone, invalid if the file is not a PFM
+QSize pfmSize(const QString& filePath);
+
+// any image the preview and batch take, 8 bit files are decoded to linear like FloatImage::fromQImage()
+bool loadFloatImage(const QString& filePath, FloatImage& image);
+bool savePfm(const QString& filePath, const FloatImage& image);
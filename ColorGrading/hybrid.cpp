@@ -0,0 +1,114 @@
+#include "hybrid.h"
+#include "alerts.h"
+
+HybridScheduler::HybridScheduler(int numFrames) :
+	_numFrames(numFrames)
+{
+	_clock.start();
+}
+
+int HybridScheduler::addEngine(const char* name, int workers)
+{
+	Engine engine;
+	engine.name = name;
+	engine.workers = workers;
+	_engines.push_back(engine);
+	return (int)_engines.size() - 1;
+}
+
+/*
+Not worth it when another engine grades every frame that is left before this one would finish the next,
+counted in rounds of all its workers. An engine only ever steps back for one that is faster per frame,
+so the fastest engine that is left always takes frames and the workers can not all end up waiting.
+Until an engine finished a frame it takes frames, that is how it gets measured.
+*/
+bool HybridScheduler::_worthTaking(int engine, int left) const
+{
+	const Engine& self = _engines[engine];
+	if (self.secondsPerFrame <= 0.0)
+		return true;
+	for (int i = 0; i < (int)_engines.size(); ++i)
+	{
+		const Engine& other = _engines[i];
+		if (i == engine || other.retired || other.workers <= 0 || other.secondsPerFrame <= 0.0)
+			continue;
+		int rounds = (left + other.workers - 1) / other.workers;
+		if (rounds * other.secondsPerFrame < self.secondsPerFrame)
+			return false;
+	}
+	return true;
+}
+
+int HybridScheduler::take(int engine)
+{
+	std::unique_lock<std::mutex> guard(_mutex);
+	for (;;)
+	{
+		if (_engines[engine].retired || _finished >= _numFrames)
+			return -1;
+		int left = _numFrames - _next + (int)_returned.size();
+		if (left > 0 && _worthTaking(engine, left))
+		{
+			if (!_returned.empty())
+			{
+				int frame = _returned.front();
+				_returned.pop_front();
+				return frame;
+			}
+			return _next++;
+		}
+		// the frames in flight may still come back from an engine that gets retired
+		_changed.wait(guard);
+	}
+}
+
+void HybridScheduler::done(int engine, int frame, double seconds, bool failed)
+{
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		Engine& self = _engines[engine];
+		if (self.secondsPerFrame <= 0.0)
+			self.secondsPerFrame = seconds;
+		else
+			self.secondsPerFrame += (seconds - self.secondsPerFrame) * HYBRID_RATE_SMOOTHING;
+		++self.frames;
+		self.busySeconds += seconds;
+		++_finished;
+		if (failed)
+			++_failed;
+	}
+	_changed.notify_all();
+}
+
+void HybridScheduler::retire(int engine, int frame)
+{
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_engines[engine].retired = true;
+		if (frame >= 0)
+			_returned.push_back(frame);
+	}
+	_changed.notify_all();
+}
+
+int HybridScheduler::failed() const
+{
+	// frames nobody was left to grade, when the only engine got retired
+	return _failed + _numFrames - _finished;
+}
+
+void HybridScheduler::report() const
+{
+	// frames per second while busy is the speed of one worker, over the wall time it is what the engine added to the batch
+	double wall = _clock.elapsed() / 1000.0;
+	for (const Engine& engine : _engines)
+	{
+		if (engine.workers <= 0)
+			continue;
+		infod("%s engine: %d frames, %d workers, %.2f frames/s per worker, %.2f frames/s of the batch (%.0f%%)%s", engine.name, engine.frames,
+			engine.workers, engine.busySeconds > 0.0 ? engine.frames / engine.busySeconds : 0.0,
+			wall > 0.0 ? engine.frames / wall : 0.0, _finished ? 100.0 * engine.frames / _finished : 0.0, engine.retired ? ", retired" : "");
+	}
+	if (wall > 0.0)
+		infod("%d frames in %.1f s: %.2f frames/s, %d failed", _finished, wall, _finished / wall, failed());
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Rows and columns of the pixels of every GPU image that are checked against the CPU engine
+const int HYBRID_CHECK_GRID = 64;
+// Weight of the newest frame in the seconds per frame of an engine
+const double HYBRID_RATE_SMOOTHING = 0.2;
+
+/*
+Hands the frames of a batch to engines that grade side by side in one process, the GPU engine and a number of CPU
+worker threads, see --engine in batch.h. Every worker thread of an engine calls take() until it returns -1.
+
+Frames come from one queue in order, a worker takes the next one whenever it is free, so the split between
+the engines follows how fast each of them is without being planned. What does need planning is the end of the batch:
+every engine keeps a moving average of its seconds per frame, and a worker does not take a frame if another engine
+would finish all frames that are left before it finishes that one. It waits instead, in case the other engine
+is retired and hands frames back. So a slow engine never holds up the end with the last frames.
+
+An engine whose output was outside the tolerance is retired, the frame it had goes back to the queue. Every frame is checked
+before anything of it is written, so the frames an engine finished stay finished.
+*/
+class HybridScheduler
+{
+protected:
+	struct Engine
+	{
+		const char* name;
+		int workers;
+		bool retired = false;
+		double secondsPerFrame = 0.0; // per worker, 0 until the first frame is done
+		// throughput
+		int frames = 0;
+		double busySeconds = 0.0;
+	};
+
+	std::vector<Engine> _engines;
+	std::deque<int> _returned; // frames retired engines handed back
+	int _next = 0;
+	int _finished = 0;
+	int _failed = 0;
+	int _numFrames;
+	QElapsedTimer _clock;
+	std::mutex _mutex;
+	std::condition_variable _changed;
+
+	bool _worthTaking(int engine, int left) const;
+
+public:
+	HybridScheduler(int numFrames);
+
+	// before the workers start, returns the engine's index
+	int addEngine(const char* name, int workers);
+
+	// blocks until there is a frame worth taking for the engine, -1 when it should stop
+	int take(int engine);
+	void done(int engine, int frame, double seconds, bool failed);
+	// the engine's output can not be trusted, frame goes back to the queue (-1 for none) and the engine takes no more
+	void retire(int engine, int frame);
+
+	// failed frames and the frames left over if every engine was retired, once the workers are done
+	int failed() const;
+	// logs the frames per second of every engine and of the whole batch
+	void report() const;
+};
@@ -0,0 +1,242 @@
+#include "logging.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+struct LogSlot
+{
+	std::atomic<size_t> sequence;
+	const char* title;
+	char text[LOG_MESSAGE_SIZE];
+};
+
+struct RepeatInfo
+{
+	std::chrono::steady_clock::time_point lastWritten;
+	int suppressed;
+	const char* title;
+};
+
+// bounded multi producer, single consumer queue, slots carry a sequence number so producers never take a lock
+class LogWriter
+{
+	LogSlot _ring[LOG_RING_SIZE];
+	std::atomic<size_t> _enqueuePos;
+	size_t _dequeuePos = 0;
+	std::atomic<size_t> _written;
+	std::atomic<unsigned long long> _dropped;
+
+	std::once_flag _started;
+	std::thread _thread;
+	std::atomic<bool> _stop;
+	std::mutex _wakeLock;
+	std::condition_variable _wake;
+	// flushLog() asks the writer thread to report the repeats it is holding back
+	std::atomic<unsigned> _repeatFlushRequests;
+	std::atomic<unsigned> _repeatFlushesDone;
+
+	std::unordered_map<std::string, RepeatInfo> _repeats;
+
+	void _output(const char* line)
+	{
+#ifdef _WIN32
+		if (IsDebuggerPresent())
+		{
+			OutputDebugStringA(line);
+			return;
+		}
+#endif
+		// stdout can carry graded frames, see framepipe.h
+		fputs(line, stderr);
+	}
+
+	// a burst that ends is otherwise never reported, no message comes along to carry the count
+	void _flushRepeats()
+	{
+		auto now = std::chrono::steady_clock::now();
+		char line[LOG_MESSAGE_SIZE + 64];
+		bool any = false;
+		for (auto& repeat : _repeats)
+		{
+			if (!repeat.second.suppressed)
+				continue;
+			snprintf(line, sizeof(line), "%s: %s (repeated %d more times)\n", repeat.second.title, repeat.first.c_str(), repeat.second.suppressed);
+			_output(line);
+			repeat.second.suppressed = 0;
+			repeat.second.lastWritten = now;
+			any = true;
+		}
+		if (any)
+			fflush(stderr);
+	}
+
+	void _write(const char* title, const char* text)
+	{
+		std::string key = text;
+		auto now = std::chrono::steady_clock::now();
+		auto it = _repeats.find(key);
+		int suppressed = 0;
+		if (it != _repeats.end())
+		{
+			if (now - it->second.lastWritten < std::chrono::milliseconds(LOG_REPEAT_INTERVAL_MS))
+			{
+				++it->second.suppressed;
+				return;
+			}
+			suppressed = it->second.suppressed;
+			it->second = { now, 0, title };
+		}
+		else
+		{
+			// forget old messages instead of growing forever, the counts they held back are reported first
+			if (_repeats.size() > (size_t)LOG_RING_SIZE)
+			{
+				_flushRepeats();
+				_repeats.clear();
+			}
+			_repeats[key] = { now, 0, title };
+		}
+
+		char line[LOG_MESSAGE_SIZE + 64];
+		if (suppressed)
+			snprintf(line, sizeof(line), "%s: %s (repeated %d more times)\n", title, text, suppressed);
+		else
+			snprintf(line, sizeof(line), "%s: %s\n", title, text);
+		_output(line);
+	}
+
+	// drain the ring, returns false if it was empty
+	bool _drain()
+	{
+		bool any = false;
+		for (;;)
+		{
+			LogSlot& slot = _ring[_dequeuePos & (LOG_RING_SIZE - 1)];
+			if (slot.sequence.load(std::memory_order_acquire) != _dequeuePos + 1)
+				break;
+			_write(slot.title, slot.text);
+			slot.sequence.store(_dequeuePos + LOG_RING_SIZE, std::memory_order_release);
+			++_dequeuePos;
+			any = true;
+		}
+		if (any)
+			fflush(stderr);
+		_written.store(_dequeuePos, std::memory_order_release);
+		return any;
+	}
+
+	void _run()
+	{
+		while (!_stop.load())
+		{
+			if (_drain())
+				continue;
+			unsigned requested = _repeatFlushRequests.load();
+			if (requested != _repeatFlushesDone.load())
+			{
+				_flushRepeats();
+				_repeatFlushesDone.store(requested, std::memory_order_release);
+				continue;
+			}
+			// producers notify without the lock, the timeout covers a missed wake up
+			std::unique_lock<std::mutex> guard(_wakeLock);
+			_wake.wait_for(guard, std::chrono::milliseconds(50));
+		}
+		_drain();
+		_flushRepeats();
+	}
+
+	void _start()
+	{
+		std::call_once(_started, [this]() { _thread = std::thread(&LogWriter::_run, this); });
+	}
+
+public:
+	LogWriter() : _enqueuePos(0), _written(0), _dropped(0), _stop(false), _repeatFlushRequests(0), _repeatFlushesDone(0)
+	{
+		for (size_t i = 0; i < LOG_RING_SIZE; ++i)
+			_ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	~LogWriter()
+	{
+		_stop.store(true);
+		_wake.notify_one();
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	void push(const char* title, const char* fmt, va_list args)
+	{
+		_start();
+		size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+		LogSlot* slot;
+		for (;;)
+		{
+			slot = &_ring[pos & (LOG_RING_SIZE - 1)];
+			size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+			if (difference == 0)
+			{
+				if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				++_dropped;
+				return;
+			}
+			else
+				pos = _enqueuePos.load(std::memory_order_relaxed);
+		}
+		slot->title = title;
+		vsnprintf(slot->text, LOG_MESSAGE_SIZE, fmt, args);
+		slot->sequence.store(pos + 1, std::memory_order_release);
+		_wake.notify_one();
+	}
+
+	void flush()
+	{
+		_start();
+		size_t target = _enqueuePos.load();
+		while (_written.load(std::memory_order_acquire) < target)
+		{
+			_wake.notify_one();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		// then the repeats those messages held back
+		unsigned request = ++_repeatFlushRequests;
+		while ((int)(_repeatFlushesDone.load(std::memory_order_acquire) - request) < 0)
+		{
+			_wake.notify_one();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	inline unsigned long long dropped() { return _dropped.load(); }
+};
+
+LogWriter logWriter;
+
+void logMessage(const char* title, const char* fmt, va_list args)
+{
+	logWriter.push(title, fmt, args);
+}
+
+void flushLog()
+{
+	logWriter.flush();
+}
+
+unsigned long long droppedLogMessages()
+{
+	return logWriter.dropped();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdarg>
+
+/*
+Asynchronous log backend used by the message utilities in alerts.h.
+
+Messages are formatted straight into a slot of a fixed size lock-free ring (no allocations),
+a background thread takes them out and does the actual output, so logging from a frame only costs a vsnprintf.
+Formatting can not be deferred any further, most %s arguments point at temporaries.
+
+The writer thread rate limits: identical messages are written at most once per LOG_REPEAT_INTERVAL_MS,
+the number of suppressed repeats is reported with the next one that gets through.
+If the ring is full messages are dropped and counted instead of blocking.
+*/
+
+const int LOG_RING_SIZE = 1024; // must be a power of 2
+const int LOG_MESSAGE_SIZE = 500;
+const int LOG_REPEAT_INTERVAL_MS = 1000;
+
+// title is expected to be a string literal, it is stored by pointer
+void logMessage(const char* title, const char* fmt, va_list args);
+// blocks until everything logged before this call has been written, repeats that were held back included
+void flushLog();
+// number of messages lost because the ring was full
+unsigned long long droppedLogMessages();
@@ -0,0 +1,430 @@
+#include "lut.h"
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define LUT_HAS_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles intrinsics of any instruction set, they are only run after checking the CPU
+#define LUT_AVX2
+#else
+#define LUT_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+int lutPixelBytes(LutPixelFormat format)
+{
+	switch (format)
+	{
+	case LutPixelFormat::rgba8: return 4;
+	case LutPixelFormat::rgb16: return 6;
+	case LutPixelFormat::rgba16f: return 8;
+	}
+	return 0;
+}
+
+static bool cpuHasAvx2()
+{
+#ifndef LUT_HAS_AVX2
+	return false;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	// the OS has to save the ymm registers on a context switch
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static const bool useAvx2 = cpuHasAvx2();
+
+bool lutUsesAvx2()
+{
+	return useAvx2;
+}
+
+static float halfToFloat(uint16_t half)
+{
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1F;
+	uint32_t mantissa = half & 0x3FF;
+	uint32_t bits;
+	if (exponent == 0x1F)
+		bits = sign | 0x7F800000 | (mantissa << 13); // inf and nan
+	else if (exponent)
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	else if (mantissa)
+	{
+		// subnormal, normalized for the float
+		exponent = 113;
+		while (!(mantissa & 0x400))
+		{
+			mantissa <<= 1;
+			--exponent;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	}
+	else
+		bits = sign;
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+// rounds to nearest even, too large values become inf
+static uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	uint32_t magnitude = bits & 0x7FFFFFFF;
+	if (magnitude >= 0x7F800000)
+		return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0);
+	if (magnitude >= 0x477FF000)
+		return sign | 0x7C00;
+	if (magnitude < 0x38800000)
+	{
+		// subnormal or zero, shifted into place with the implicit bit
+		if (magnitude < 0x33000000)
+			return sign;
+		uint32_t exponent = magnitude >> 23;
+		uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t rounded = (mantissa + (1u << (shift - 1)) - 1 + ((mantissa >> shift) & 1)) >> shift;
+		return sign | (uint16_t)rounded;
+	}
+	uint32_t rounded = magnitude + 0xFFF + ((magnitude >> 13) & 1);
+	return sign | (uint16_t)((rounded - 0x38000000) >> 13);
+}
+
+// nan fails every comparison, written so it ends up as 0 like with the AVX2 max and min, not as an index out of the LUT
+static inline float clamp01(float value) { return !(value > 0.0f) ? 0.0f : (value > 1.0f ? 1.0f : value); }
+
+static inline unsigned char toByte(float value)
+{
+	value = value * 255.0f + 0.5f;
+	return (unsigned char)(!(value > 0.0f) ? 0.0f : (value > 255.0f ? 255.0f : value));
+}
+
+static inline uint16_t toShort(float value)
+{
+	value = value * 65535.0f + 0.5f;
+	return (uint16_t)(!(value > 0.0f) ? 0.0f : (value > 65535.0f ? 65535.0f : value));
+}
+
+static inline void loadPixel(LutPixelFormat format, const unsigned char* pixel, float* rgb)
+{
+	switch (format)
+	{
+	case LutPixelFormat::rgba8:
+		for (int c = 0; c < 3; ++c)
+			rgb[c] = pixel[c] * (1.0f / 255.0f);
+		break;
+	case LutPixelFormat::rgb16:
+		for (int c = 0; c < 3; ++c)
+			rgb[c] = ((const uint16_t*)pixel)[c] * (1.0f / 65535.0f);
+		break;
+	case LutPixelFormat::rgba16f:
+		for (int c = 0; c < 3; ++c)
+			rgb[c] = halfToFloat(((const uint16_t*)pixel)[c]);
+		break;
+	}
+}
+
+static inline void storePixel(LutPixelFormat format, const unsigned char* source, unsigned char* target, const float* rgb)
+{
+	switch (format)
+	{
+	case LutPixelFormat::rgba8:
+		for (int c = 0; c < 3; ++c)
+			target[c] = toByte(rgb[c]);
+		target[3] = source[3];
+		break;
+	case LutPixelFormat::rgb16:
+		for (int c = 0; c < 3; ++c)
+			((uint16_t*)target)[c] = toShort(rgb[c]);
+		break;
+	case LutPixelFormat::rgba16f:
+		for (int c = 0; c < 3; ++c)
+			((uint16_t*)target)[c] = floatToHalf(rgb[c]);
+		((uint16_t*)target)[3] = ((const uint16_t*)source)[3];
+		break;
+	}
+}
+
+// offsets in floats of the corner a color's cell starts at and the steps along red, green and blue, plus the position in the cell
+struct LutCell
+{
+	int base;
+	int step[3];
+	float t[3];
+};
+
+static inline LutCell lutCell(const Lut3D& lut, const float* rgb)
+{
+	const int n = lut.size;
+	LutCell cell;
+	int index[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		// the last cell is used for the top edge, with a position of 1 in it
+		float position = clamp01(rgb[c]) * (n - 1);
+		index[c] = (int)position < n - 2 ? (int)position : n - 2;
+		cell.t[c] = position - index[c];
+	}
+	cell.step[0] = 3;
+	cell.step[1] = 3 * n;
+	cell.step[2] = 3 * n * n;
+	cell.base = index[0] * cell.step[0] + index[1] * cell.step[1] + index[2] * cell.step[2];
+	return cell;
+}
+
+static void lookupTrilinear(const Lut3D& lut, const float* rgb, float* result)
+{
+	LutCell cell = lutCell(lut, rgb);
+	const float* c000 = lut.data + cell.base;
+	const float* c100 = c000 + cell.step[0];
+	const float* c010 = c000 + cell.step[1];
+	const float* c110 = c010 + cell.step[0];
+	const float* c001 = c000 + cell.step[2];
+	const float* c101 = c001 + cell.step[0];
+	const float* c011 = c001 + cell.step[1];
+	const float* c111 = c011 + cell.step[0];
+	for (int c = 0; c < 3; ++c)
+	{
+		float x00 = c000[c] + (c100[c] - c000[c]) * cell.t[0];
+		float x10 = c010[c] + (c110[c] - c010[c]) * cell.t[0];
+		float x01 = c001[c] + (c101[c] - c001[c]) * cell.t[0];
+		float x11 = c011[c] + (c111[c] - c011[c]) * cell.t[0];
+		float y0 = x00 + (x10 - x00) * cell.t[1];
+		float y1 = x01 + (x11 - x01) * cell.t[1];
+		result[c] = y0 + (y1 - y0) * cell.t[2];
+	}
+}
+
+/*
+The tetrahedron is picked by the order of the positions in the cell: walking from the first corner along the axis
+with the largest position, then the middle one, then the smallest ends at the opposite corner.
+Ties go to red over green over blue for the largest axis and blue over green over red for the smallest,
+so the two are never the same axis. The AVX2 path picks the same way.
+*/
+static void lookupTetrahedral(const Lut3D& lut, const float* rgb, float* result)
+{
+	LutCell cell = lutCell(lut, rgb);
+	const float* t = cell.t;
+	bool rg = t[0] >= t[1], rb = t[0] >= t[2], gb = t[1] >= t[2];
+	int largest = rg && rb ? 0 : (gb ? 1 : 2);
+	int smallest = gb && rb ? 2 : (rg ? 1 : 0);
+	float x = t[largest];
+	float z = t[smallest];
+	float y = t[0] + t[1] + t[2] - x - z;
+	int diagonal = cell.step[0] + cell.step[1] + cell.step[2];
+	const float* c0 = lut.data + cell.base;
+	const float* c1 = c0 + cell.step[largest];
+	const float* c2 = c0 + diagonal - cell.step[smallest];
+	const float* c3 = c0 + diagonal;
+	for (int c = 0; c < 3; ++c)
+		result[c] = c0[c] + (c1[c] - c0[c]) * x + (c2[c] - c1[c]) * y + (c3[c] - c2[c]) * z;
+}
+
+#ifdef LUT_HAS_AVX2
+
+LUT_AVX2 static inline __m256 gather(const float* data, __m256i offsets)
+{
+	return _mm256_i32gather_ps(data, offsets, 4);
+}
+
+// 8 colors at a time, planes of red, green and blue in and out
+LUT_AVX2 static void lookup8(const Lut3D& lut, bool tetrahedral, const __m256* rgb, __m256* result)
+{
+	const int n = lut.size;
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 scale = _mm256_set1_ps((float)(n - 1));
+	const __m256i last = _mm256_set1_epi32(n - 2);
+	const int steps[3] = { 3, 3 * n, 3 * n * n };
+
+	__m256 t[3];
+	__m256i base = _mm256_setzero_si256();
+	for (int c = 0; c < 3; ++c)
+	{
+		// max and min also turn nan into 0 like the scalar clamp
+		__m256 position = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(rgb[c], zero), one), scale);
+		__m256i index = _mm256_min_epi32(_mm256_cvttps_epi32(position), last);
+		t[c] = _mm256_sub_ps(position, _mm256_cvtepi32_ps(index));
+		base = _mm256_add_epi32(base, _mm256_mullo_epi32(index, _mm256_set1_epi32(steps[c])));
+	}
+	const __m256i stepR = _mm256_set1_epi32(steps[0]);
+	const __m256i stepG = _mm256_set1_epi32(steps[1]);
+	const __m256i stepB = _mm256_set1_epi32(steps[2]);
+
+	if (!tetrahedral)
+	{
+		__m256i c000 = base;
+		__m256i c100 = _mm256_add_epi32(c000, stepR);
+		__m256i c010 = _mm256_add_epi32(c000, stepG);
+		__m256i c110 = _mm256_add_epi32(c010, stepR);
+		__m256i c001 = _mm256_add_epi32(c000, stepB);
+		__m256i c101 = _mm256_add_epi32(c001, stepR);
+		__m256i c011 = _mm256_add_epi32(c001, stepG);
+		__m256i c111 = _mm256_add_epi32(c011, stepR);
+		for (int c = 0; c < 3; ++c)
+		{
+			const float* data = lut.data + c;
+			__m256 v000 = gather(data, c000), v100 = gather(data, c100);
+			__m256 v010 = gather(data, c010), v110 = gather(data, c110);
+			__m256 v001 = gather(data, c001), v101 = gather(data, c101);
+			__m256 v011 = gather(data, c011), v111 = gather(data, c111);
+			__m256 x00 = _mm256_fmadd_ps(_mm256_sub_ps(v100, v000), t[0], v000);
+			__m256 x10 = _mm256_fmadd_ps(_mm256_sub_ps(v110, v010), t[0], v010);
+			__m256 x01 = _mm256_fmadd_ps(_mm256_sub_ps(v101, v001), t[0], v001);
+			__m256 x11 = _mm256_fmadd_ps(_mm256_sub_ps(v111, v011), t[0], v011);
+			__m256 y0 = _mm256_fmadd_ps(_mm256_sub_ps(x10, x00), t[1], x00);
+			__m256 y1 = _mm256_fmadd_ps(_mm256_sub_ps(x11, x01), t[1], x01);
+			result[c] = _mm256_fmadd_ps(_mm256_sub_ps(y1, y0), t[2], y0);
+		}
+		return;
+	}
+
+	// see lookupTetrahedral()
+	__m256i rg = _mm256_castps_si256(_mm256_cmp_ps(t[0], t[1], _CMP_GE_OQ));
+	__m256i rb = _mm256_castps_si256(_mm256_cmp_ps(t[0], t[2], _CMP_GE_OQ));
+	__m256i gb = _mm256_castps_si256(_mm256_cmp_ps(t[1], t[2], _CMP_GE_OQ));
+	__m256i largestStep = _mm256_blendv_epi8(_mm256_blendv_epi8(stepB, stepG, gb), stepR, _mm256_and_si256(rg, rb));
+	__m256i smallestStep = _mm256_blendv_epi8(_mm256_blendv_epi8(stepR, stepG, rg), stepB, _mm256_and_si256(gb, rb));
+	__m256 x = _mm256_max_ps(t[0], _mm256_max_ps(t[1], t[2]));
+	__m256 z = _mm256_min_ps(t[0], _mm256_min_ps(t[1], t[2]));
+	__m256 y = _mm256_sub_ps(_mm256_add_ps(t[0], _mm256_add_ps(t[1], t[2])), _mm256_add_ps(x, z));
+
+	__m256i c0 = base;
+	__m256i c3 = _mm256_add_epi32(base, _mm256_set1_epi32(steps[0] + steps[1] + steps[2]));
+	__m256i c1 = _mm256_add_epi32(c0, largestStep);
+	__m256i c2 = _mm256_sub_epi32(c3, smallestStep);
+	for (int c = 0; c < 3; ++c)
+	{
+		const float* data = lut.data + c;
+		__m256 v0 = gather(data, c0), v1 = gather(data, c1), v2 = gather(data, c2), v3 = gather(data, c3);
+		__m256 sum = _mm256_fmadd_ps(_mm256_sub_ps(v1, v0), x, v0);
+		sum = _mm256_fmadd_ps(_mm256_sub_ps(v2, v1), y, sum);
+		result[c] = _mm256_fmadd_ps(_mm256_sub_ps(v3, v2), z, sum);
+	}
+}
+
+// clamped to 0 to max and rounded like toByte() and toShort()
+LUT_AVX2 static inline __m256i toIntegers(__m256 value, float max)
+{
+	__m256 scaled = _mm256_fmadd_ps(value, _mm256_set1_ps(max), _mm256_set1_ps(0.5f));
+	return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(scaled, _mm256_setzero_ps()), _mm256_set1_ps(max)));
+}
+
+// whole groups of 8 pixels, returns how many pixels were done
+LUT_AVX2 static int applyAvx2(const Lut3D& lut, bool tetrahedral, LutPixelFormat format, const unsigned char* source, unsigned char* target, int numPixels)
+{
+	const int pixelBytes = lutPixelBytes(format);
+	int done = 0;
+	for (; done + 8 <= numPixels; done += 8, source += 8 * pixelBytes, target += 8 * pixelBytes)
+	{
+		__m256 rgb[3], result[3];
+		if (format == LutPixelFormat::rgba8)
+		{
+			// channels are the bytes of 32 bit lanes
+			__m256i pixels = _mm256_loadu_si256((const __m256i*)source);
+			const __m256i byte = _mm256_set1_epi32(0xFF);
+			for (int c = 0; c < 3; ++c)
+				rgb[c] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, c * 8), byte)), _mm256_set1_ps(1.0f / 255.0f));
+			lookup8(lut, tetrahedral, rgb, result);
+			__m256i packed = _mm256_andnot_si256(_mm256_set1_epi32(0x00FFFFFF), pixels);
+			for (int c = 0; c < 3; ++c)
+				packed = _mm256_or_si256(packed, _mm256_slli_epi32(toIntegers(result[c], 255.0f), c * 8));
+			_mm256_storeu_si256((__m256i*)target, packed);
+			continue;
+		}
+
+		// the 16 bit layouts are split into planes with scalar code, the lookup is what costs
+		float planes[3][8];
+		for (int i = 0; i < 8; ++i)
+		{
+			float color[3];
+			loadPixel(format, source + i * pixelBytes, color);
+			for (int c = 0; c < 3; ++c)
+				planes[c][i] = color[c];
+		}
+		for (int c = 0; c < 3; ++c)
+			rgb[c] = _mm256_loadu_ps(planes[c]);
+		lookup8(lut, tetrahedral, rgb, result);
+		if (format == LutPixelFormat::rgb16)
+		{
+			int32_t values[3][8];
+			for (int c = 0; c < 3; ++c)
+				_mm256_storeu_si256((__m256i*)values[c], toIntegers(result[c], 65535.0f));
+			for (int i = 0; i < 8; ++i)
+				for (int c = 0; c < 3; ++c)
+					((uint16_t*)target)[i * 3 + c] = (uint16_t)values[c][i];
+			continue;
+		}
+		for (int c = 0; c < 3; ++c)
+			_mm256_storeu_ps(planes[c], result[c]);
+		for (int i = 0; i < 8; ++i)
+		{
+			float color[3] = { planes[0][i], planes[1][i], planes[2][i] };
+			storePixel(format, source + i * pixelBytes, target + i * pixelBytes, color);
+		}
+	}
+	return done;
+}
+
+#endif
+
+void applyLut(const Lut3D& lut, const unsigned char* source, unsigned char* target, int numPixels, LutPixelFormat format, LutInterpolation interpolation)
+{
+	const int pixelBytes = lutPixelBytes(format);
+	bool tetrahedral = interpolation == LutInterpolation::tetrahedral;
+	int done = 0;
+#ifdef LUT_HAS_AVX2
+	if (useAvx2)
+		done = applyAvx2(lut, tetrahedral, format, source, target, numPixels);
+#endif
+	source += done * pixelBytes;
+	target += done * pixelBytes;
+	for (int i = done; i < numPixels; ++i, source += pixelBytes, target += pixelBytes)
+	{
+		float color[3], result[3];
+		loadPixel(format, source, color);
+		if (tetrahedral)
+			lookupTetrahedral(lut, color, result);
+		else
+			lookupTrilinear(lut, color, result);
+		storePixel(format, source, target, result);
+	}
+}
+
+void applyLutRows(const Lut3D& lut, const unsigned char* source, int sourceStride, unsigned char* target, int targetStride, int width, int height,
+	LutPixelFormat format, LutInterpolation interpolation, int threads)
+{
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency() ? (int)std::thread::hardware_concurrency() : 1;
+	threads = threads < height ? threads : (height ? height : 1);
+
+	auto band = [=](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+			applyLut(lut, source + (size_t)y * sourceStride, target + (size_t)y * targetStride, width, format, interpolation);
+	};
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; ++i)
+		workers.emplace_back(band, height * i / threads, height * (i + 1) / threads);
+	// the calling thread takes the first band
+	band(0, height / threads);
+	for (std::thread& worker : workers)
+		worker.join();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+View of a 3D LUT of size^3 RGB floats, red varies fastest, see bakeLut().
+The data is owned elsewhere, e.g. a std::vector or a mapped cache file.
+*/
+struct Lut3D
+{
+	int size;
+	const float* data;
+};
+
+/*
+Trilinear blends the 8 corners of the cell a color falls in, tetrahedral splits the cell into 6 tetrahedra along
+its grey diagonal and blends the 4 corners of one. Tetrahedral reads half the entries and keeps neutrals neutral.
+*/
+enum class LutInterpolation
+{
+	trilinear,
+	tetrahedral,
+};
+
+// Pixel layouts the LUT is applied to, alpha is copied as is
+enum class LutPixelFormat
+{
+	rgba8,
+	rgb16, // 3 unsigned shorts per pixel, no alpha
+	rgba16f, // 4 half floats per pixel, results are not clamped
+};
+
+int lutPixelBytes(LutPixelFormat format);
+
+/*
+Apply to a run of pixels. With AVX2 8 pixels are looked up at a time with gathers, the rest of a run
+and CPUs without AVX2 go through the scalar path, the two agree up to float rounding.
+*/
+void applyLut(const Lut3D& lut, const unsigned char* source, unsigned char* target, int numPixels,
+	LutPixelFormat format = LutPixelFormat::rgba8, LutInterpolation interpolation = LutInterpolation::trilinear);
+
+// Apply to the rows of an image, split into bands over threads, 0 uses one per core. Strides are in bytes.
+void applyLutRows(const Lut3D& lut, const unsigned char* source, int sourceStride, unsigned char* target, int targetStride, int width, int height,
+	LutPixelFormat format = LutPixelFormat::rgba8, LutInterpolation interpolation = LutInterpolation::trilinear, int threads = 0);
+
+// True if applyLut() uses the AVX2 path on this CPU
+bool lutUsesAvx2();
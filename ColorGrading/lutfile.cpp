@@ -0,0 +1,340 @@
+#include "lutfile.h"
+#include <QFile>
+#include <QFileInfo>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+LutFileFormat lutFileFormat(const QString& filePath)
+{
+	QString extension = QFileInfo(filePath).suffix().toLower();
+	if (extension == "cube")
+		return LutFileFormat::cube;
+	if (extension == "3dl")
+		return LutFileFormat::threeDl;
+	return LutFileFormat::unknown;
+}
+
+// a parsed LUT in the cache, followed by size^3 RGB floats
+struct CachedLutHeader
+{
+	char magic[4];
+	uint32_t size;
+};
+
+static const char CACHED_LUT_MAGIC[4] = { 'L', 'U', 'T', '3' };
+
+static inline qint64 cachedLutBytes(int size) { return (qint64)sizeof(CachedLutHeader) + (qint64)size * size * size * 3 * sizeof(float); }
+
+// lines of a text file, without their line breaks
+class LineReader
+{
+protected:
+	const char* _pos;
+	const char* _end;
+	int _number = 0;
+
+public:
+	LineReader(const QByteArray& text) : _pos(text.constData()), _end(text.constData() + text.size()) {}
+
+	inline int number() const { return _number; }
+
+	// next line that is not empty or a comment, with the leading white space skipped
+	bool next(const char*& line, const char*& lineEnd)
+	{
+		while (_pos < _end)
+		{
+			line = _pos;
+			while (_pos < _end && *_pos != '\n' && *_pos != '\r')
+				++_pos;
+			lineEnd = _pos;
+			// \r\n counts as one line
+			if (_pos < _end && *_pos == '\r')
+				++_pos;
+			if (_pos < _end && *_pos == '\n')
+				++_pos;
+			++_number;
+			while (line < lineEnd && (*line == ' ' || *line == '\t'))
+				++line;
+			if (line < lineEnd && *line != '#')
+				return true;
+		}
+		return false;
+	}
+};
+
+// numbers at the start of a line, strtof alone would carry on into the next line
+static int parseNumbers(const char* line, const char* lineEnd, float* values, int count)
+{
+	int parsed = 0;
+	const char* pos = line;
+	while (parsed < count)
+	{
+		char* next = nullptr;
+		float value = strtof(pos, &next);
+		if (next == pos || next > lineEnd)
+			break;
+		values[parsed++] = value;
+		pos = next;
+	}
+	return parsed;
+}
+
+static inline bool isKeyword(const char* line, const char* lineEnd, const char* keyword)
+{
+	size_t length = strlen(keyword);
+	return (size_t)(lineEnd - line) >= length && !memcmp(line, keyword, length)
+		&& ((size_t)(lineEnd - line) == length || line[length] == ' ' || line[length] == '\t');
+}
+
+static inline bool setError(QString* error, const QString& message)
+{
+	if (error)
+		*error = message;
+	return false;
+}
+
+static bool parseCube(const QByteArray& text, std::vector<float>& values, int& size, QString* error)
+{
+	LineReader reader(text);
+	const char* line;
+	const char* lineEnd;
+	size = 0;
+	size_t entries = 0;
+	while (reader.next(line, lineEnd))
+	{
+		float numbers[3];
+		if ((*line >= 'A' && *line <= 'Z') || (*line >= 'a' && *line <= 'z'))
+		{
+			const char* arguments = line;
+			while (arguments < lineEnd && *arguments != ' ' && *arguments != '\t')
+				++arguments;
+			if (isKeyword(line, lineEnd, "LUT_3D_SIZE"))
+			{
+				if (parseNumbers(arguments, lineEnd, numbers, 1) != 1 || numbers[0] < 2.0f || numbers[0] > 256.0f)
+					return setError(error, QString("line %1: LUT_3D_SIZE must be between 2 and 256").arg(reader.number()));
+				size = (int)numbers[0];
+				values.resize((size_t)size * size * size * 3);
+			}
+			else if (isKeyword(line, lineEnd, "LUT_1D_SIZE"))
+				return setError(error, "1D LUTs are not supported");
+			else if (isKeyword(line, lineEnd, "DOMAIN_MIN") || isKeyword(line, lineEnd, "DOMAIN_MAX"))
+			{
+				// the preview and batch index LUTs with [0, 1] encoded colors, other domains would need a shaper
+				float wanted = isKeyword(line, lineEnd, "DOMAIN_MIN") ? 0.0f : 1.0f;
+				if (parseNumbers(arguments, lineEnd, numbers, 3) != 3 || numbers[0] != wanted || numbers[1] != wanted || numbers[2] != wanted)
+					return setError(error, QString("line %1: only a domain of 0 to 1 is supported").arg(reader.number()));
+			}
+			else if (isKeyword(line, lineEnd, "LUT_3D_INPUT_RANGE"))
+			{
+				if (parseNumbers(arguments, lineEnd, numbers, 2) != 2 || numbers[0] != 0.0f || numbers[1] != 1.0f)
+					return setError(error, QString("line %1: only an input range of 0 to 1 is supported").arg(reader.number()));
+			}
+			// TITLE and keywords of other tools don't change the values
+			continue;
+		}
+
+		if (!size)
+			return setError(error, QString("line %1: values before LUT_3D_SIZE").arg(reader.number()));
+		if (entries == values.size() / 3)
+			return setError(error, QString("line %1: more than %2^3 values").arg(reader.number()).arg(size));
+		if (parseNumbers(line, lineEnd, &values[entries * 3], 3) != 3)
+			return setError(error, QString("line %1: expected 3 numbers").arg(reader.number()));
+		++entries;
+	}
+	if (!size)
+		return setError(error, "no LUT_3D_SIZE");
+	if (entries != values.size() / 3)
+		return setError(error, QString("%1 values for a %2^3 LUT").arg(entries).arg(size));
+	return true;
+}
+
+/*
+.3dl files start with the input mesh, one line with the input value of every grid point, followed by integer
+triplets with blue varying fastest. The output bit depth is the second number of a "Mesh" line if there is one,
+without it 12 bit is assumed, or 16 bit if any value is above 4095.
+*/
+static bool parse3dl(const QByteArray& text, std::vector<float>& values, int& size, QString* error)
+{
+	LineReader reader(text);
+	const char* line;
+	const char* lineEnd;
+	size = 0;
+	int outputBits = 0;
+	std::vector<float> triplets;
+	while (reader.next(line, lineEnd))
+	{
+		if ((*line >= 'A' && *line <= 'Z') || (*line >= 'a' && *line <= 'z'))
+		{
+			float bits[2];
+			if (isKeyword(line, lineEnd, "Mesh") && parseNumbers(line + 4, lineEnd, bits, 2) == 2)
+				outputBits = (int)bits[1];
+			// 3DMESH, LUT8, gamma and the like don't change the values
+			continue;
+		}
+
+		if (!size)
+		{
+			float mesh[257];
+			size = parseNumbers(line, lineEnd, mesh, 257);
+			if (size < 2 || size > 256)
+				return setError(error, QString("line %1: the input mesh must have between 2 and 256 points").arg(reader.number()));
+			triplets.reserve((size_t)size * size * size * 3);
+			continue;
+		}
+
+		float numbers[3];
+		if (triplets.size() == (size_t)size * size * size * 3)
+			return setError(error, QString("line %1: more than %2^3 values").arg(reader.number()).arg(size));
+		if (parseNumbers(line, lineEnd, numbers, 3) != 3)
+			return setError(error, QString("line %1: expected 3 numbers").arg(reader.number()));
+		triplets.insert(triplets.end(), numbers, numbers + 3);
+	}
+	if (!size)
+		return setError(error, "no input mesh");
+	if (triplets.size() != (size_t)size * size * size * 3)
+		return setError(error, QString("%1 values for a %2^3 LUT").arg(triplets.size() / 3).arg(size));
+
+	if (!outputBits)
+	{
+		float largest = 0.0f;
+		for (float value : triplets)
+			largest = value > largest ? value : largest;
+		outputBits = largest > 4095.0f ? 16 : 12;
+	}
+	if (outputBits < 8 || outputBits > 16)
+		return setError(error, QString("unsupported output bit depth %1").arg(outputBits));
+	float scale = 1.0f / ((1 << outputBits) - 1);
+
+	// from blue fastest to red fastest
+	values.resize(triplets.size());
+	const float* src = &triplets[0];
+	for (int r = 0; r < size; ++r)
+	{
+		for (int g = 0; g < size; ++g)
+		{
+			for (int b = 0; b < size; ++b, src += 3)
+			{
+				float* dst = &values[((size_t)(b * size + g) * size + r) * 3];
+				for (int c = 0; c < 3; ++c)
+					dst[c] = src[c] * scale;
+			}
+		}
+	}
+	return true;
+}
+
+bool LutFile::load(const QString& filePath, GradeCache* cache, QString* error)
+{
+	LutFileFormat format = lutFileFormat(filePath);
+	if (format == LutFileFormat::unknown)
+		return setError(error, "not a .cube or .3dl file");
+
+	uint64_t hash = 0;
+	if (!hashFile(filePath, hash))
+		return setError(error, "could not read the file");
+	CacheKey key = { format == LutFileFormat::cube ? "cube" : "3dl", hash, 0, LUT_FILE_PARSER_VERSION };
+
+	_cached = CacheEntry();
+	_parsed.clear();
+	_lut = { 0, nullptr };
+	if (cache)
+		_cached = cache->find(key);
+	if (_cached.valid())
+	{
+		const CachedLutHeader* header = (const CachedLutHeader*)_cached.data();
+		if (_cached.size() >= (qint64)sizeof(CachedLutHeader) && !memcmp(header->magic, CACHED_LUT_MAGIC, sizeof(header->magic))
+			&& _cached.size() == cachedLutBytes(header->size))
+		{
+			_lut = { (int)header->size, (const float*)(_cached.data() + sizeof(CachedLutHeader)) };
+			return true;
+		}
+		// not what this version writes, parsed again and overwritten below
+		_cached = CacheEntry();
+	}
+
+	QFile fh(filePath);
+	if (!fh.open(QFile::ReadOnly))
+		return setError(error, "could not read the file");
+	QByteArray text = fh.readAll();
+	std::vector<float> values;
+	int size = 0;
+	if (!(format == LutFileFormat::cube ? parseCube(text, values, size, error) : parse3dl(text, values, size, error)))
+		return false;
+
+	if (cache)
+	{
+		std::vector<unsigned char> entry((size_t)cachedLutBytes(size));
+		CachedLutHeader header;
+		memcpy(header.magic, CACHED_LUT_MAGIC, sizeof(header.magic));
+		header.size = size;
+		memcpy(&entry[0], &header, sizeof(header));
+		memcpy(&entry[sizeof(header)], &values[0], values.size() * sizeof(float));
+		cache->store(key, &entry[0], (qint64)entry.size());
+	}
+	_parsed = std::move(values);
+	_lut = { size, &_parsed[0] };
+	return true;
+}
+
+bool saveLutFile(const QString& filePath, const Lut3D& lut, const QString& title)
+{
+	LutFileFormat format = lutFileFormat(filePath);
+	if (format == LutFileFormat::unknown || !lut.data || lut.size < 2)
+		return false;
+
+	int size = lut.size;
+	std::string text;
+	text.reserve((size_t)size * size * size * 32 + 256);
+	char line[128];
+	if (format == LutFileFormat::cube)
+	{
+		text += "# Exported by ColorGrading\n";
+		if (!title.isEmpty())
+		{
+			// the title is quoted, quotes in it can not be escaped
+			QString quoteless = title;
+			quoteless.remove('"');
+			text += "TITLE \"" + quoteless.toStdString() + "\"\n";
+		}
+		snprintf(line, sizeof(line), "LUT_3D_SIZE %d\nDOMAIN_MIN 0.0 0.0 0.0\nDOMAIN_MAX 1.0 1.0 1.0\n", size);
+		text += line;
+		// same order as in memory, red fastest
+		const float* src = lut.data;
+		for (int i = 0; i < size * size * size; ++i, src += 3)
+		{
+			snprintf(line, sizeof(line), "%.6f %.6f %.6f\n", src[0], src[1], src[2]);
+			text += line;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < size; ++i)
+		{
+			snprintf(line, sizeof(line), i ? " %d" : "%d", (int)lroundf(i * 1023.0f / (size - 1)));
+			text += line;
+		}
+		text += "\n";
+		// blue fastest
+		for (int r = 0; r < size; ++r)
+		{
+			for (int g = 0; g < size; ++g)
+			{
+				for (int b = 0; b < size; ++b)
+				{
+					const float* src = lut.data + ((size_t)(b * size + g) * size + r) * 3;
+					int values[3];
+					for (int c = 0; c < 3; ++c)
+						values[c] = (int)lroundf((src[c] < 0.0f ? 0.0f : (src[c] > 1.0f ? 1.0f : src[c])) * 4095.0f);
+					snprintf(line, sizeof(line), "%d %d %d\n", values[0], values[1], values[2]);
+					text += line;
+				}
+			}
+		}
+	}
+
+	QFile fh(filePath);
+	return fh.open(QFile::WriteOnly) && fh.write(text.data(), (qint64)text.size()) == (qint64)text.size();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cache.h"
+#include "lut.h"
+#include <QString>
+#include <vector>
+
+/*
+Exchange of looks with other grading tools through .cube (Resolve, Adobe) and .3dl (Lustre, Nuke) 3D LUT files.
+
+Parsing a 65^3 LUT means reading 275k lines of text, so parsed LUTs are kept in the GradeCache keyed on a hash of
+the file content. Opening the same file again maps the floats straight from the cache.
+*/
+
+enum class LutFileFormat
+{
+	unknown,
+	cube,
+	threeDl,
+};
+
+// from the file extension
+LutFileFormat lutFileFormat(const QString& filePath);
+
+// bump when the parsers make something else of a file, LUTs cached by older parsers are not used
+const uint32_t LUT_FILE_PARSER_VERSION = 1;
+
+/*
+A LUT read from a file, red varies fastest like bakeLut() makes them.
+Holds either the mapped cache entry or the parsed values, move only.
+*/
+class LutFile
+{
+protected:
+	CacheEntry _cached;
+	std::vector<float> _parsed;
+	Lut3D _lut = { 0, nullptr };
+
+public:
+	inline bool valid() const { return _lut.data != nullptr; }
+	inline const Lut3D& lut() const { return _lut; }
+	// true if mapped from the cache instead of parsed
+	inline bool cached() const { return _cached.valid(); }
+
+	// cache may be null. When it returns false error says what is wrong with the file.
+	bool load(const QString& filePath, GradeCache* cache, QString* error = nullptr);
+};
+
+/*
+Writes a LUT in the format of the extension. .cube files get the float values and the title,
+.3dl files a 10 bit input mesh and 12 bit integer values, clamped to [0, 1].
+*/
+bool saveLutFile(const QString& filePath, const Lut3D& lut, const QString& title = QString());
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+
+/*
+Hands the newest value from one thread to another without locks, for state where only the latest value matters.
+
+Three slots: the writer fills its draft, the reader works on its current slot and the third sits between them.
+post() swaps the draft with the middle slot and take() swaps the middle slot with the current one, both with a single
+atomic exchange, so neither side ever waits. A value the reader has not taken yet is replaced by the next one.
+Slots are reused as they are, a writer that fills its draft in place (e.g. a texture it renders into)
+gets back what the reader let go of.
+
+Exactly one thread may write and one thread may read.
+*/
+template<typename T>
+class Mailbox
+{
+protected:
+	static const int FRESH = 4;
+
+	T _slots[3];
+	// index of the middle slot, FRESH while it holds a value the reader has not taken
+	std::atomic<int> _middle;
+	int _draft = 0;
+	int _current = 1;
+
+public:
+	Mailbox() : _middle(2) {}
+	Mailbox(const Mailbox&) = delete;
+	Mailbox& operator=(const Mailbox&) = delete;
+
+	// writer side
+	inline T& draft() { return _slots[_draft]; }
+	inline void post() { _draft = _middle.exchange(_draft | FRESH, std::memory_order_acq_rel) & ~FRESH; }
+
+	// reader side, false if nothing was posted since the last take and current() is unchanged
+	inline bool take()
+	{
+		if (!(_middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		_current = _middle.exchange(_current, std::memory_order_acq_rel) & ~FRESH;
+		return true;
+	}
+	inline T& current() { return _slots[_current]; }
+
+	// all slots, e.g. to release what they hold once neither thread uses them anymore
+	inline T& slot(int index) { return _slots[index]; }
+};
@@ -9,6 +9,19 @@
 #include "buffers.h"
 #include "materials.h"
 #include "alerts.h"
+#include "profiling.h"
+#include "tracing.h"
+#include "grading.h"
+#include "match.h"
+#include "lutfile.h"
+#include "hdrimage.h"
+#include "batch.h"
+#include "sourcebin.h"
+#include "statistics.h"
+#include "mailbox.h"
+#include "renderthread.h"
+#include <atomic>
+#include <thread>
 
 struct ColorWheelSettings
 {
@@ -39,7 +52,7 @@ float max(float lhs, float rhs)
 	return rhs;
 }
 
-QConicalGradient hueGradient()
+QConicalGradient buildHueGradient()
 {
 	QConicalGradient gradient;
 	
@@ -57,6 +70,98 @@ QConicalGradient hueGradient()
 	return gradient;
 }
 
+const QConicalGradient& hueGradient()
+{
+	static const QConicalGradient gradient = buildHueGradient();
+	return gradient;
+}
+
+/*
+The parts of a color wheel that don't depend on its value, rendered once per size and device pixel ratio
+and shared by all wheels. The white ring value is drawn in between the 2 layers.
+*/
+struct ColorWheelLayers
+{
+	QPixmap background; // background and the empty ring slider
+	QPixmap foreground; // hue ring, drop shadow and axes, transparent outside the ring slider
+	QRect ringRegion; // rect the ring slider value arc is drawn in
+	QRect motionRegion; // rect of the hue ring, used to map mouse input
+};
+
+// pixmaps can not outlive the QApplication, main() clears this before it goes
+std::map<qint64, ColorWheelLayers> colorWheelLayerCache;
+
+const ColorWheelLayers& colorWheelLayers(QSize size, qreal devicePixelRatio)
+{
+	std::map<qint64, ColorWheelLayers>& cache = colorWheelLayerCache;
+	qint64 key = ((qint64)size.width() << 40) | ((qint64)size.height() << 20) | (qint64)(devicePixelRatio * 100.0);
+	auto it = cache.find(key);
+	if (it != cache.end())
+		return it->second;
+
+	const QColor light(140, 140, 140);
+	const QColor mid(80, 80, 80);
+	const QColor dark(40, 40, 40);
+
+	ColorWheelLayers& layers = cache[key];
+	layers.background = QPixmap(size * devicePixelRatio);
+	layers.background.setDevicePixelRatio(devicePixelRatio);
+	layers.foreground = QPixmap(size * devicePixelRatio);
+	layers.foreground.setDevicePixelRatio(devicePixelRatio);
+	layers.foreground.fill(Qt::transparent);
+
+	QRect geo(QPoint(0, 0), size);
+	{
+		QPainter painter(&layers.background);
+		painter.setPen(Qt::NoPen);
+		painter.setRenderHints(QPainter::Antialiasing | QPainter::HighQualityAntialiasing);
+
+		// background
+		painter.fillRect(geo, mid);
+
+		// ring slider background
+		painter.setBrush(dark);
+		geo.adjust(4, 4, -4, -4);
+		painter.drawEllipse(geo);
+		layers.ringRegion = geo;
+	}
+
+	QPainter painter(&layers.foreground);
+	painter.setPen(Qt::NoPen);
+	painter.setRenderHints(QPainter::Antialiasing | QPainter::HighQualityAntialiasing);
+
+	// mask the center, so it's not a pie chart but a ring slider
+	painter.setBrush(mid);
+	geo.adjust(2, 2, -2, -2);
+	painter.drawEllipse(geo);
+
+	// draw the hue ring
+	painter.setBrush(hueGradient());
+	geo.adjust(6, 6, -6, -6);
+	painter.drawEllipse(geo);
+	layers.motionRegion = geo;
+
+	// draw drop shadow
+	painter.setBrush(dark);
+	geo.adjust(8, 8, -8, -8);
+	painter.drawEllipse(geo);
+
+	// mask out the drop shadow
+	painter.setBrush(mid);
+	geo.adjust(2, 2, -2, -2);
+	painter.drawEllipse(geo);
+
+	// draw the axes of the central widget region
+	painter.setBrush(Qt::NoBrush);
+	painter.setPen(light);
+	float x = geo.center().x() + 0.5f;
+	float y = geo.center().y() + 0.5f;
+	painter.drawLine(QLineF(geo.x(), y, geo.right(), y));
+	painter.drawLine(QLineF(x, geo.y(), x, geo.bottom()));
+
+	return layers;
+}
+
 /*
 Color wheel control inspired by DaVinci Resolve
 Differences:
@@ -107,7 +212,7 @@ public:
 
 		setFixedSize(128, 128);
 #pragma warning(suppress: 4100)
-		connect(this, &ColorWheelWidget::changed, this, [=](ColorWheelSettings state) { this->repaint(); });
+		connect(this, &ColorWheelWidget::changed, this, [=](ColorWheelSettings state) { this->update(); });
 	}
 
 	void reset()
@@ -129,6 +234,8 @@ public:
 
 	virtual void mouseMoveEvent(QMouseEvent* event) override
 	{
+		TRACE_SCOPE("ColorWheelWidget::mouseMoveEvent");
+
 		// mouse delta in unit space
 		float dx = (event->x() - dragStart.x()) / (float)motionRegion.width();
 		float dy = (event->y() - dragStart.y()) / (float)motionRegion.height();
@@ -170,68 +277,34 @@ public:
 	virtual void paintEvent(QPaintEvent* event) override
 	{
 		const QColor light(140, 140, 140);
-		const QColor mid(80, 80, 80);
-		const QColor dark(40, 40, 40);
+		const ColorWheelLayers& layers = colorWheelLayers(size(), devicePixelRatioF());
+		motionRegion = layers.motionRegion;
 
 		QPainter painter(this);
 		painter.setPen(Qt::NoPen);
 		painter.setRenderHints(QPainter::Antialiasing | QPainter::HighQualityAntialiasing);
-		
-		QRect geo(0, 0, width(), height());
-		
-		// background
-		painter.fillRect(geo, mid);
-		
-		// ring slider background
-		painter.setBrush(dark);
-		geo.adjust(4,4,-4,-4);
-		painter.drawEllipse(geo);
-		
+
+		painter.drawPixmap(0, 0, layers.background);
+
 		// ring slider value
 		painter.setBrush(light);
 		QPainterPath wedge;
-		wedge.moveTo(geo.center());
-		wedge.arcTo((QRectF)geo, arcStart(), clamp(state.white, -1.0f, 1.0f) * -180);
+		wedge.moveTo(layers.ringRegion.center());
+		wedge.arcTo((QRectF)layers.ringRegion, arcStart(), clamp(state.white, -1.0f, 1.0f) * -180);
 		painter.drawPath(wedge);
-		
-		// mask the center, so it's not a pie chart but a ring slider
-		painter.setBrush(mid);
-		geo.adjust(2, 2, -2, -2);
-		painter.drawEllipse(geo);
-		
-		// draw the hue ring
-		painter.setBrush(hueGradient());
-		geo.adjust(6,6,-6,-6);
-		painter.drawEllipse(geo);
-		motionRegion = QRect(geo);
-		
-		// draw drop shadow
-		painter.setBrush(dark);
-		geo.adjust(8,8,-8,-8);
-		painter.drawEllipse(geo);
-		
-		// mask out the drop shadow
-		painter.setBrush(mid);
-		geo.adjust(2,2,-2,-2);
-		painter.drawEllipse(geo);
-		
-		// draw the axes of the central widget region
-        painter.setBrush(Qt::NoBrush);
-        painter.setPen(light);
-        float x = geo.center().x() + 0.5f;
-        float y = geo.center().y() + 0.5f;
-        painter.drawLine(QLineF(geo.x(), y, geo.right(), y));
-        painter.drawLine(QLineF(x, geo.y(), x, geo.bottom()));
-		
+
+		painter.drawPixmap(0, 0, layers.foreground);
+
 		// draw the blue & red control
 		float excessMagnitude = sqrtf(max(state.blue * state.blue + state.red * state.red, 1.0f));
-		x = ((state.blue / excessMagnitude) * 0.5f) * motionRegion.width();
-		y = ((-state.red / excessMagnitude) * 0.5f) * motionRegion.height();
+		float x = ((state.blue / excessMagnitude) * 0.5f) * motionRegion.width();
+		float y = ((-state.red / excessMagnitude) * 0.5f) * motionRegion.height();
 		
 		QPoint cursor = motionRegion.center() + QPoint((int)x, (int)y);
 		QPen pen(light);
 		pen.setWidth(2);
 		painter.setPen(pen);
+		painter.setBrush(Qt::NoBrush);
 		painter.drawEllipse(QRect(cursor - QPoint(5, 5), QSize(11, 11)));
 	}
 
@@ -261,11 +334,11 @@ public:
 
 	virtual void setValue(const ColorWheelSettings& newState) override
 	{
-		state.y = newState.y / ((state.y <= 0.0f) ? 1.0f : 15.0f);
-		state.red = newState.y / ((state.red <= 0.0f) ? 1.0f : 2.0f);
-		state.green = newState.y / ((state.green <= 0.0f) ? 1.0f : 2.0f);
-		state.blue = newState.y / ((state.blue <= 0.0f) ? 1.0f : 2.0f);
-		state.white = newState.white / ((state.white <= 0.0f) ? 1.0f : 15.0f);
+		state.y = newState.y / ((newState.y <= 0.0f) ? 1.0f : 15.0f);
+		state.red = newState.red / ((newState.red <= 0.0f) ? 1.0f : 2.0f);
+		state.green = newState.green / ((newState.green <= 0.0f) ? 1.0f : 2.0f);
+		state.blue = newState.blue / ((newState.blue <= 0.0f) ? 1.0f : 2.0f);
+		state.white = newState.white / ((newState.white <= 0.0f) ? 1.0f : 15.0f);
 	}
 };
 
@@ -379,6 +452,14 @@ public:
 		return QVector3D(r, g, b);
 	}
 
+	// inverse of value(), the wheel moves red and blue around y so green ends up in y
+	void setValue(const QVector3D& rgb)
+	{
+		wheel->setValue({ rgb.y(), rgb.x() - rgb.y(), 0.0f, rgb.z() - rgb.y(), 0.0f });
+		wheel->update();
+		forwardChanged(wheel->value());
+	}
+
 signals:
 	void changed(ColorWheelSettings state);
 };
@@ -391,6 +472,7 @@ protected:
 	virtual void instantiateWheel() override
 	{
 		wheel = new GainWidget;
+		connect(wheel, &ColorWheelWidget::changed, this, &ColorWheel::forwardChanged);
 	}
 
 public:
@@ -429,7 +511,7 @@ public:
 		caption(text), minimum(minimum), maximum(maximum), QLabel("", parent, f)
 	{
 		setValue(initialValue);
-		connect(this, SIGNAL(valueChanged(float)), this, SLOT(repaint()));
+		connect(this, SIGNAL(valueChanged(float)), this, SLOT(update()));
 	}
 
 	virtual float value()
@@ -447,6 +529,7 @@ public:
 
 	virtual void mouseMoveEvent(QMouseEvent* event) override
 	{
+		TRACE_SCOPE("LabelSlider::mouseMoveEvent");
 		float t = event->x() / (float)width();
 		setValue(t * (maximum - minimum) + minimum);
 	}
@@ -463,8 +546,11 @@ public:
 		const QBrush* fg = foreground();
 		if (fg)
 		{
-			geo.setWidth(int(((current - minimum) / (maximum - minimum)) * geo.width()));
+			// the foreground spans the whole slider and is clipped at the value, so gradients can be cached
+			painter.save();
+			painter.setClipRect(QRect(0, 0, int(((current - minimum) / (maximum - minimum)) * geo.width()), geo.height()));
 			painter.fillRect(geo, *fg);
+			painter.restore();
 		}
 
 		// draw default label behaviour on top
@@ -504,6 +590,11 @@ protected:
 	const float SMEAR = 3.0f;
 	const float STOP = 4000.0f;
 
+	// the full temperature gradient, built once
+	QBrush gradient;
+	// the current color, updated when the value changes
+	QBrush currentColor;
+
 	float mapped(float t)
 	{
 		// do a kind of fish eye at 0.5 to stretch the interesting bit out more
@@ -528,6 +619,14 @@ public:
 	explicit TemperatureSlider(const QString& text, QWidget *parent = Q_NULLPTR, Qt::WindowFlags f = Qt::WindowFlags()) :
 		LabelSlider(text, 0.0f, 1.0f, 0.0f, parent, f)
 	{
+		QLinearGradient stops;
+		stops.setFinalStop(1.0f, 0.0f);
+		stops.setCoordinateMode(QGradient::ObjectBoundingMode);
+		const int N = 20;
+		for (int i = 0; i <= N; ++i)
+			stops.setColorAt(i / (float)N, colorFromKelvin(mapped(i / (float)N)));
+		gradient = QBrush(stops);
+
 		setValue(66.0f);
 	}
 
@@ -539,6 +638,7 @@ public:
 	virtual void setValue(float value) override
 	{
 		current = unmapped(value);
+		currentColor = QBrush(colorFromKelvin(value));
 		CONVERT_QSTRING(caption, text);
 		setText(format<QString>("%s: %.02f", text, value));
 		emit valueChanged(value);
@@ -546,51 +646,29 @@ public:
 
 	virtual void mouseMoveEvent(QMouseEvent* event) override
 	{
+		TRACE_SCOPE("TemperatureSlider::mouseMoveEvent");
 		float t = clamp(event->x() / (float)width(), 0.0f, 1.0f);
 		current = t;
 		float value = mapped(t);
+		currentColor = QBrush(colorFromKelvin(value));
 		CONVERT_QSTRING(caption, text);
 		setText(format<QString>("%s: %.02f", text, value));
 		emit valueChanged(value);
 	}
 
 	// approach the temperature gradient up until this point
-	virtual QBrush* foreground() override 
+	virtual const QBrush* foreground() override 
 	{
-		QLinearGradient gradient;
-		gradient.setFinalStop(1.0f, 0.0f);
-		gradient.setCoordinateMode(QGradient::ObjectBoundingMode);
-		const int N = 20;
-		for (int i = 0; i <= N; ++i)
-		{
-			float temperature = mapped(current * i / (float)N);
-			gradient.setColorAt(i / (float)N, colorFromKelvin(temperature));
-		}
-		return new QBrush(gradient);
+		return &gradient;
 	}
 
 	// fill the remainder of the slider with the current color
-	virtual QBrush* background() override 
+	virtual const QBrush* background() override 
 	{
-		return new QBrush(colorFromKelvin(mapped(current))); 
+		return &currentColor;
 	}
 };
 
-// Utility to batch pass all color correction settings through a signal
-struct GradingSettings
-{
-	QVector3D lift;
-	QVector3D gamma;
-	QVector3D gain;
-	QVector3D offset;
-	float contrast;
-	float pivot;
-	float saturation;
-	float hueShift;
-	float temperature;
-	float unsharpMask;
-};
-
 class ColorCorrect : public QWidget
 {
 	Q_OBJECT;
@@ -605,10 +683,23 @@ class ColorCorrect : public QWidget
 	LabelSlider* hueShift;
 	TemperatureSlider* temperature;
 	LabelSlider* unsharpMask;
+	LabelSlider* unsharpRadius;
+	LabelSlider* clarity;
+	QComboBox* output;
+	// set while setState() moves the controls one by one
+	bool applying = false;
 
 	void emitChanged()
 	{
-		emit changed(state());
+		if (applying)
+			return;
+		TRACE_SCOPE("ColorCorrect::changed");
+		GradingSettings current;
+		{
+			PROFILE_CPU("state()");
+			current = state();
+		}
+		emit changed(current);
 	}
 
 public:
@@ -638,6 +729,11 @@ public:
 		sliders->addWidget(hueShift = new LabelSlider("Hue shift", -6.0f, 6.0f, 0.0f));
 		sliders->addWidget(temperature = new TemperatureSlider("White balance"));
 		sliders->addWidget(unsharpMask = new LabelSlider("Unsharp mask", -1.0f, 1.0f, 0.0f));
+		sliders->addWidget(unsharpRadius = new LabelSlider("Unsharp radius", 1.0f, 64.0f, 1.0f));
+		sliders->addWidget(clarity = new LabelSlider("Clarity", -1.0f, 1.0f, 0.0f));
+		// in the order of OutputTransform
+		sliders->addWidget(output = new QComboBox());
+		output->addItems({ "Output: sRGB", "Output: Rec. 709", "Output: ACES filmic", "Output: PQ (HDR)", "Output: HLG (HDR)" });
 
 		connect(contrast, &LabelSlider::valueChanged, this, &ColorCorrect::emitChanged);
 		connect(pivot, &LabelSlider::valueChanged, this, &ColorCorrect::emitChanged);
@@ -645,6 +741,9 @@ public:
 		connect(hueShift, &LabelSlider::valueChanged, this, &ColorCorrect::emitChanged);
 		connect(temperature, &TemperatureSlider::valueChanged, this, &ColorCorrect::emitChanged);
 		connect(unsharpMask, &LabelSlider::valueChanged, this, &ColorCorrect::emitChanged);
+		connect(unsharpRadius, &LabelSlider::valueChanged, this, &ColorCorrect::emitChanged);
+		connect(clarity, &LabelSlider::valueChanged, this, &ColorCorrect::emitChanged);
+		connect(output, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &ColorCorrect::emitChanged);
 	}
 
 	GradingSettings state()
@@ -659,80 +758,1069 @@ public:
 			saturation->value(),
 			hueShift->value(),
 			temperature->value(),
-			unsharpMask->value()
+			unsharpMask->value(),
+			unsharpRadius->value(),
+			clarity->value(),
+			(OutputTransform)output->currentIndex()
 		};
 	}
 
+	// move every control to the given settings, the grade is sent once at the end
+	void setState(const GradingSettings& settings)
+	{
+		applying = true;
+		lift->setValue(settings.lift);
+		gamma->setValue(settings.gamma);
+		gain->setValue(settings.gain);
+		offset->setValue(settings.offset);
+		contrast->setValue(settings.contrast);
+		pivot->setValue(settings.pivot);
+		saturation->setValue(settings.saturation);
+		hueShift->setValue(settings.hueShift);
+		temperature->setValue(settings.temperature);
+		unsharpMask->setValue(settings.unsharpMask);
+		unsharpRadius->setValue(settings.unsharpRadius);
+		clarity->setValue(settings.clarity);
+		output->setCurrentIndex((int)settings.output);
+		applying = false;
+		emitChanged();
+	}
+
 signals:
 	void changed(GradingSettings);
 };
 
+// Grades in the contact sheet
+const int WEDGE_COLUMNS = 5;
+const int WEDGE_ROWS = 5;
+
+// GradingSettings as the WEDGE variant of grading.glsl reads them from its shader storage buffer, std430 layout
+struct WedgeVariant
+{
+	float lift[4];
+	float gamma[4];
+	float gain[4];
+	float offset[4];
+	float contrast;
+	float contrastPivot;
+	float saturation;
+	float hue;
+	float temperature;
+	float unsharpMask;
+	int clarity;
+	float clarityGains[CLARITY_BANDS];
+	float padding[3];
+};
+static_assert(sizeof(WedgeVariant) == 128, "WedgeVariant has to match the std430 layout of Variant in grading.glsl");
+
+WedgeVariant packWedgeVariant(const GradingSettings& settings)
+{
+	WedgeVariant variant = {
+		{ settings.lift.x(), settings.lift.y(), settings.lift.z(), 0.0f },
+		{ settings.gamma.x(), settings.gamma.y(), settings.gamma.z(), 0.0f },
+		{ settings.gain.x(), settings.gain.y(), settings.gain.z(), 0.0f },
+		{ settings.offset.x(), settings.offset.y(), settings.offset.z(), 0.0f },
+		settings.contrast,
+		settings.pivot,
+		settings.saturation,
+		settings.hueShift,
+		settings.temperature,
+		settings.unsharpMask,
+		settings.clarity != 0.0f ? 1 : 0
+	};
+	clarityBandGains(settings.clarity, variant.clarityGains);
+	return variant;
+}
+
+// autoGraded() is emitted on the render and match threads and queued to the controls
+Q_DECLARE_METATYPE(GradingSettings)
+
+/*
+Everything a frame of the preview shows. The widget keeps one that its controls and events change
+and posts a copy to the render thread, which draws the newest one it has.
+*/
+struct PreviewFrame
+{
+	GradingSettings state;
+	int imageIndex = 0;
+
+	// viewer, zoom is view pixels per image texel and center is the texel in the middle of the view
+	// everything is in GL orientation, y goes up
+	bool fit = true;
+	float zoom = 1.0f;
+	QPointF center;
+	QSize viewSize = QSize(1, 1);
+	bool showWedge = false;
+	bool showProfiler = false;
+
+	// one-off work for the render thread. The widget counts every request, the render thread does the work
+	// when a count differs from the frame before, so requests are not lost when it skips frames.
+	int autoRequests = 0;
+	int autoParts = 0; // AutoGradeParts of the last auto request
+	int exportRequests = 0;
+	QString exportPath;
+	int measureRequests = 0;
+	int lookRequests = 0;
+	// LUT from another tool applied after the grade, null for none
+	std::shared_ptr<LutFile> look;
+
+	void fitTo(const QSize& image)
+	{
+		zoom = qMin((float)viewSize.width() / image.width(), (float)viewSize.height() / image.height());
+		center = QPointF(image.width() * 0.5, image.height() * 0.5);
+	}
+
+	// lower left corner of the image in view pixels
+	inline QPointF imageOrigin() const { return QPointF(viewSize.width() * 0.5 - center.x() * zoom, viewSize.height() * 0.5 - center.y() * zoom); }
+
+	// texels that are on screen
+	QRect visibleRegion(const QSize& image) const
+	{
+		QPointF origin = imageOrigin();
+		int x0 = qMax(0, (int)floor(-origin.x() / zoom));
+		int y0 = qMax(0, (int)floor(-origin.y() / zoom));
+		int x1 = qMin(image.width(), (int)ceil((viewSize.width() - origin.x()) / zoom));
+		int y1 = qMin(image.height(), (int)ceil((viewSize.height() - origin.y()) / zoom));
+		return QRect(x0, y0, qMax(0, x1 - x0), qMax(0, y1 - y0));
+	}
+};
+
+// a frame the render thread drew, handed to the widget to put on screen
+struct RenderedFrame
+{
+	ColorBufferObject2D texture = ColorBufferObject2D(ColorBufferFormat::RGBA8, 1, 1, {});
+	QSize size; // empty until drawn
+	GLsync drawn = nullptr; // passed when the render thread's commands that draw it are done
+	GLsync shown = nullptr; // passed when the widget is done copying it to the screen
+	// lines of the profiler overlay, taken when the frame was drawn
+	QStringList overlay;
+};
+
+/*
+The preview renders on a thread of its own, so a heavy grade never holds up the controls that are dragged.
+
+The widget side (events, set()) only changes its PreviewFrame and posts it. The render thread takes the newest frame,
+grades it into a texture of a RenderedFrame and posts that back, paintGL() copies the newest of those to the screen.
+Both hand-overs go through a Mailbox, frames that are overtaken are skipped. The render thread's context shares
+the textures, buffers and programs with the widget's. Members below the frames are only used on the render thread.
+*/
 class CCPreview : public QOpenGLWidget
 {
 	Q_OBJECT;
 
-	GradingSettings state;
-	ColorBufferObject2D screens[4] = { 
-		ColorBufferObject2D::fromQImage(QGLWidget::convertToGLFormat(QImage("../screens/01.png")), false, true),
-		ColorBufferObject2D::fromQImage(QGLWidget::convertToGLFormat(QImage("../screens/02.png")), false, true) ,
-		ColorBufferObject2D::fromQImage(QGLWidget::convertToGLFormat(QImage("../screens/03.png")), false, true) ,
-		ColorBufferObject2D::fromQImage(QGLWidget::convertToGLFormat(QImage("../screens/04.png")), false, true) };
+	// widget side
+	PreviewFrame view;
+	QPoint dragFrom;
+	Mailbox<PreviewFrame> posted;
+	Mailbox<RenderedFrame> rendered;
+	std::unique_ptr<RenderThread> renderThread;
+	FrameBufferObject presentFramebuffer;
+	std::unique_ptr<GradeCache> lutCache;
+	// Key_M matches on a thread of its own so the widget stays responsive, one match at a time
+	std::thread matcher;
+	std::atomic<bool> matching{ false };
+
+	// set halfSources in cg.ini to store 8 bit shots as half floats as well, HDR shots always are
+	// the list of shots and the size are fixed, those are read on both sides
+	SourceBin sources = SourceBin(SourceBin::shotsIn("../screens"), SOURCE_BIN_LAYERS, QSettings("cg.ini", QSettings::IniFormat).value("halfSources", false).toBool());
+
+	inline QSize imageSize() { return QSize(sources.texture().width(), sources.texture().height()); }
+
+	inline QPointF widgetToImage(const QPoint& pos) { return (QPointF(pos.x(), height() - pos.y()) - view.imageOrigin()) / view.zoom; }
+
+	// hands a copy of the view to the render thread
+	void requestFrame()
+	{
+		view.viewSize = QSize(qMax(1, width()), qMax(1, height()));
+		if (view.fit)
+			view.fitTo(imageSize());
+		posted.draft() = view;
+		posted.post();
+		if (renderThread)
+			renderThread->wake();
+	}
+
+	// render thread side, the frame being drawn and the one before it
+	PreviewFrame frame;
+	PreviewFrame previous;
 	Program program;
-	int imageIndex = 0;
+	// layer of the source bin that holds frame.imageIndex this frame
+	int sourceLayer = 0;
+
+	// texels the grade reads this frame, the wedge shows the whole image in every cell
+	QRect gradeRegion() { return frame.showWedge ? QRect(QPoint(0, 0), imageSize()) : frame.visibleRegion(imageSize()); }
+
+	// region grown by some slack so small pans don't redo the spatial passes, and a texel for bilinear lookups
+	QRect withSlack(const QRect& region)
+	{
+		int dx = region.width() / 4 + 1;
+		int dy = region.height() / 4 + 1;
+		return region.adjusted(-dx, -dy, dx, dy).intersected(QRect(QPoint(0, 0), imageSize()));
+	}
+
+	static void setRegion(Program& pass, const QRect& region)
+	{
+		pass.set("uRegion", region.x(), region.y(), region.x() + region.width(), region.y() + region.height());
+	}
+
+	// unsharp mask blur of the current image, only recomputed when the image or radius changes
+	Program blurProgram;
+	Program blurSourceProgram; // first pass, reads from the source bin
+	ColorBufferObject2D blurred = ColorBufferObject2D(ColorBufferFormat::RGBA16F, 1, 1, {});
+	ColorBufferObject2D blurTemp = ColorBufferObject2D(ColorBufferFormat::RGBA16F, 1, 1, {});
+	int blurredImageIndex = -1;
+	int blurredRadius = -1;
+	QRect blurredRegion; // texels of blurred that are exact
+
+	void blurPass(Program& pass, ColorBufferObject2DBase& source, ColorBufferObject2DBase& target, int axisX, int axisY, int radius, const QRect& region)
+	{
+		pass.bind();
+		pass.set("uSource", 0, source);
+		pass.set("uSourceLayer", sourceLayer);
+		pass.set("uAxis", axisX, axisY);
+		pass.set("uRadius", radius);
+		setRegion(pass, region);
+		target.bindLoadStore(0, GL_WRITE_ONLY);
+		int lines = axisX ? region.height() : region.width();
+		pass.dispatch((lines + 63) / 64);
+		gl.glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	// only the texels the grade reads are blurred, so dragging the radius zoomed in costs what is on screen
+	void updateBlur()
+	{
+		int radius = unsharpRadiusPixels(frame.state);
+		QRect needed = gradeRegion();
+		if (needed.isEmpty() || (blurredImageIndex == frame.imageIndex && blurredRadius == radius && blurredRegion.contains(needed)))
+			return;
+		PROFILE_GPU("blur");
+		ColorBufferObject2DArray& source = sources.texture();
+		blurred.setSize(source.width(), source.height());
+		blurTemp.setSize(source.width(), source.height());
+
+		// passes after the first read texels the previous pass did not write near the edge of the region,
+		// every pass moves that error in by the radius. A margin of all passes keeps the wanted texels exact.
+		QRect image(QPoint(0, 0), imageSize());
+		QRect wanted = withSlack(needed);
+		int margin = UNSHARP_BLUR_ITERATIONS * radius;
+		QRect region = wanted.adjusted(-margin, -margin, margin, margin).intersected(image);
+		for (int i = 0; i < UNSHARP_BLUR_ITERATIONS; ++i)
+		{
+			if (!i)
+				blurPass(blurSourceProgram, source, blurTemp, 1, 0, radius, region);
+			else
+				blurPass(blurProgram, blurred, blurTemp, 1, 0, radius, region);
+			blurPass(blurProgram, blurTemp, blurred, 0, 1, radius, region);
+		}
+		blurredImageIndex = frame.imageIndex;
+		blurredRadius = radius;
+		blurredRegion = wanted;
+	}
+
+	// gaussian pyramid of the current image for clarity, stored in the mip levels, only rebuilt when the image changes
+	Program pyramidProgram;
+	Program pyramidSourceProgram; // copy to level 0, reads from the source bin
+	ColorBufferObject2D pyramid = ColorBufferObject2D(ColorBufferFormat::RGBA16F, 1, 1, {});
+	int pyramidImageIndex = -1;
+	QRect pyramidRegion; // level 0 texels whose bands are up to date
+
+	void pyramidPass(Program& pass, ColorBufferObject2DBase& source, int sourceLevel, int targetLevel, bool downsample, const QRect& region)
+	{
+		pass.bind();
+		pass.set("uSource", 0, source);
+		pass.set("uSourceLayer", sourceLayer);
+		pass.set("uSourceLevel", sourceLevel);
+		pass.set("uDownsample", downsample ? 1 : 0);
+		setRegion(pass, region);
+		pyramid.bindLoadStore(0, GL_WRITE_ONLY, targetLevel);
+		pass.dispatch((region.width() + 7) / 8, (region.height() + 7) / 8);
+		gl.glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	// like the blur, only the part of every level the grade reads is built
+	void updatePyramid()
+	{
+		QRect needed = gradeRegion();
+		if (frame.state.clarity == 0.0f || needed.isEmpty() || (pyramidImageIndex == frame.imageIndex && pyramidRegion.contains(needed)))
+			return;
+		PROFILE_GPU("pyramid");
+		ColorBufferObject2DArray& source = sources.texture();
+		pyramid.setSize(source.width(), source.height());
+		// allocates the mip chain that holds the pyramid levels, resizing keeps it
+		if (!pyramid.hasMips())
+			pyramid.generateMipMaps();
+
+		// from the coarsest level down, a level covers the wanted texels, one more for bilinear lookups,
+		// and the footprint of the [1 3 3 1] kernel of every texel of the next level
+		QRect wanted = withSlack(needed);
+		int levels = qMin(CLARITY_BANDS, pyramid.mipLevels() - 1);
+		std::vector<QRect> regions(levels + 1);
+		for (int level = levels; level >= 0; --level)
+		{
+			int scale = 1 << level;
+			int x0 = wanted.x() / scale - 1;
+			int y0 = wanted.y() / scale - 1;
+			int x1 = (wanted.x() + wanted.width() + scale - 1) / scale + 1;
+			int y1 = (wanted.y() + wanted.height() + scale - 1) / scale + 1;
+			if (level < levels)
+			{
+				const QRect& next = regions[level + 1];
+				x0 = qMin(x0, next.x() * 2 - 1);
+				y0 = qMin(y0, next.y() * 2 - 1);
+				x1 = qMax(x1, (next.x() + next.width()) * 2 + 1);
+				y1 = qMax(y1, (next.y() + next.height()) * 2 + 1);
+			}
+			QRect levelImage(0, 0, qMax(1, source.width() >> level), qMax(1, source.height() >> level));
+			regions[level] = QRect(x0, y0, x1 - x0, y1 - y0).intersected(levelImage);
+		}
+
+		pyramidPass(pyramidSourceProgram, source, 0, 0, false, regions[0]);
+		for (int level = 1; level <= levels; ++level)
+			pyramidPass(pyramidProgram, pyramid, level - 1, level, true, regions[level]);
+		pyramidImageIndex = frame.imageIndex;
+		pyramidRegion = wanted;
+	}
+
+	void drawGrade()
+	{
+		{
+			PROFILE_CPU("uniforms");
+			program.bind();
+			QPointF origin = frame.imageOrigin();
+			program.set("uImageOrigin", (float)origin.x(), (float)origin.y());
+			program.set("uImageSize", imageSize().width() * frame.zoom, imageSize().height() * frame.zoom);
+			program.set("uSources", 0, sources.texture());
+			program.set("uSourceLayer", sourceLayer);
+			program.set("uBlurred", 1, blurred);
+			program.set("uClarity", frame.state.clarity != 0.0f ? 1 : 0);
+			if (frame.state.clarity != 0.0f)
+			{
+				std::vector<float> gains(CLARITY_BANDS);
+				clarityBandGains(frame.state.clarity, &gains[0]);
+				program.set("uPyramid", 2, pyramid);
+				program.set("uClarityGains", gains);
+			}
+
+			program.set("uLift", frame.state.lift);
+			program.set("uGamma", frame.state.gamma);
+			program.set("uGain", frame.state.gain);
+			program.set("uOffset", frame.state.offset);
+			program.set("uContrast", frame.state.contrast);
+			program.set("uContrastPivot", frame.state.pivot);
+			program.set("uSaturation", frame.state.saturation);
+			program.set("uHue", frame.state.hueShift);
+			program.set("uTemperature", frame.state.temperature);
+			program.set("uUnsharpMask", frame.state.unsharpMask);
+			setOutputShaper(program);
+			setLook(program);
+		}
+
+		{
+			// only the part of the image that is on screen is drawn, so the grade costs what is visible
+			PROFILE_GPU("grade");
+			glClear(GL_COLOR_BUFFER_BIT);
+			QPointF origin = frame.imageOrigin();
+			float x0 = qMax(0.0f, (float)origin.x());
+			float y0 = qMax(0.0f, (float)origin.y());
+			float w = (float)frame.viewSize.width();
+			float h = (float)frame.viewSize.height();
+			float x1 = qMin(w, (float)origin.x() + imageSize().width() * frame.zoom);
+			float y1 = qMin(h, (float)origin.y() + imageSize().height() * frame.zoom);
+			if (x0 < x1 && y0 < y1)
+				glRectf(x0 / w * 2.0f - 1.0f, y0 / h * 2.0f - 1.0f, x1 / w * 2.0f - 1.0f, y1 / h * 2.0f - 1.0f);
+		}
+	}
+
+	// contact sheet of variants around the current grade, all graded by one instanced draw
+	Program wedgeProgram;
+	ShaderStorageBufferObject wedgeVariants = ShaderStorageBufferObject(0);
+
+	void drawWedge()
+	{
+		std::vector<GradingSettings> variants;
+		{
+			PROFILE_CPU("uniforms");
+			variants = wedgeSweep(frame.state, WEDGE_COLUMNS, WEDGE_ROWS);
+			int size = (int)(variants.size() * sizeof(WedgeVariant));
+			char* data = new char[size];
+			for (size_t i = 0; i < variants.size(); ++i)
+				((WedgeVariant*)data)[i] = packWedgeVariant(variants[i]);
+			// create the buffer before handing it data, so it does not upload twice
+			wedgeVariants.handle<GLuint>();
+			wedgeVariants.setData(size, data);
+			wedgeVariants.bind(0);
+
+			wedgeProgram.bind();
+			wedgeProgram.set("uSources", 0, sources.texture());
+			wedgeProgram.set("uSourceLayer", sourceLayer);
+			wedgeProgram.set("uBlurred", 1, blurred);
+			if (frame.state.clarity != 0.0f)
+				wedgeProgram.set("uPyramid", 2, pyramid);
+			wedgeProgram.set("uColumns", WEDGE_COLUMNS);
+			wedgeProgram.set("uRows", WEDGE_ROWS);
+			wedgeProgram.set("uGap", 4.0f / frame.viewSize.width(), 4.0f / frame.viewSize.height());
+			setOutputShaper(wedgeProgram);
+			setLook(wedgeProgram);
+		}
+
+		{
+			PROFILE_GPU("grade");
+			glClear(GL_COLOR_BUFFER_BIT);
+			gl.glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)variants.size());
+		}
+	}
+	// statistics of the current image for the auto grading tools, only recomputed when the image changes
+	Program statisticsProgram;
+	ShaderStorageBufferObject statisticsBuffer = ShaderStorageBufferObject(0);
+	ImageStatistics statistics;
+	int statisticsImageIndex = -1;
+
+	void updateStatistics()
+	{
+		if (statisticsImageIndex == frame.imageIndex)
+			return;
+		PROFILE_GPU("statistics");
+		ColorBufferObject2DArray& source = sources.texture();
+		// the first level small enough, the source bin keeps the mip chain of every image
+		int level = 0;
+		while (level + 1 < source.mipLevels() && qMax(source.width() >> level, source.height() >> level) > STATISTICS_MAX_SIZE)
+			++level;
+		int width = qMax(1, source.width() >> level);
+		int height = qMax(1, source.height() >> level);
+		int groupsX = (width + STATISTICS_GROUP_SIZE - 1) / STATISTICS_GROUP_SIZE;
+		int groupsY = (height + STATISTICS_GROUP_SIZE - 1) / STATISTICS_GROUP_SIZE;
+
+		// create the buffer before handing it data, so it does not upload twice
+		statisticsBuffer.handle<GLuint>();
+		statisticsBuffer.setData(gpuStatisticsBufferSize(groupsX * groupsY), gpuStatisticsInitialData(groupsX * groupsY));
+		statisticsBuffer.bind(0);
+		statisticsProgram.bind();
+		statisticsProgram.set("uSource", 0, source);
+		statisticsProgram.set("uSourceLayer", sourceLayer);
+		statisticsProgram.set("uSourceLevel", level);
+		statisticsProgram.dispatch(groupsX, groupsY);
+		gl.glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		// mapping waits for the dispatch, the buffer is a few KB
+		PooledBuffer result = statisticsBuffer.read();
+		statistics = gpuStatisticsResult(result.data(), groupsX * groupsY, (int64_t)width * height);
+		statisticsImageIndex = frame.imageIndex;
+#ifdef _DEBUG
+		checkStatistics();
+#endif
+	}
+
+	// the CPU statistics read every pixel of the shot, the mean of the reduced mip level has to come out the same
+	void checkStatistics()
+	{
+		FloatImage image;
+		if (!loadFloatImage(sources.shot(frame.imageIndex), image))
+			return;
+		ImageStatistics cpu = computeStatistics(image);
+		float difference = 0.0f;
+		for (int c = 0; c < 3; ++c)
+			difference = qMax(difference, fabsf(cpu.mean[c] - statistics.mean[c]));
+		infod("Statistics on the CPU: median %.3f, GPU: median %.3f, largest difference of the mean %.4f",
+			cpu.lumaPercentile(0.5f), statistics.lumaPercentile(0.5f), difference);
+		// 8 bit shots are quantized on the GPU, in the source bin and in its mip levels
+		if (difference > 0.01f)
+			warningd("The GPU statistics are off the CPU statistics by %.4f", difference);
+	}
+
+	// the image is uploaded by the time this runs
+	void applyAuto()
+	{
+		if (frame.autoRequests == previous.autoRequests)
+			return;
+		QElapsedTimer timer;
+		timer.start();
+		updateStatistics();
+		GradingSettings suggested = autoGrade(statistics, frame.state, frame.autoParts);
+		infod("Auto grade in %.2f ms: black %.3f, median %.3f, white %.3f, temperature %.1f", timer.nsecsElapsed() / 1.0e6,
+			statistics.lumaPercentile(AUTO_BLACK_POINT), statistics.lumaPercentile(0.5f), statistics.lumaPercentile(AUTO_WHITE_POINT), suggested.temperature);
+		// queued to the controls on the GUI thread, they send the grade back through set()
+		emit autoGraded(suggested);
+	}
+
+	// the look of the frame as a 3D texture
+	std::unique_ptr<ColorBufferObject3D> lookTexture;
+	int lookSize = 0;
+
+	void updateLook()
+	{
+		if (frame.lookRequests == previous.lookRequests)
+			return;
+		lookTexture.reset();
+		lookSize = 0;
+		if (!frame.look)
+			return;
+		const Lut3D& lut = frame.look->lut();
+		const unsigned char* data = (const unsigned char*)lut.data;
+		std::vector<unsigned char> bytes(data, data + (size_t)lut.size * lut.size * lut.size * 3 * sizeof(float));
+		lookTexture.reset(new ColorBufferObject3D(ColorBufferFormat::RGB32F, lut.size, lut.size, lut.size, { bytes }));
+		lookSize = lut.size;
+	}
+
+	// output transform of the grade as a 1D shaper LUT, made again when the transform changes
+	std::unique_ptr<ColorBufferObject2D> outputShaperTexture;
+	OutputTransform outputShaperTransform = OutputTransform::count;
+
+	void setOutputShaper(Program& pass)
+	{
+		if (outputShaperTransform != frame.state.output)
+		{
+			const unsigned char* data = (const unsigned char*)outputShaper(frame.state.output);
+			std::vector<unsigned char> bytes(data, data + OUTPUT_SHAPER_SIZE * sizeof(float));
+			outputShaperTexture.reset(new ColorBufferObject2D(ColorBufferFormat::R32F, OUTPUT_SHAPER_SIZE, 1, { bytes }));
+			outputShaperTransform = frame.state.output;
+		}
+		pass.set("uOutputShaper", 4, *outputShaperTexture);
+	}
+
+	void setLook(Program& pass)
+	{
+		pass.set("uLookSize", lookSize);
+		// samplers of different types can not share a unit, even when the look is off
+		if (lookTexture)
+			pass.set("uLook", 3, *lookTexture);
+		else
+			pass.set("uLook", 3);
+	}
+
+	// the target of every grade on the render thread, the frames for the widget and the full resolution renders
+	FrameBufferObject framebuffer;
+
+	// the grade of the whole image 1:1 into target, which has the size of the image
+	void gradeOffscreen(ColorBufferObject2D& target)
+	{
+		PreviewFrame shown = frame;
+		frame.viewSize = QSize(target.width(), target.height());
+		frame.zoom = 1.0f;
+		frame.center = QPointF(target.width() * 0.5, target.height() * 0.5);
+		frame.showWedge = false;
+
+		updateBlur();
+		updatePyramid();
+		if (!framebuffer.bind(target))
+			warningd("Can not render into a %s texture", target.format() == ColorBufferFormat::RGBA16F ? "RGBA16F" : "RGBA8");
+		drawGrade();
+		FrameBufferObject::unbind(0);
+		frame = shown;
+	}
+
+	// half floats keep what is above 1 and below a code value, PFM files keep them as well
+	void exportFrame()
+	{
+		if (frame.exportRequests == previous.exportRequests || frame.exportPath.isEmpty())
+			return;
+		QString filePath = frame.exportPath;
+		QElapsedTimer timer;
+		timer.start();
+		QSize size = imageSize();
+		ColorBufferObject2D graded(ColorBufferFormat::RGBA16F, size.width(), size.height(), {});
+		gradeOffscreen(graded);
+
+		// GL rows go bottom to top
+		PooledBuffer halves = graded.readHalves();
+		FloatImage image(size.width(), size.height());
+		for (int y = 0; y < size.height(); ++y)
+		{
+			const qfloat16* src = (const qfloat16*)halves.data() + (size_t)(size.height() - 1 - y) * size.width() * 4;
+			float* dst = image.pixel(0, y);
+			for (int i = 0; i < size.width() * 4; ++i)
+				dst[i] = (float)src[i];
+		}
+		bool written = isHdrImageFile(filePath) ? savePfm(filePath, image) : image.toQImage().save(filePath);
+		CONVERT_QSTRING(filePath, text);
+		if (!written)
+			warning("Could not write '%s'", text);
+		else
+			infod("Exported '%s' in %.1f ms", text, timer.nsecsElapsed() / 1.0e6);
+	}
+
+	/*
+	Uploads, grades and reads back the current image a number of times through the 8 bit and the half float path
+	and logs the time and bandwidth of every step. The grade reads the source bin in the format it has,
+	so the grade measures the cost of the target format.
+	*/
+	void measurePaths()
+	{
+		if (frame.measureRequests == previous.measureRequests)
+			return;
+		const int FRAMES = 10;
+		const double MB = 1024.0 * 1024.0;
+		QSize size = imageSize();
+		double pixels = (double)size.width() * size.height();
+		struct Path
+		{
+			const char* name;
+			ColorBufferFormat sourceFormat;
+			ColorBufferFormat targetFormat;
+			int pixelBytes;
+		};
+		const Path paths[] = {
+			{ "8 bit", ColorBufferFormat::SRGB8_ALPHA8, ColorBufferFormat::RGBA8, 4 },
+			{ "16F", ColorBufferFormat::RGBA16F, ColorBufferFormat::RGBA16F, 8 },
+		};
+		infod("Measuring %dx%d, the grade reads a %s source bin", size.width(), size.height(), sources.isHalf() ? "16F" : "8 bit");
+		for (const Path& path : paths)
+		{
+			double frameMB = pixels * path.pixelBytes / MB;
+			QElapsedTimer timer;
+
+			// the content does not matter for the upload, only the amount
+			PooledBuffer staging = bufferPool.lease((size_t)pixels * path.pixelBytes);
+			ColorBufferObject2DArray upload(path.sourceFormat, size.width(), size.height(), 1);
+			upload.setLayer(0, staging.data());
+			glFinish();
+			timer.start();
+			for (int i = 0; i < FRAMES; ++i)
+				upload.setLayer(0, staging.data());
+			glFinish();
+			double uploadMs = timer.nsecsElapsed() / 1.0e6 / FRAMES;
+
+			ColorBufferObject2D target(path.targetFormat, size.width(), size.height(), {});
+			gradeOffscreen(target);
+			glFinish();
+			timer.start();
+			for (int i = 0; i < FRAMES; ++i)
+				gradeOffscreen(target);
+			glFinish();
+			double gradeMs = timer.nsecsElapsed() / 1.0e6 / FRAMES;
+
+			timer.start();
+			for (int i = 0; i < FRAMES; ++i)
+				PooledBuffer readback = path.targetFormat == ColorBufferFormat::RGBA16F ? target.readHalves() : target.readBytes();
+			double readMs = timer.nsecsElapsed() / 1.0e6 / FRAMES;
+
+			infod("%-5s upload %6.2f ms %7.0f MB/s | grade %6.2f ms %6.0f Mpixels/s %7.0f MB/s written | readback %6.2f ms %7.0f MB/s",
+				path.name, uploadMs, frameMB / uploadMs * 1000.0, gradeMs, pixels / gradeMs / 1000.0, frameMB / gradeMs * 1000.0,
+				readMs, frameMB / readMs * 1000.0);
+		}
+	}
+
+	// lines of the profiler overlay, made on the render thread as the residency counters are only kept there
+	QStringList profilerOverlay()
+	{
+		std::vector<ProfilerSample> samples = profiler.samples();
+		QStringList lines;
+		for (const ProfilerSample& sample : samples)
+			lines.push_back(format<QString>("%s %-12s %7.3f ms  avg %7.3f ms", sample.gpu ? "GPU" : "CPU", sample.name, sample.lastMs, sample.averageMs));
+
+		// texture memory, see residency.h
+		const double MB = 1024.0 * 1024.0;
+		ResidencyCounters total = residency.total();
+		QString budget = residency.budget() ? QString("%1 MB").arg(residency.budget() / (1024 * 1024)) : QString("unlimited");
+		lines.push_back(QString("VRAM %1 MB of %2").arg(total.gpuBytes / MB, 0, 'f', 1).arg(budget));
+		for (int type = 0; type < (int)ResidencyType::count; ++type)
+		{
+			ResidencyCounters counts = residency.counters((ResidencyType)type);
+			if (!counts.resident && !counts.evicted)
+				continue;
+			lines.push_back(format<QString>("  %-8s %2d %7.1f MB  RAM %7.1f MB  %d evicted", residencyTypeName((ResidencyType)type),
+				counts.resident, counts.gpuBytes / MB, counts.shadowBytes / MB, counts.evictions));
+		}
+
+		BufferPoolCounters pool = bufferPool.counters();
+		lines.push_back(QString("Pool %1 leases, %2% reused, %3 MB out, %4 MB idle").arg(pool.leases)
+			.arg(pool.leases ? 100 * pool.reuses / pool.leases : 0).arg(pool.leasedBytes / MB, 0, 'f', 1).arg(pool.idleBytes / MB, 0, 'f', 1));
+		return lines;
+	}
+
+	// draws the grade of the newest posted frame into a texture and hands it to the widget
+	void renderFrame()
+	{
+		if (!posted.take())
+			return;
+		TRACE_SCOPE("CCPreview::renderFrame");
+		frame = posted.current();
+		// edited shader files apply from this frame on, never halfway through one
+		rebuildChangedShaders();
+		profiler.setEnabled(frame.showProfiler);
+		profiler.newFrame();
+		residency.newFrame();
+
+		{
+			// shots are uploaded the first time they are shown, after that this is a lookup
+			PROFILE_GPU("upload");
+			sourceLayer = sources.layer(frame.imageIndex);
+		}
+
+		applyAuto();
+		updateLook();
+		exportFrame();
+		measurePaths();
+		updateBlur();
+		updatePyramid();
+
+		// the widget may still be copying this texture from the last time it had it
+		RenderedFrame& target = rendered.draft();
+		if (target.shown)
+		{
+			gl.glWaitSync(target.shown, 0, GL_TIMEOUT_IGNORED);
+			gl.glDeleteSync(target.shown);
+			target.shown = nullptr;
+		}
+		if (target.drawn)
+			gl.glDeleteSync(target.drawn);
+		target.texture.setSize(frame.viewSize.width(), frame.viewSize.height());
+		target.size = frame.viewSize;
+		if (!framebuffer.bind(target.texture))
+			warningd("Can not render into the frame texture");
+		if (frame.showWedge)
+			drawWedge();
+		else
+			drawGrade();
+		FrameBufferObject::unbind(0);
+		// flushed so the widget's context can wait for it
+		target.drawn = gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl.glFlush();
+		target.overlay = frame.showProfiler ? profilerOverlay() : QStringList();
+		previous = frame;
+		rendered.post();
+		QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+	}
+
+	// what the render thread created in its own context, the rest is shared and deleted with the widget
+	void releaseRenderer()
+	{
+		framebuffer = FrameBufferObject();
+		profiler.clear();
+	}
+
+	int64_t swapBegin = 0;
+
+	void drawProfilerOverlay(const QStringList& lines)
+	{
+		QPainter painter(this);
+		painter.setFont(QFont("Consolas", 9));
+		QRect geo(8, 8, 360, 8 + 16 * lines.size());
+		painter.fillRect(geo, QColor(0, 0, 0, 160));
+		painter.setPen(QColor(220, 220, 220));
+		int y = geo.y() + 16;
+		for (const QString& line : lines)
+		{
+			painter.drawText(geo.x() + 4, y, line);
+			y += 16;
+		}
+	}
 
 public:
-	void set(GradingSettings state)
+	CCPreview()
 	{
-		// receive settings
-		this->state = state;
-		// kick off a repaint
-		repaint();
+		qRegisterMetaType<GradingSettings>();
+		// closes the "swap" stage that paintGL opens, measuring the time until the frame is on screen
+		connect(this, &QOpenGLWidget::frameSwapped, this, [=]()
+		{
+			profiler.endCpu("swap");
+			if (swapBegin)
+				traceComplete("swap", swapBegin, traceNow());
+			swapBegin = 0;
+		});
 	}
 
-	virtual void initializeGL() override
+	virtual ~CCPreview()
 	{
-		gl.initializeOpenGLFunctions();
+		// a match still running emits into this widget
+		if (matcher.joinable())
+			matcher.join();
+		// stops rendering and releases what the render thread owns in its context
+		renderThread.reset();
+		// the textures and buffers below delete their GL names after this body, the context stays current for them
+		// and QOpenGLWidget releases it when it is destroyed
+		makeCurrent();
+		for (int i = 0; i < 3; ++i)
+		{
+			RenderedFrame& slot = rendered.slot(i);
+			if (slot.drawn)
+				gl.glDeleteSync(slot.drawn);
+			if (slot.shown)
+				gl.glDeleteSync(slot.shown);
+		}
+	}
+
+	void set(GradingSettings state)
+	{
+		TRACE_SCOPE("CCPreview::set");
+		// receive settings and hand them on, this returns without waiting for the grade
+		view.state = state;
+		requestFrame();
+	}
 
+	// on the render thread with its context current, before the first frame
+	void initializeRenderer()
+	{
 		// load a shader to see grading in action
 		Shader shader("../grading.glsl", ProgramStage::frag);
 		program = Program(shader);
+		Shader blurShader("../blur.glsl", ProgramStage::compute);
+		blurProgram = Program(blurShader);
+		Shader blurSourceShader("../blur.glsl", ProgramStage::compute, { "SOURCE_ARRAY" });
+		blurSourceProgram = Program(blurSourceShader);
+		Shader pyramidShader("../pyramid.glsl", ProgramStage::compute);
+		pyramidProgram = Program(pyramidShader);
+		Shader pyramidSourceShader("../pyramid.glsl", ProgramStage::compute, { "SOURCE_ARRAY" });
+		pyramidSourceProgram = Program(pyramidSourceShader);
+		wedgeProgram = Program({ Shader("../wedge.glsl", ProgramStage::vert), Shader("../grading.glsl", ProgramStage::frag, { "WEDGE" }) });
+		Shader statisticsShader("../statistics.glsl", ProgramStage::compute);
+		statisticsProgram = Program(statisticsShader);
+	}
+
+	virtual void initializeGL() override
+	{
+		gl.initializeOpenGLFunctions();
+
+		// texture memory budget, 0 keeps everything resident
+		QSettings settings("cg.ini", QSettings::IniFormat);
+		residency.setBudget(settings.value("textureBudgetMB", 0).toLongLong() * 1024 * 1024);
+
+		// shaders are edited while the preview runs, a saved file rebuilds what depends on it and renders again
+		watchShaderFiles([this]() { requestFrame(); });
+		renderThread.reset(new RenderThread(context(), [this]() { initializeRenderer(); }, [this]() { renderFrame(); }, [this]() { releaseRenderer(); }));
+		requestFrame();
 
 		setFocusPolicy(Qt::StrongFocus);
 	}
 
 	virtual void keyPressEvent(QKeyEvent* event) override
 	{
-		if (event->key() == Qt::Key_Space)
+		if (event->key() == Qt::Key_Space && sources.size())
+		{
+			view.imageIndex = (view.imageIndex + 1) % sources.size();
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_F)
+		{
+			view.fit = true;
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_1)
 		{
-			imageIndex = (imageIndex + 1) % 4;
-			repaint();
+			// 1:1 around the middle of the view
+			view.fit = false;
+			view.zoom = 1.0f;
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_W)
+		{
+			view.showWedge = !view.showWedge;
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_A || event->key() == Qt::Key_B || event->key() == Qt::Key_L || event->key() == Qt::Key_V)
+		{
+			// auto grade everything, or just the white balance, levels or contrast pivot
+			switch (event->key())
+			{
+			case Qt::Key_A: view.autoParts = AUTO_ALL; break;
+			case Qt::Key_B: view.autoParts = AUTO_BALANCE; break;
+			case Qt::Key_L: view.autoParts = AUTO_LEVELS; break;
+			case Qt::Key_V: view.autoParts = AUTO_PIVOT; break;
+			}
+			++view.autoRequests;
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_M && sources.size())
+		{
+			// fit the grade of the current image to a reference, with shift pixel by pixel for references of the same framing
+			QString filePath = QFileDialog::getOpenFileName(this, "Match to reference", QString(), "Images (*.png *.jpg *.jpeg *.bmp *.tif *.tiff *.pfm)");
+			FloatImage reference;
+			FloatImage source;
+			bool loaded = !filePath.isEmpty() && loadFloatImage(filePath, reference) && loadFloatImage(sources.shot(view.imageIndex), source);
+			if (!filePath.isEmpty() && !loaded)
+			{
+				CONVERT_QSTRING(filePath, text);
+				warning("Could not read '%s' or the current image", text);
+			}
+			else if (!filePath.isEmpty() && matching)
+				infod("Still matching, the reference is ignored");
+			else if (!filePath.isEmpty())
+			{
+				MatchMetric metric = (event->modifiers() & Qt::ShiftModifier) ? MatchMetric::deltaE : MatchMetric::histogram;
+				// the thread of the last match is done, matching was cleared as its last step
+				if (matcher.joinable())
+					matcher.join();
+				matching = true;
+				matcher = std::thread([this, source, reference, metric](GradingSettings start)
+				{
+					MatchResult match = matchGrade(source, reference, start, metric);
+					infod("Matched in %.0f ms, %d rounds of %d grades: distance %.4f to %.4f", match.ms, match.rounds, match.evaluations,
+						match.startDistance, match.distance);
+					emit autoGraded(match.settings);
+					matching = false;
+				}, view.state);
+			}
+		}
+		if (event->key() == Qt::Key_I)
+		{
+			// apply a LUT from another tool after the grade, with shift remove it again
+			QString filePath;
+			if (!(event->modifiers() & Qt::ShiftModifier))
+				filePath = QFileDialog::getOpenFileName(this, "Import LUT", QString(), "LUTs (*.cube *.3dl)");
+			LutFile loaded;
+			QString error;
+			QElapsedTimer timer;
+			timer.start();
+			if (!lutCache)
+				lutCache.reset(new GradeCache("cache", 2048ll * 1024 * 1024));
+			if (!filePath.isEmpty() && !loaded.load(filePath, lutCache.get(), &error))
+			{
+				QString message = QString("Could not import '%1': %2").arg(filePath, error);
+				CONVERT_QSTRING(message, text);
+				warning("%s", text);
+			}
+			else if (!filePath.isEmpty() || (event->modifiers() & Qt::ShiftModifier))
+			{
+				if (loaded.valid())
+					infod("%s a %d^3 LUT in %.2f ms", loaded.cached() ? "Mapped" : "Parsed", loaded.lut().size, timer.nsecsElapsed() / 1.0e6);
+				// stays mapped while it is the look, the render thread reads it when it makes the texture
+				view.look = loaded.valid() ? std::make_shared<LutFile>(std::move(loaded)) : nullptr;
+				++view.lookRequests;
+				requestFrame();
+			}
+		}
+		if (event->key() == Qt::Key_E)
+		{
+			// bake the grade for other tools, at a size they can take
+			QString filePath = QFileDialog::getSaveFileName(this, "Export LUT", "grade.cube", "LUTs (*.cube *.3dl)");
+			bool ok = false;
+			int size = filePath.isEmpty() ? 0 : QInputDialog::getInt(this, "Export LUT", "Points per axis", 33, 2, 256, 1, &ok);
+			if (ok)
+			{
+				if (!isLutGrade(view.state))
+					warningd("The unsharp mask and clarity can not be baked, they are left out of the LUT");
+				std::vector<float> baked = bakeLut(view.state, size);
+				Lut3D lut = { size, &baked[0] };
+				if (!saveLutFile(filePath, lut, QFileInfo(filePath).completeBaseName()))
+				{
+					CONVERT_QSTRING(filePath, text);
+					warning("Could not write LUT to '%s'", text);
+				}
+			}
+		}
+		if (event->key() == Qt::Key_X && sources.size())
+		{
+			// write the graded frame at full resolution, with shift time the 8 bit and half float paths instead
+			if (event->modifiers() & Qt::ShiftModifier)
+				++view.measureRequests;
+			else
+			{
+				view.exportPath = QFileDialog::getSaveFileName(this, "Export frame", "graded.pfm", "Images (*.pfm *.png)");
+				++view.exportRequests;
+			}
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_P)
+		{
+			// the render thread turns the profiler on or off at the start of the frame, between its stages
+			view.showProfiler = !view.showProfiler;
+			requestFrame();
+		}
+		if (event->key() == Qt::Key_T)
+		{
+			// start a fresh recording, or stop the current one
+			if (!isTracing())
+				clearTrace();
+			setTracing(!isTracing());
+		}
+		if (event->key() == Qt::Key_D)
+		{
+			QString filePath = QString("trace-%1.json").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+			CONVERT_QSTRING(filePath, text);
+			if (dumpTrace(text))
+				infod("Wrote trace to '%s'", text);
+			else
+				warning("Could not write trace to '%s'", text);
+		}
+		if (event->key() == Qt::Key_S)
+		{
+			// save the grade for --batch runs
+			QString filePath = QFileDialog::getSaveFileName(this, "Save grade", "grade.ini", "Grades (*.ini)");
+			if (!filePath.isEmpty() && !saveGradingSettings(filePath, view.state))
+			{
+				CONVERT_QSTRING(filePath, text);
+				warning("Could not write grade to '%s'", text);
+			}
 		}
 	}
 
+#pragma warning(suppress: 4100)
 	virtual void resizeGL(int w, int h) override
 	{
-		glViewport(0, 0, w, h);
+		// the render thread draws frames of the new size, until then the last one is stretched
+		requestFrame();
 	}
 
-	virtual void paintGL() override
+	virtual void wheelEvent(QWheelEvent* event) override
+	{
+		// zoom around the texel under the cursor
+		QPointF anchor = widgetToImage(event->pos());
+		view.fit = false;
+		view.zoom = qBound(1.0f / 64.0f, view.zoom * powf(2.0f, event->angleDelta().y() / 480.0f), 64.0f);
+		view.center += anchor - widgetToImage(event->pos());
+		requestFrame();
+	}
+
+	virtual void mousePressEvent(QMouseEvent* event) override
+	{
+		dragFrom = event->pos();
+	}
+
+	virtual void mouseMoveEvent(QMouseEvent* event) override
 	{
-		program.bind();
-		program.set("uResolution", (float)width(), (float)height());
-		program.set("uImages[1]", 0, screens[imageIndex]);
+		if (!(event->buttons() & Qt::LeftButton))
+			return;
+		QPoint delta = event->pos() - dragFrom;
+		dragFrom = event->pos();
+		view.fit = false;
+		view.center -= QPointF(delta.x(), -delta.y()) / view.zoom;
+		requestFrame();
+	}
 
-		program.set("uLift", state.lift);
-		program.set("uGamma", state.gamma);
-		program.set("uGain", state.gain);
-		program.set("uOffset", state.offset);
-		program.set("uContrast", state.contrast);
-		program.set("uContrastPivot", state.pivot);
-		program.set("uSaturation", state.saturation);
-		program.set("uHue", state.hueShift);
-		program.set("uTemperature", state.temperature);
-		program.set("uUnsharpMask", state.unsharpMask);
+	// only copies the newest frame of the render thread to the screen
+	virtual void paintGL() override
+	{
+		TRACE_SCOPE("CCPreview::paintGL");
+		rendered.take();
+		RenderedFrame& shown = rendered.current();
+		{
+			PROFILE_CPU("present");
+			// waits on the GPU, not here
+			if (shown.drawn)
+			{
+				gl.glWaitSync(shown.drawn, 0, GL_TIMEOUT_IGNORED);
+				gl.glDeleteSync(shown.drawn);
+				shown.drawn = nullptr;
+			}
+			glClear(GL_COLOR_BUFFER_BIT);
+			if (!shown.size.isEmpty())
+			{
+				presentFramebuffer.bind(shown.texture);
+				gl.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
+				int w = (int)(width() * devicePixelRatioF());
+				int h = (int)(height() * devicePixelRatioF());
+				gl.glBlitFramebuffer(0, 0, shown.size.width(), shown.size.height(), 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+				FrameBufferObject::unbind(defaultFramebufferObject());
+				glViewport(0, 0, w, h);
+			}
+			if (shown.shown)
+				gl.glDeleteSync(shown.shown);
+			shown.shown = gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			gl.glFlush();
+		}
+		// timed apart from the blit. that is a CPU stage, the GPU queries of the profiler belong to the render thread's context
+		if (view.showProfiler && !shown.overlay.isEmpty())
+		{
+			PROFILE_CPU("overlay");
+			drawProfilerOverlay(shown.overlay);
+		}
 
-		glRecti(-1, -1, 1, 1);
+		profiler.beginCpu("swap");
+		swapBegin = isTracing() ? traceNow() : 0;
 	}
+
+signals:
+	// a grade from the auto tools or a reference match, for the controls to take over
+	void autoGraded(GradingSettings settings);
 };
 
 class ColorGradingApp : public QMainWindow
@@ -750,6 +1838,7 @@ public:
 		main->addWidget(view = new CCPreview());
 		main->addWidget(cc = new ColorCorrect());
 		connect(cc, &ColorCorrect::changed, view, &CCPreview::set);
+		connect(view, &CCPreview::autoGraded, cc, &ColorCorrect::setState);
 		view->set(cc->state());
 	}
 
@@ -780,10 +1869,26 @@ public:
 
 int main(int argc, char *argv[])
 {
+	if (isBatchInvocation(argc, argv))
+	{
+		if (isGpuBatchInvocation(argc, argv))
+		{
+			QGuiApplication a(argc, argv);
+			return runBatch(a.arguments());
+		}
+		QCoreApplication a(argc, argv);
+		return runBatch(a.arguments());
+	}
+
 	QApplication a(argc, argv);
-	ColorGradingApp w;
-	w.show();
-	return a.exec();
+	int result;
+	{
+		ColorGradingApp w;
+		w.show();
+		result = a.exec();
+	}
+	colorWheelLayerCache.clear();
+	return result;
 }
 
 // this is how you do Q_OBJECT macros inside cpp files
@@ -0,0 +1,359 @@
+#include "match.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+// histogram bins per channel, values are split between the two nearest bins so the distance changes smoothly
+const int MATCH_BINS = 64;
+// pixels the delta E metric compares, it needs every one graded
+const int MATCH_DELTA_E_SAMPLES = 2048;
+// the search stops when every step is this fraction of where it started
+const float MATCH_MIN_STEP = 1.0f / 256.0f;
+
+// searched values of packGradingSettings(), with their first step and range
+struct MatchParameter
+{
+	int index;
+	float step;
+	float low;
+	float high;
+};
+
+static const MatchParameter MATCH_PARAMETERS[] = {
+	{ 0, 0.05f, -1.0f, 1.0f }, { 1, 0.05f, -1.0f, 1.0f }, { 2, 0.05f, -1.0f, 1.0f }, // lift
+	{ 3, 0.1f, -1.0f, 0.9f }, { 4, 0.1f, -1.0f, 0.9f }, { 5, 0.1f, -1.0f, 0.9f }, // gamma
+	{ 6, 0.1f, -1.0f, 4.0f }, { 7, 0.1f, -1.0f, 4.0f }, { 8, 0.1f, -1.0f, 4.0f }, // gain
+	{ 9, 0.05f, -1.0f, 1.0f }, { 10, 0.05f, -1.0f, 1.0f }, { 11, 0.05f, -1.0f, 1.0f }, // offset
+	{ 12, 0.2f, 0.0f, 2.0f }, // contrast
+	{ 13, 0.1f, 0.01f, 0.99f }, // pivot
+	{ 14, 0.2f, 0.0f, 2.0f }, // saturation
+	{ 16, 8.0f, 15.0f, 150.0f }, // temperature
+};
+const int MATCH_NUM_PARAMETERS = sizeof(MATCH_PARAMETERS) / sizeof(MATCH_PARAMETERS[0]);
+
+static inline float clampTo(float value, float low, float high) { return value < low ? low : (value > high ? high : value); }
+
+// the sRGB values grading ends in while matching
+static inline float displayEncode(float linear)
+{
+	return shapeOutput(outputShaper(OutputTransform::srgb), linear);
+}
+
+static inline float displayDecode(float display)
+{
+	if (display <= 0.04045f)
+		return display / 12.92f;
+	return powf((display + 0.055f) / 1.055f, 2.4f);
+}
+
+// CIE L*a*b* of a display color, sRGB primaries and a D65 white
+static void displayToLab(const float* display, float* lab)
+{
+	float r = displayDecode(display[0]);
+	float g = displayDecode(display[1]);
+	float b = displayDecode(display[2]);
+	float xyz[3] = {
+		(0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f,
+		0.2126f * r + 0.7152f * g + 0.0722f * b,
+		(0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f };
+	for (float& t : xyz)
+		t = t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+	lab[0] = 116.0f * xyz[1] - 16.0f;
+	lab[1] = 500.0f * (xyz[0] - xyz[1]);
+	lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+// per channel cumulative histogram of weighted display colors
+static void cumulativeHistogram(const std::vector<float>& display, const std::vector<float>& weights, float cdf[3][MATCH_BINS])
+{
+	float histogram[3][MATCH_BINS] = {};
+	float total = 0.0f;
+	for (size_t i = 0; i < weights.size(); ++i)
+	{
+		float weight = weights[i];
+		total += weight;
+		for (int c = 0; c < 3; ++c)
+		{
+			float position = clampTo(display[i * 3 + c], 0.0f, 1.0f) * (MATCH_BINS - 1);
+			int bin = (int)position;
+			float t = position - bin;
+			histogram[c][bin] += (1.0f - t) * weight;
+			if (bin + 1 < MATCH_BINS)
+				histogram[c][bin + 1] += t * weight;
+		}
+	}
+	for (int c = 0; c < 3; ++c)
+	{
+		float sum = 0.0f;
+		for (int bin = 0; bin < MATCH_BINS; ++bin)
+		{
+			sum += histogram[c][bin];
+			cdf[c][bin] = total > 0.0f ? sum / total : 0.0f;
+		}
+	}
+}
+
+// what candidates are compared against, derived from the reference once
+struct MatchTarget
+{
+	MatchMetric metric;
+	// linear source colors that get graded, with how many pixels they stand for
+	std::vector<float> colors;
+	std::vector<float> weights;
+	// histogram metric, of the reference
+	float cdf[3][MATCH_BINS];
+	// delta E metric, of the reference pixel every color lines up with
+	std::vector<float> lab;
+};
+
+// the histogram metric does not care where a color is, pixels of about the same color are graded once for all of them
+static void clusterColors(const FloatImage& proxy, MatchTarget& target)
+{
+	const int CELLS = 32;
+	std::vector<float> sums(CELLS * CELLS * CELLS * 4, 0.0f);
+	for (int i = 0; i < proxy.width * proxy.height; ++i)
+	{
+		const float* color = &proxy.pixels[i * 4];
+		int cell = 0;
+		for (int c = 0; c < 3; ++c)
+			cell = cell * CELLS + (int)(clampTo(displayEncode(color[c]), 0.0f, 1.0f) * (CELLS - 1) + 0.5f);
+		for (int c = 0; c < 3; ++c)
+			sums[cell * 4 + c] += color[c];
+		sums[cell * 4 + 3] += 1.0f;
+	}
+	for (int cell = 0; cell < CELLS * CELLS * CELLS; ++cell)
+	{
+		float weight = sums[cell * 4 + 3];
+		if (weight == 0.0f)
+			continue;
+		for (int c = 0; c < 3; ++c)
+			target.colors.push_back(sums[cell * 4 + c] / weight);
+		target.weights.push_back(weight);
+	}
+}
+
+static float distance(const MatchTarget& target, const GradingSettings& settings)
+{
+	int count = (int)target.weights.size();
+	std::vector<float> display(count * 3);
+	for (int i = 0; i < count; ++i)
+	{
+		const float* color = &target.colors[i * 3];
+		// no unsharp mask on the proxies, the color is its own blur
+		gradeColor(settings, color, color, &display[i * 3]);
+	}
+
+	if (target.metric == MatchMetric::histogram)
+	{
+		// the area between the cumulative histograms, the earth mover's distance in 1D
+		float cdf[3][MATCH_BINS];
+		cumulativeHistogram(display, target.weights, cdf);
+		float sum = 0.0f;
+		for (int c = 0; c < 3; ++c)
+			for (int bin = 0; bin < MATCH_BINS; ++bin)
+				sum += fabsf(cdf[c][bin] - target.cdf[c][bin]);
+		return sum / (3.0f * MATCH_BINS);
+	}
+
+	double sum = 0.0;
+	for (int i = 0; i < count; ++i)
+	{
+		float lab[3];
+		displayToLab(&display[i * 3], lab);
+		const float* wanted = &target.lab[i * 3];
+		sum += sqrtf((lab[0] - wanted[0]) * (lab[0] - wanted[0]) + (lab[1] - wanted[1]) * (lab[1] - wanted[1]) + (lab[2] - wanted[2]) * (lab[2] - wanted[2]));
+	}
+	return count ? (float)(sum / count) : 0.0f;
+}
+
+FloatImage matchProxy(const FloatImage& image, int size)
+{
+	const FloatImage* current = &image;
+	FloatImage proxy;
+	if (image.width <= size && image.height <= size)
+		return image;
+	while (current->width > size || current->height > size)
+	{
+		// 2x2 box, a lone last row or column is folded into the one before it
+		FloatImage half(current->width > 1 ? current->width / 2 : 1, current->height > 1 ? current->height / 2 : 1);
+		for (int y = 0; y < half.height; ++y)
+		{
+			int y0 = y * 2;
+			int y1 = y0 + 1 < current->height ? y0 + 1 : y0;
+			for (int x = 0; x < half.width; ++x)
+			{
+				int x0 = x * 2;
+				int x1 = x0 + 1 < current->width ? x0 + 1 : x0;
+				float* dst = half.pixel(x, y);
+				for (int c = 0; c < 4; ++c)
+					dst[c] = (current->pixel(x0, y0)[c] + current->pixel(x1, y0)[c] + current->pixel(x0, y1)[c] + current->pixel(x1, y1)[c]) * 0.25f;
+			}
+		}
+		proxy = std::move(half);
+		current = &proxy;
+	}
+	return proxy;
+}
+
+MatchResult matchGrade(const FloatImage& source, const FloatImage& reference, const GradingSettings& start, MatchMetric metric, int threads)
+{
+	auto began = std::chrono::steady_clock::now();
+	auto elapsedMs = [&]() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - began).count(); };
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency() ? (int)std::thread::hardware_concurrency() : 1;
+
+	FloatImage proxy = matchProxy(source);
+	MatchTarget target;
+	target.metric = metric;
+	{
+		// the reference as it would be displayed, at the size of the source proxy so pixels line up for delta E
+		FloatImage referenceProxy = matchProxy(reference);
+		std::vector<float> display(proxy.width * proxy.height * 3);
+		for (int y = 0; y < proxy.height; ++y)
+		{
+			for (int x = 0; x < proxy.width; ++x)
+			{
+				float color[4];
+				sampleBilinear(referenceProxy, (x + 0.5f) / proxy.width, (y + 0.5f) / proxy.height, color);
+				for (int c = 0; c < 3; ++c)
+					display[(y * proxy.width + x) * 3 + c] = displayEncode(color[c]);
+			}
+		}
+		if (metric == MatchMetric::histogram)
+		{
+			cumulativeHistogram(display, std::vector<float>(display.size() / 3, 1.0f), target.cdf);
+			clusterColors(proxy, target);
+		}
+		else
+		{
+			// an even spread of pixels is enough for the mean
+			int pixels = proxy.width * proxy.height;
+			int stride = pixels > MATCH_DELTA_E_SAMPLES ? pixels / MATCH_DELTA_E_SAMPLES : 1;
+			for (int i = 0; i < pixels; i += stride)
+			{
+				float lab[3];
+				displayToLab(&display[i * 3], lab);
+				target.lab.insert(target.lab.end(), lab, lab + 3);
+				target.colors.insert(target.colors.end(), &proxy.pixels[i * 4], &proxy.pixels[i * 4 + 3]);
+				target.weights.push_back(1.0f);
+			}
+		}
+	}
+
+	GradingSettings base = start;
+	base.unsharpMask = 0.0f;
+	base.clarity = 0.0f;
+	// references are sRGB images, the output transform of the grade is put back at the end
+	base.output = OutputTransform::srgb;
+	float current[GRADING_SETTINGS_VALUES];
+	packGradingSettings(base, current);
+	float steps[MATCH_NUM_PARAMETERS];
+	for (int p = 0; p < MATCH_NUM_PARAMETERS; ++p)
+	{
+		const MatchParameter& parameter = MATCH_PARAMETERS[p];
+		current[parameter.index] = clampTo(current[parameter.index], parameter.low, parameter.high);
+		steps[p] = parameter.step;
+	}
+
+	MatchResult result;
+	float best = distance(target, unpackGradingSettings(current));
+	result.startDistance = best;
+	result.evaluations = 1;
+
+	// every parameter up and down, and all improving moves at once as the last candidate
+	const int numCandidates = MATCH_NUM_PARAMETERS * 2 + 1;
+	std::vector<float> candidates(numCandidates * GRADING_SETTINGS_VALUES);
+	std::vector<float> distances(numCandidates);
+	for (;;)
+	{
+		bool searching = false;
+		for (int p = 0; p < MATCH_NUM_PARAMETERS; ++p)
+			searching = searching || steps[p] > MATCH_PARAMETERS[p].step * MATCH_MIN_STEP;
+		if (!searching || elapsedMs() > MATCH_TIME_BUDGET_MS)
+			break;
+		++result.rounds;
+
+		for (int p = 0; p < MATCH_NUM_PARAMETERS; ++p)
+		{
+			const MatchParameter& parameter = MATCH_PARAMETERS[p];
+			for (int direction = 0; direction < 2; ++direction)
+			{
+				float* candidate = &candidates[(p * 2 + direction) * GRADING_SETTINGS_VALUES];
+				memcpy(candidate, current, sizeof(current));
+				float value = current[parameter.index] + (direction ? steps[p] : -steps[p]);
+				candidate[parameter.index] = clampTo(value, parameter.low, parameter.high);
+			}
+		}
+
+		// graded in parallel, every thread takes the next candidate until none are left
+		auto evaluate = [&](std::atomic<int>& next, int end)
+		{
+			for (int i; (i = next++) < end;)
+				distances[i] = distance(target, unpackGradingSettings(&candidates[i * GRADING_SETTINGS_VALUES]));
+		};
+		auto evaluateAll = [&](int begin, int end)
+		{
+			std::atomic<int> next(begin);
+			std::vector<std::thread> workers;
+			int count = threads < end - begin ? threads : end - begin;
+			for (int i = 1; i < count; ++i)
+				workers.emplace_back([&]() { evaluate(next, end); });
+			evaluate(next, end);
+			for (std::thread& worker : workers)
+				worker.join();
+		};
+		evaluateAll(0, numCandidates - 1);
+		result.evaluations += numCandidates - 1;
+
+		float* combined = &candidates[(numCandidates - 1) * GRADING_SETTINGS_VALUES];
+		memcpy(combined, current, sizeof(current));
+		int improving = 0;
+		for (int p = 0; p < MATCH_NUM_PARAMETERS; ++p)
+		{
+			int down = p * 2;
+			int up = down + 1;
+			int better = distances[down] < distances[up] ? down : up;
+			if (distances[better] < best)
+			{
+				combined[MATCH_PARAMETERS[p].index] = candidates[better * GRADING_SETTINGS_VALUES + MATCH_PARAMETERS[p].index];
+				++improving;
+			}
+		}
+		distances[numCandidates - 1] = best;
+		if (improving > 1)
+		{
+			evaluateAll(numCandidates - 1, numCandidates);
+			++result.evaluations;
+		}
+
+		int winner = -1;
+		for (int i = 0; i < numCandidates; ++i)
+		{
+			if (distances[i] < best)
+			{
+				best = distances[i];
+				winner = i;
+			}
+		}
+		if (winner == -1)
+		{
+			for (float& step : steps)
+				step *= 0.5f;
+			continue;
+		}
+		memcpy(current, &candidates[winner * GRADING_SETTINGS_VALUES], sizeof(current));
+	}
+
+	result.settings = unpackGradingSettings(current);
+	// only the searched values change, the rest is as it came in
+	result.settings.hueShift = start.hueShift;
+	result.settings.unsharpMask = start.unsharpMask;
+	result.settings.unsharpRadius = start.unsharpRadius;
+	result.settings.clarity = start.clarity;
+	result.settings.output = start.output;
+	result.distance = best;
+	result.ms = elapsedMs();
+	return result;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "grading.h"
+#include <vector>
+
+/*
+Fits a grade so a shot matches a reference, e.g. a plate to the hero frame of a sequence.
+
+Both images are reduced to proxies of at most MATCH_PROXY_SIZE pixels on their longest side and the candidates are
+graded with the CPU engine on those. The search is a pattern search: every round grades the current grade with every
+parameter nudged up and down, in parallel, and moves to the best candidate. When none is better the steps are halved.
+It stops when the steps are small or the time budget is used up.
+
+Lift, gamma, gain and offset, contrast, pivot, saturation and temperature are searched. Hue shift and the spatial
+controls (unsharp mask, clarity) are kept from the starting grade and left out of the proxies.
+*/
+
+const int MATCH_PROXY_SIZE = 128;
+const double MATCH_TIME_BUDGET_MS = 800.0;
+
+enum class MatchMetric
+{
+	// distance between the per channel histograms, for references of a different shot
+	histogram,
+	// mean CIE76 delta E per pixel, for references of the same framing, e.g. a regrade of the same frame
+	deltaE,
+};
+
+struct MatchResult
+{
+	GradingSettings settings;
+	float startDistance = 0.0f;
+	float distance = 0.0f;
+	int rounds = 0;
+	int evaluations = 0;
+	double ms = 0.0;
+};
+
+// at most size pixels on the longest side, averaged down by halving
+FloatImage matchProxy(const FloatImage& image, int size = MATCH_PROXY_SIZE);
+
+// images are linear like FloatImage::fromQImage() makes them, start is also where the search begins. threads 0 uses one per core
+MatchResult matchGrade(const FloatImage& source, const FloatImage& reference, const GradingSettings& start,
+	MatchMetric metric = MatchMetric::histogram, int threads = 0);
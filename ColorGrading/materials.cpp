@@ -1,28 +1,140 @@
 #include "materials.h"
 #include "alerts.h"
+#include <QRegularExpression>
+#include <QTimer>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
 
-QString readWithIncludes(FilePath filePath, std::vector<FilePath> readFiles)
+FilePath sanitizePath(FilePath filePath) { return QFileInfo(filePath).absoluteFilePath().toLower(); }
+
+// a source file split at its #include lines, so expanding a shader never goes back to the disk for it
+struct SourceFile
+{
+	QString text; // as read, to tell a real change from a save that changed nothing
+	std::vector<QString> chunks; // the text around the includes, one more than includes
+	std::vector<FilePath> includes; // sanitized
+	std::vector<int> resumeLines; // the line after every include
+	bool read = false;
+};
+
+static const QRegularExpression INCLUDE_LINE("^\\s*#\\s*include\\s+\"([^\"]+)\"");
+
+SourceFile parseSourceFile(const FilePath& filePath)
 {
+	SourceFile parsed;
 	QFile fh(filePath);
 	if (!fh.open(QFile::ReadOnly | QFile::Text))
 	{
 		CONVERT_QSTRING(filePath, text);
 		warning("Could not read file '%s'", text);
-		return "";
+		return parsed;
 	}
 	QTextStream s(&fh);
-	return s.readAll();
+	parsed.text = s.readAll();
+	parsed.read = true;
+
+	// included paths are relative to the including file
+	QDir directory = QFileInfo(filePath).absoluteDir();
+	QStringList lines = parsed.text.split('\n');
+	QString chunk;
+	for (int i = 0; i < lines.size(); ++i)
+	{
+		QRegularExpressionMatch include = INCLUDE_LINE.match(lines[i]);
+		if (!include.hasMatch())
+		{
+			chunk += lines[i];
+			if (i + 1 < lines.size())
+				chunk += '\n';
+			continue;
+		}
+		parsed.chunks.push_back(chunk);
+		parsed.includes.push_back(sanitizePath(directory.filePath(include.captured(1))));
+		parsed.resumeLines.push_back(i + 2);
+		chunk.clear();
+	}
+	parsed.chunks.push_back(chunk);
+	return parsed;
+}
+
+std::map<FilePath, SourceFile> sourceCache;
+
+void watchFile(const FilePath& filePath);
+
+const SourceFile& cachedSourceFile(const FilePath& filePath)
+{
+	SourceFile& cached = sourceCache[filePath];
+	if (!cached.read)
+	{
+		cached = parseSourceFile(filePath);
+		watchFile(filePath);
+	}
+	return cached;
+}
+
+/*
+The source of filePath with its includes expanded in place, every file once per shader so common headers can be
+included from several files. readFiles gets every file the result depends on, its index is the source string
+number of the #line directives, which is what compile errors report as the file.
+*/
+void expandIncludes(const FilePath& filePath, std::vector<FilePath>& readFiles, QString& source)
+{
+	if (std::find(readFiles.begin(), readFiles.end(), filePath) != readFiles.end())
+		return;
+	int index = (int)readFiles.size();
+	readFiles.push_back(filePath);
+	const SourceFile& file = cachedSourceFile(filePath);
+	if (index)
+		source += QString("#line 1 %1\n").arg(index);
+	for (size_t i = 0; i < file.chunks.size(); ++i)
+	{
+		source += file.chunks[i];
+		if (i == file.includes.size())
+			break;
+		expandIncludes(file.includes[i], readFiles, source);
+		source += QString("\n#line %1 %2\n").arg(file.resumeLines[i]).arg(index);
+	}
+}
+
+QString readWithIncludes(FilePath filePath, std::vector<FilePath>& readFiles)
+{
+	QString source;
+	expandIncludes(sanitizePath(filePath), readFiles, source);
+	return source;
+}
+QString insertDefines(QString source, const QStringList& defines)
+{
+	if (defines.isEmpty())
+		return source;
+	QString lines;
+	for (auto define : defines)
+		lines += "#define " + define + "\n";
+	// #version has to stay the first statement, the lines after it keep their numbers
+	int versionEnd = source.startsWith("#version") ? source.indexOf('\n') + 1 : 0;
+	if (versionEnd)
+		lines += "#line 2 0\n";
+	return source.insert(versionEnd, lines);
 }
-FilePath sanitizePath(FilePath filePath) { return QFileInfo(filePath).absoluteFilePath().toLower(); }
 
 std::map<QString, GLuint> shaderCache;
 std::map<QString, GLuint> programCache;
-std::map<QString, QString> fileKeyAssociation;
-std::map<QString, std::vector<QString>> shaderSourceFiles;
+
+// dependencies: the files a shader was expanded from, the shaders that read a file, the programs that link a shader
+std::map<QString, std::vector<FilePath>> shaderSourceFiles;
+std::map<FilePath, std::set<QString>> fileShaders;
+std::map<QString, std::set<QString>> shaderPrograms;
+
+// files the watcher saw change, taken by the thread that compiles before it fetches anything
+std::mutex changedFilesLock;
+std::set<FilePath> changedFiles;
+std::atomic<bool> filesChanged(false);
 
 class ShaderWatcher : public QFileSystemWatcher
 {
 protected:
+	std::function<void()> _changed;
+
 	void onFileChanged(QString changedPath)
 	{
 		changedPath = sanitizePath(changedPath);
@@ -40,32 +152,89 @@ protected:
 			}
 			// todo: sleep ~ 5 ms
 		}
-		for (auto key : fileKeyAssociation[changedPath])
+		// the GL names belong to the thread that compiles, it rebuilds what depends on the file on its next fetch
 		{
-			if (shaderCache.count(key))
-			{
-				gl.glDeleteShader(shaderCache[key]);
-				shaderCache.erase(key);
-			}
-			if (programCache.count(key))
-			{
-				gl.glDeleteProgram(programCache[key]);
-				programCache.erase(key);
-			}
+			std::lock_guard<std::mutex> lock(changedFilesLock);
+			changedFiles.insert(changedPath);
 		}
+		filesChanged = true;
+		if (_changed)
+			_changed();
 	}
 
 public:
-	ShaderWatcher()
+	ShaderWatcher(std::function<void()> changed) : _changed(std::move(changed))
 	{
 		connect(this, &QFileSystemWatcher::fileChanged, this, &ShaderWatcher::onFileChanged);
 	}
 };
 
+ShaderWatcher* shaderWatcher = nullptr;
+
+void watchShaderFiles(std::function<void()> changed)
+{
+	if (!shaderWatcher)
+		shaderWatcher = new ShaderWatcher(std::move(changed));
+}
+
+void watchFile(const FilePath& filePath)
+{
+	if (!shaderWatcher)
+		return;
+	// files are read on the thread that compiles, the watcher lives on the GUI thread
+	QTimer::singleShot(0, shaderWatcher, [filePath]() { shaderWatcher->addPath(filePath); });
+}
+
+// drops the shaders that read a changed file and the programs that link them, they are built again when fetched
+void rebuildChangedShaders()
+{
+	if (!filesChanged.exchange(false))
+		return;
+	std::set<FilePath> changed;
+	{
+		std::lock_guard<std::mutex> lock(changedFilesLock);
+		changed.swap(changedFiles);
+	}
+
+	std::set<QString> shaders;
+	for (const FilePath& filePath : changed)
+	{
+		SourceFile parsed = parseSourceFile(filePath);
+		SourceFile& cached = sourceCache[filePath];
+		// editors often save twice or touch a file without changing it
+		if (!parsed.read || (cached.read && cached.text == parsed.text))
+			continue;
+		cached = std::move(parsed);
+		shaders.insert(fileShaders[filePath].begin(), fileShaders[filePath].end());
+	}
+
+	std::set<QString> programs;
+	for (const QString& key : shaders)
+	{
+		if (shaderCache.count(key))
+		{
+			gl.glDeleteShader(shaderCache[key]);
+			shaderCache.erase(key);
+		}
+		for (const QString& program : shaderPrograms[key])
+			programs.insert(program);
+	}
+	for (const QString& key : programs)
+	{
+		if (programCache.count(key))
+		{
+			gl.glDeleteProgram(programCache[key]);
+			programCache.erase(key);
+		}
+	}
+	if (!shaders.empty())
+		infod("Rebuilding %d shaders and %d programs", (int)shaders.size(), (int)programs.size());
+}
+
 const int INFO_LOG_BUFFER_SIZE = 1024 * 1024; // 1 MB a bit overkill?
 char* INFO_LOG_BUFFER = nullptr;
 
-GLuint compileShader(QString source, ProgramStage stage)
+GLuint compileShader(QString source, ProgramStage stage, const std::vector<FilePath>& readFiles)
 {
 	GLuint shader = gl.glCreateShader((GLenum)stage);
 	CONVERT_QSTRING(source, text);
@@ -79,7 +248,12 @@ GLuint compileShader(QString source, ProgramStage stage)
 			INFO_LOG_BUFFER = new char[INFO_LOG_BUFFER_SIZE];
 		int strLen;
 		gl.glGetShaderInfoLog(shader, INFO_LOG_BUFFER_SIZE, &strLen, INFO_LOG_BUFFER);
-		warning(INFO_LOG_BUFFER);
+		// the log names files by their source string number
+		QString files;
+		for (size_t i = 0; i < readFiles.size(); ++i)
+			files += QString("%1: %2\n").arg(i).arg(readFiles[i]);
+		CONVERT_QSTRING(files, fileList);
+		warning("%s%s", fileList, INFO_LOG_BUFFER);
 	}
 	return shader;
 }
@@ -89,7 +263,7 @@ QString shaderKey(const Shader& shader)
 	char key[sizeof(GLenum)];
 	GLenum stage = (GLenum)shader.stage();
 	CopyMemory(key, &stage, sizeof(GLenum));
-	return shader.filePath() + key;
+	return shader.filePath() + key + shader.defines().join(' ');
 }
 
 GLuint fetchShader(const Shader& shader)
@@ -99,12 +273,13 @@ GLuint fetchShader(const Shader& shader)
 	if (!shaderCache.count(key))
 	{
 		std::vector<FilePath> readFiles;
-		GLuint shaderi = compileShader(readWithIncludes(filePath, readFiles), shader.stage());
+		GLuint shaderi = compileShader(insertDefines(readWithIncludes(filePath, readFiles), shader.defines()), shader.stage(), readFiles);
 		shaderCache[key] = shaderi;
+		// the includes may have changed since the last build
+		for (auto assocFilePath : shaderSourceFiles[key])
+			fileShaders[assocFilePath].erase(key);
 		for (auto assocFilePath : readFiles)
-		{
-			fileKeyAssociation[assocFilePath].push_back(key);
-		}
+			fileShaders[assocFilePath].insert(key);
 		shaderSourceFiles[key] = readFiles;
 	}
 	return shaderCache[key];
@@ -155,19 +330,15 @@ GLuint fetchProgram(const std::vector<Shader>& shaders)
 		GLuint program = compileProgram(shaders);
 		programCache[key] = program;
 		for (auto shader : shaders)
-		{
-			for (auto assocFilePath : shaderSourceFiles[shaderKey(shader)])
-			{
-				fileKeyAssociation[assocFilePath].push_back(key);
-			}
-		}
+			shaderPrograms[shaderKey(shader)].insert(key);
 	}
 	return programCache[key];
 }
 
-Shader::Shader(FilePath filePath, ProgramStage stage) :
+Shader::Shader(FilePath filePath, ProgramStage stage, QStringList defines) :
 	_filePath(filePath),
-	_stage(stage)
+	_stage(stage),
+	_defines(defines)
 {
 }
 
@@ -190,10 +361,26 @@ void Program::bind() const
 	gl.glUseProgram(fetchProgram(_shaders));
 }
 
-#define UNIFORM_LOC GLint loc = gl.glGetUniformLocation(fetchProgram(_shaders), key); \
+void Program::dispatch(int x, int y, int z) const
+{
+	bind();
+	gl.glDispatchCompute(x, y, z);
+}
+
+// missing uniforms are only reported once per program, not every frame
+std::set<std::pair<GLuint, std::string>> reportedMissingUniforms;
+
+void reportMissingUniform(GLuint program, const char* key)
+{
+	if (reportedMissingUniforms.insert(std::make_pair(program, std::string(key))).second)
+		infod("Skipping uniform '%s'. Not found.", key);
+}
+
+#define UNIFORM_LOC GLuint program = fetchProgram(_shaders); \
+GLint loc = gl.glGetUniformLocation(program, key); \
 if (loc == -1) \
 { \
-	infod("Skipping uniform '%s'. Not found.", key); \
+	reportMissingUniform(program, key); \
 	return; \
 }
 
@@ -2,6 +2,7 @@
 
 #include "gl.h"
 #include "buffers.h"
+#include <functional>
 #include <map>
 
 typedef QString FilePath;
@@ -11,6 +12,7 @@ enum class ProgramStage : GLenum
 	frag = GL_FRAGMENT_SHADER,
 	vert = GL_VERTEX_SHADER,
 	geometry = GL_GEOMETRY_SHADER,
+	compute = GL_COMPUTE_SHADER,
 };
 
 class Shader
@@ -18,11 +20,14 @@ class Shader
 protected:
 	FilePath _filePath;
 	ProgramStage _stage;
+	QStringList _defines;
 
 public:
-	Shader(FilePath filePath, ProgramStage stage);
+	// defines are inserted after the #version line, the same file compiles once per set of defines
+	Shader(FilePath filePath, ProgramStage stage, QStringList defines = QStringList());
 	inline FilePath filePath() const { return _filePath; }
 	inline ProgramStage stage() const { return _stage; }
+	inline const QStringList& defines() const { return _defines; }
 };
 
 class Program
@@ -35,6 +40,8 @@ public:
 	Program(Shader& shader);
 	Program(std::vector<Shader> shaders);
 	void bind() const;
+	// binds and runs a program made of a compute shader
+	void dispatch(int x, int y = 1, int z = 1) const;
 
 	// uniform setters
 	void set(char* key, float value);
@@ -65,3 +72,14 @@ public:
 	void set(char* key, std::vector<QMatrix3x3> value);
 	void set(char* key, std::vector<QMatrix4x4> value);
 };
+
+/*
+Shader files can #include "file.glsl", relative to the including file. Every file is read once and kept parsed,
+changed files are read again and only the shaders that include them and the programs linking those are rebuilt,
+on the thread that compiles, the next time they are fetched.
+
+Call on the GUI thread to watch the files read from then on, changed runs there after a file changed.
+*/
+void watchShaderFiles(std::function<void()> changed);
+// drops what the changed files invalidated, call on the compiling thread before a frame so no frame mixes old and new programs
+void rebuildChangedShaders();
@@ -0,0 +1,97 @@
+#include "outputtransform.h"
+#include <cmath>
+#include <mutex>
+
+static const char* OUTPUT_TRANSFORM_NAMES[(int)OutputTransform::count] = { "srgb", "rec709", "aces", "pq", "hlg" };
+
+const char* outputTransformName(OutputTransform transform)
+{
+	return transform >= OutputTransform::srgb && transform < OutputTransform::count ? OUTPUT_TRANSFORM_NAMES[(int)transform] : "";
+}
+
+bool parseOutputTransform(const char* name, OutputTransform& transform)
+{
+	for (int i = 0; i < (int)OutputTransform::count; ++i)
+	{
+		if (!strcmp(name, OUTPUT_TRANSFORM_NAMES[i]))
+		{
+			transform = (OutputTransform)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static double srgbEncode(double v)
+{
+	return v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+}
+
+// from https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+static double acesFilm(double x)
+{
+	const double a = 2.51;
+	const double b = 0.03;
+	const double c = 2.43;
+	const double d = 0.59;
+	const double e = 0.14;
+	double v = (x * (a * x + b)) / (x * (c * x + d) + e);
+	return v < 0.0 ? 0.0 : (v > 1.0 ? 1.0 : v);
+}
+
+static double pqEncode(double nits)
+{
+	const double m1 = 2610.0 / 16384.0;
+	const double m2 = 2523.0 / 4096.0 * 128.0;
+	const double c1 = 3424.0 / 4096.0;
+	const double c2 = 2413.0 / 4096.0 * 32.0;
+	const double c3 = 2392.0 / 4096.0 * 32.0;
+	double y = pow((nits < 10000.0 ? nits : 10000.0) / 10000.0, m1);
+	return pow((c1 + c2 * y) / (1.0 + c3 * y), m2);
+}
+
+static double hlgEncode(double e)
+{
+	const double a = 0.17883277;
+	const double b = 1.0 - 4.0 * a;
+	const double c = 0.5 - a * log(4.0 * a);
+	e = e < 1.0 ? e : 1.0;
+	return e <= 1.0 / 12.0 ? sqrt(3.0 * e) : a * log(12.0 * e - b) + c;
+}
+
+float outputTransformExact(OutputTransform transform, float linear)
+{
+	double v = linear > 0.0f ? linear : 0.0;
+	switch (transform)
+	{
+	case OutputTransform::srgb: return (float)srgbEncode(v);
+	case OutputTransform::rec709: return (float)(v < 0.018 ? v * 4.5 : 1.099 * pow(v, 0.45) - 0.099);
+	case OutputTransform::acesFilmic: return (float)srgbEncode(acesFilm(v));
+	case OutputTransform::pq: return (float)pqEncode(v * 203.0);
+	// scene light that HLG signals at 75%
+	case OutputTransform::hlg: return (float)hlgEncode(v * 0.26497);
+	default: return (float)v;
+	}
+}
+
+const float* outputShaper(OutputTransform transform)
+{
+	static std::vector<float> tables[(int)OutputTransform::count];
+	static std::once_flag made[(int)OutputTransform::count];
+	if (transform < OutputTransform::srgb || transform >= OutputTransform::count)
+		transform = OutputTransform::srgb;
+	std::vector<float>& table = tables[(int)transform];
+	std::call_once(made[(int)transform], [&]()
+	{
+		table.resize(OUTPUT_SHAPER_SIZE);
+		for (int i = 0; i < OUTPUT_SHAPER_SIZE; ++i)
+		{
+			// the float whose upper bits are the index
+			uint32_t bits = (uint32_t)(OUTPUT_SHAPER_FIRST + i) << 16;
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			table[i] = outputTransformExact(transform, value);
+		}
+	});
+	return &table[0];
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+Last stage of the grade, from linear light to the values that are written out or shown.
+
+1.0 is diffuse white. The HDR transforms put it at the reference white of BT.2408,
+203 nits for PQ and 75% signal for HLG, brighter values keep their headroom.
+*/
+enum class OutputTransform
+{
+	srgb, // IEC 61966-2-1, exact instead of the pow() approximation grading.glsl used to end with
+	rec709, // BT.709 camera OETF
+	acesFilmic, // Narkowicz' fit of the ACES filmic curve, then sRGB
+	pq, // SMPTE ST 2084
+	hlg, // BT.2100 hybrid log gamma
+	count,
+};
+
+const char* outputTransformName(OutputTransform transform);
+// by name, false if there is no such transform
+bool parseOutputTransform(const char* name, OutputTransform& transform);
+
+// the transfer function itself, per channel, for a linear value that is not negative
+float outputTransformExact(OutputTransform transform, float linear);
+
+/*
+The transforms are applied through a 1D shaper LUT instead of their pow() and log() chains.
+
+An entry is picked by the exponent and the top 7 mantissa bits of the float, so every octave gets 128 entries
+and the remaining mantissa bits interpolate between them, like a half float with a wider exponent.
+OUTPUT_SHAPER_SIZE entries cover 2^-20 to 2^12 with an error below a 16 bit code value, apart from the corners
+of the curves (the clip of PQ and HLG, the start of the rec 709 power segment). Smaller values fade linearly to 0,
+larger ones take the last entry. grading.glsl reads the same table from a texture.
+*/
+const int OUTPUT_SHAPER_SIZE = 4096;
+// upper 16 bits of the float of the first entry, 2^-20
+const int OUTPUT_SHAPER_FIRST = (127 - 20) << 7;
+
+// table of a transform, made once and kept for the life of the process
+const float* outputShaper(OutputTransform transform);
+
+inline float shapeOutput(const float* shaper, float value)
+{
+	// also catches NaN
+	if (!(value > 0.0f))
+		return 0.0f;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	int index = (int)(bits >> 16) - OUTPUT_SHAPER_FIRST;
+	if (index < 0)
+		return shaper[0] * value * 1048576.0f;
+	if (index >= OUTPUT_SHAPER_SIZE - 1)
+		return shaper[OUTPUT_SHAPER_SIZE - 1];
+	float t = (bits & 0xFFFF) * (1.0f / 65536.0f);
+	return shaper[index] + (shaper[index + 1] - shaper[index]) * t;
+}
@@ -0,0 +1,164 @@
+#include "profiling.h"
+
+Profiler profiler;
+
+void RollingAverage::add(float sample)
+{
+	if (_count == ROLLING_AVERAGE_FRAMES)
+		_sum -= _samples[_cursor];
+	else
+		++_count;
+	_samples[_cursor] = sample;
+	_sum += sample;
+	_cursor = (_cursor + 1) % ROLLING_AVERAGE_FRAMES;
+}
+
+void GpuStageTimer::_initialize()
+{
+	_handle = new GLint[4];
+	gl.glGenQueries(4, (GLuint*)_handle);
+}
+
+void GpuStageTimer::_uninitialize()
+{
+	gl.glDeleteQueries(4, (GLuint*)_handle);
+	delete[] _handle;
+	_handle = nullptr;
+}
+
+void GpuStageTimer::begin()
+{
+	handle<GLuint>();
+	// if the GPU is more than a frame behind this drops the old result instead of waiting for it
+	_pending[_frame & 1] = false;
+	gl.glQueryCounter(_query(_frame, 0), GL_TIMESTAMP);
+	_begun = true;
+}
+
+void GpuStageTimer::end()
+{
+	// the profiler was enabled between begin and end, there is no start to measure from
+	if (!_begun)
+		return;
+	gl.glQueryCounter(_query(_frame, 1), GL_TIMESTAMP);
+	_pending[_frame & 1] = true;
+	_begun = false;
+}
+
+void GpuStageTimer::resolve()
+{
+	if (!_handle)
+		return;
+	++_frame;
+	for (int slot = 0; slot < 2; ++slot)
+	{
+		if (!_pending[slot])
+			continue;
+		// the end query is issued last, so if that is available both are
+		GLint available = 0;
+		gl.glGetQueryObjectiv(_query(slot, 1), GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue;
+		GLuint64 start, stop;
+		gl.glGetQueryObjectui64v(_query(slot, 0), GL_QUERY_RESULT, &start);
+		gl.glGetQueryObjectui64v(_query(slot, 1), GL_QUERY_RESULT, &stop);
+		_average.add((float)((stop - start) / 1000000.0));
+		_pending[slot] = false;
+	}
+}
+
+void GpuStageTimer::release()
+{
+	if (_handle)
+		_uninitialize();
+}
+
+void CpuStageTimer::end()
+{
+	if (!_begun)
+		return;
+	_begun = false;
+	std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - _start;
+	_average.add(elapsed.count());
+}
+
+void Profiler::_register(const char* stage)
+{
+	for (const char* existing : _order)
+		if (!strcmp(existing, stage))
+			return;
+	_order.push_back(stage);
+}
+
+void Profiler::beginGpu(const char* stage)
+{
+	if (!_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	_register(stage);
+	_gpu[stage].begin();
+}
+
+void Profiler::endGpu(const char* stage)
+{
+	if (!_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _gpu.find(stage);
+	if (it != _gpu.end())
+		it->second.end();
+}
+
+void Profiler::beginCpu(const char* stage)
+{
+	if (!_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	_register(stage);
+	_cpu[stage].begin();
+}
+
+void Profiler::endCpu(const char* stage)
+{
+	if (!_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _cpu.find(stage);
+	if (it != _cpu.end())
+		it->second.end();
+}
+
+void Profiler::newFrame()
+{
+	if (!_enabled)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto& it : _gpu)
+		it.second.resolve();
+}
+
+std::vector<ProfilerSample> Profiler::samples() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<ProfilerSample> result;
+	for (const char* stage : _order)
+	{
+		auto gpu = _gpu.find(stage);
+		if (gpu != _gpu.end())
+			result.push_back({ stage, true, gpu->second.average().last(), gpu->second.average().average() });
+		auto cpu = _cpu.find(stage);
+		if (cpu != _cpu.end())
+			result.push_back({ stage, false, cpu->second.average().last(), cpu->second.average().average() });
+	}
+	return result;
+}
+
+void Profiler::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto& it : _gpu)
+		it.second.release();
+	_gpu.clear();
+	_cpu.clear();
+	_order.clear();
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "gl.h"
+#include "buffers.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/*
+Frame profiling utilities.
+
+GPU stages are measured with GL_TIMESTAMP queries. Every stage owns two pairs of queries,
+one pair is written this frame while the pair from the previous frame is read back.
+The previous pair is only read when GL_QUERY_RESULT_AVAILABLE says so, so this never stalls the pipeline,
+at the cost of the results lagging a frame behind.
+
+CPU stages are measured with std::chrono::steady_clock.
+
+All results are in milliseconds and are averaged over the last ROLLING_AVERAGE_FRAMES samples.
+*/
+
+const int ROLLING_AVERAGE_FRAMES = 60;
+
+class RollingAverage
+{
+protected:
+	float _samples[ROLLING_AVERAGE_FRAMES] = {};
+	int _count = 0;
+	int _cursor = 0;
+	float _sum = 0.0f;
+
+public:
+	void add(float sample);
+	inline float average() const { return _count ? _sum / _count : 0.0f; }
+	inline float last() const { return _count ? _samples[(_cursor + ROLLING_AVERAGE_FRAMES - 1) % ROLLING_AVERAGE_FRAMES] : 0.0f; }
+};
+
+class GpuStageTimer : public GraphicsHandleBase
+{
+protected:
+	// 2 frames worth of begin / end timestamp queries
+	bool _pending[2] = { false, false };
+	bool _begun = false;
+	int _frame = 0;
+	RollingAverage _average;
+
+	virtual void _initialize() override;
+	virtual void _uninitialize() override;
+	inline GLuint _query(int frame, int index) { return ((GLuint*)_handle)[(frame & 1) * 2 + index]; }
+
+public:
+	GpuStageTimer() {}
+	virtual ~GpuStageTimer() { release(); }
+	void begin();
+	void end();
+	// reads back the results of the previous frame if they are ready, call once per frame before begin()
+	void resolve();
+	// delete the queries, requires the context that created them to be current
+	void release();
+
+	inline const RollingAverage& average() const { return _average; }
+};
+
+class CpuStageTimer
+{
+protected:
+	std::chrono::steady_clock::time_point _start;
+	bool _begun = false;
+	RollingAverage _average;
+
+public:
+	inline void begin() { _start = std::chrono::steady_clock::now(); _begun = true; }
+	// without a begin() since the last end() nothing is measured, the profiler may have been enabled in between
+	void end();
+
+	inline const RollingAverage& average() const { return _average; }
+};
+
+struct ProfilerSample
+{
+	const char* name;
+	bool gpu;
+	float lastMs;
+	float averageMs;
+};
+
+/*
+Keeps named stage timers alive and gathers their results.
+Stage names are expected to be string literals, they are compared by content but stored without copying.
+GPU timers require a current GL context for begin(), end() and newFrame().
+CPU stages can be timed from any thread, GPU stages only from the thread of the context that owns their queries.
+*/
+class Profiler
+{
+protected:
+	struct StageNameLess { inline bool operator()(const char* lhs, const char* rhs) const { return strcmp(lhs, rhs) < 0; } };
+	std::map<const char*, GpuStageTimer, StageNameLess> _gpu;
+	std::map<const char*, CpuStageTimer, StageNameLess> _cpu;
+	std::vector<const char*> _order;
+	std::atomic<bool> _enabled{ true };
+	// the GUI thread times the controls while the render thread times the frame
+	mutable std::mutex _mutex;
+
+	void _register(const char* stage);
+
+public:
+	inline bool enabled() const { return _enabled; }
+	inline void setEnabled(bool enabled) { _enabled = enabled; }
+
+	void beginGpu(const char* stage);
+	void endGpu(const char* stage);
+	void beginCpu(const char* stage);
+	void endCpu(const char* stage);
+
+	// resolve last frame's GPU queries, call at the start of a frame with the GL context current
+	void newFrame();
+
+	// results in order of first use
+	std::vector<ProfilerSample> samples() const;
+
+	// drop all timers, call with the GL context that owns the queries current
+	void clear();
+};
+
+extern Profiler profiler;
+
+// scope guards for the global profiler
+class ScopedCpuStage
+{
+	const char* _stage;
+public:
+	inline ScopedCpuStage(const char* stage) : _stage(stage) { profiler.beginCpu(_stage); }
+	inline ~ScopedCpuStage() { profiler.endCpu(_stage); }
+};
+
+class ScopedGpuStage
+{
+	const char* _stage;
+public:
+	inline ScopedGpuStage(const char* stage) : _stage(stage) { profiler.beginGpu(_stage); }
+	inline ~ScopedGpuStage() { profiler.endGpu(_stage); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_CPU(STAGE) ScopedCpuStage PROFILE_CONCAT(_profileCpu, __LINE__)(STAGE)
+#define PROFILE_GPU(STAGE) ScopedGpuStage PROFILE_CONCAT(_profileGpu, __LINE__)(STAGE)
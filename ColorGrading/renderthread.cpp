@@ -0,0 +1,65 @@
+#include "renderthread.h"
+#include "alerts.h"
+#include <QCoreApplication>
+
+RenderThread::RenderThread(QOpenGLContext* shareWith, std::function<void()> initialize, std::function<void()> render, std::function<void()> release) :
+	_initialize(std::move(initialize)),
+	_render(std::move(render)),
+	_release(std::move(release))
+{
+	// surfaces have to be created on the GUI thread, the context only has to be current on one thread at a time
+	QSurfaceFormat format = shareWith ? shareWith->format() : QSurfaceFormat::defaultFormat();
+	_surface = new QOffscreenSurface();
+	_surface->setFormat(format);
+	_surface->create();
+	_context = new QOpenGLContext();
+	_context->setFormat(format);
+	_context->setShareContext(shareWith);
+	if (!_context->create())
+		errord("Could not create the GL context of the render thread");
+	_context->moveToThread(this);
+	start();
+}
+
+RenderThread::~RenderThread()
+{
+	{
+		std::lock_guard<std::mutex> guard(_wakeLock);
+		_stop = true;
+	}
+	_wake.notify_one();
+	wait();
+	delete _context;
+	delete _surface;
+}
+
+void RenderThread::wake()
+{
+	{
+		std::lock_guard<std::mutex> guard(_wakeLock);
+		_woken = true;
+	}
+	_wake.notify_one();
+}
+
+void RenderThread::run()
+{
+	if (!_context->makeCurrent(_surface))
+		errord("Could not make the GL context of the render thread current");
+	_initialize();
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(_wakeLock);
+			_wake.wait(guard, [this]() { return _woken || _stop; });
+			if (_stop)
+				break;
+			_woken = false;
+		}
+		_render();
+	}
+	_release();
+	_context->doneCurrent();
+	// deleted by the GUI thread once this one is gone
+	_context->moveToThread(QCoreApplication::instance()->thread());
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QThread>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+/*
+A thread with a GL context of its own that shares textures, buffers and programs with the context of a widget,
+so rendering does not hold up the GUI thread.
+
+The thread sleeps until wake() is called, then runs render once. Wakes that arrive while it renders are merged
+into one more run. initialize runs first and release last, both on the thread with its context current.
+Release has to delete what is not shared between contexts (framebuffers, queries, sync objects of its own),
+everything else can be deleted later from the widget's context.
+Without a context to share with the thread has a context of its own, e.g. for grading a batch without a window.
+QOpenGLContext::currentContext() is null in initialize if it could not be created.
+*/
+class RenderThread : public QThread
+{
+protected:
+	QOpenGLContext* _context;
+	QOffscreenSurface* _surface;
+	std::function<void()> _initialize;
+	std::function<void()> _render;
+	std::function<void()> _release;
+	std::mutex _wakeLock;
+	std::condition_variable _wake;
+	bool _woken = false;
+	bool _stop = false;
+
+	virtual void run() override;
+
+public:
+	// call on the GUI thread, starts the thread right away, shareWith may be null
+	RenderThread(QOpenGLContext* shareWith, std::function<void()> initialize, std::function<void()> render, std::function<void()> release);
+	// waits for the current render and release
+	virtual ~RenderThread();
+
+	// from any thread
+	void wake();
+};
@@ -0,0 +1,125 @@
+#include "residency.h"
+#include "buffers.h"
+#include <algorithm>
+
+ResidencyManager residency;
+
+const char* residencyTypeName(ResidencyType type)
+{
+	switch (type)
+	{
+	case ResidencyType::texture2D: return "2D";
+	case ResidencyType::texture3D: return "3D";
+	case ResidencyType::texture2DArray: return "2D array";
+	case ResidencyType::textureCube: return "cube";
+	}
+	return "?";
+}
+
+void ResidencyManager::setBudget(int64_t bytes)
+{
+	_budget = bytes;
+	_enforce();
+}
+
+void ResidencyManager::newFrame()
+{
+	++_frame;
+	_enforce();
+}
+
+void ResidencyManager::allocated(ColorBufferObject2DBase* buffer)
+{
+	auto evicted = std::find(_evicted.begin(), _evicted.end(), buffer);
+	if (evicted != _evicted.end())
+		_evicted.erase(evicted);
+	if (std::find(_resident.begin(), _resident.end(), buffer) != _resident.end())
+		return;
+	_resident.push_back(buffer);
+	++_uploads[(int)buffer->residencyType()];
+	// the new buffer is about to be used, it is marked as such so it survives its own upload
+	buffer->_lastUse = _frame;
+	_enforce();
+}
+
+void ResidencyManager::released(ColorBufferObject2DBase* buffer)
+{
+	auto it = std::find(_resident.begin(), _resident.end(), buffer);
+	if (it != _resident.end())
+		_resident.erase(it);
+	it = std::find(_evicted.begin(), _evicted.end(), buffer);
+	if (it != _evicted.end())
+		_evicted.erase(it);
+}
+
+void ResidencyManager::moved(ColorBufferObject2DBase* from, ColorBufferObject2DBase* to)
+{
+	std::replace(_resident.begin(), _resident.end(), from, to);
+	std::replace(_evicted.begin(), _evicted.end(), from, to);
+}
+
+void ResidencyManager::_enforce()
+{
+	if (!_budget)
+		return;
+	int64_t total = 0;
+	for (ColorBufferObject2DBase* buffer : _resident)
+		total += buffer->gpuBytes();
+
+	while (total > _budget)
+	{
+		ColorBufferObject2DBase* oldest = nullptr;
+		for (ColorBufferObject2DBase* buffer : _resident)
+			if (buffer->evictable() && buffer->_lastUse < _frame && (!oldest || buffer->_lastUse < oldest->_lastUse))
+				oldest = buffer;
+		if (!oldest)
+			return;
+		total -= oldest->gpuBytes();
+		++_evictions[(int)oldest->residencyType()];
+		// unregisters through released()
+		oldest->evict();
+		_evicted.push_back(oldest);
+	}
+}
+
+ResidencyCounters ResidencyManager::counters(ResidencyType type) const
+{
+	ResidencyCounters result;
+	for (ColorBufferObject2DBase* buffer : _resident)
+	{
+		if (buffer->residencyType() != type)
+			continue;
+		result.gpuBytes += buffer->gpuBytes();
+		result.shadowBytes += buffer->shadowBytes();
+		++result.resident;
+		if (buffer->evictable())
+			++result.evictable;
+	}
+	for (ColorBufferObject2DBase* buffer : _evicted)
+	{
+		if (buffer->residencyType() != type)
+			continue;
+		result.shadowBytes += buffer->shadowBytes();
+		++result.evicted;
+	}
+	result.uploads = _uploads[(int)type];
+	result.evictions = _evictions[(int)type];
+	return result;
+}
+
+ResidencyCounters ResidencyManager::total() const
+{
+	ResidencyCounters result;
+	for (int type = 0; type < (int)ResidencyType::count; ++type)
+	{
+		ResidencyCounters counts = counters((ResidencyType)type);
+		result.gpuBytes += counts.gpuBytes;
+		result.shadowBytes += counts.shadowBytes;
+		result.resident += counts.resident;
+		result.evictable += counts.evictable;
+		result.evicted += counts.evicted;
+		result.uploads += counts.uploads;
+		result.evictions += counts.evictions;
+	}
+	return result;
+}
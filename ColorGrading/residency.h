@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class ColorBufferObject2DBase;
+
+/*
+Accounts the GPU memory of color buffers and keeps it under a budget.
+
+Buffers register when their storage is allocated and unregister when it is deleted, binding one marks it as used this frame.
+When the allocated bytes exceed the budget the least recently used buffers that can be recreated from their CPU copy
+are evicted, they are uploaded again the next time they are used. The source bin has no CPU copy but is evictable too,
+it reads its shots from their files again (see SourceBin::layer()). Other buffers without a CPU copy hold results rendered
+on the GPU (blur, pyramid), those are never evicted and only count towards the budget.
+Buffers used in the current frame are never evicted either, so the budget can be exceeded for a frame.
+
+Calls need the GL context that owns the buffers to be current, like the buffers themselves.
+*/
+
+enum class ResidencyType
+{
+	texture2D,
+	texture3D,
+	texture2DArray,
+	textureCube,
+	count
+};
+
+const char* residencyTypeName(ResidencyType type);
+
+struct ResidencyCounters
+{
+	int64_t gpuBytes = 0;
+	int64_t shadowBytes = 0; // CPU copies kept to upload from
+	int resident = 0;
+	int evictable = 0;
+	int evicted = 0;
+	// totals since startup
+	int uploads = 0;
+	int evictions = 0;
+};
+
+class ResidencyManager
+{
+protected:
+	std::vector<ColorBufferObject2DBase*> _resident;
+	// evicted buffers still hold their CPU copy
+	std::vector<ColorBufferObject2DBase*> _evicted;
+	int _uploads[(int)ResidencyType::count] = {};
+	int _evictions[(int)ResidencyType::count] = {};
+	int64_t _budget = 0;
+	uint64_t _frame = 1;
+
+	void _enforce();
+
+public:
+	// 0 disables eviction
+	inline int64_t budget() const { return _budget; }
+	void setBudget(int64_t bytes);
+
+	inline uint64_t frame() const { return _frame; }
+	// call at the start of a frame, evicts what the last frame left over budget
+	void newFrame();
+
+	// called by the buffers themselves
+	void allocated(ColorBufferObject2DBase* buffer);
+	// storage deleted, or the buffer itself
+	void released(ColorBufferObject2DBase* buffer);
+	// buffers are tracked by address, moving one hands its entry to the new address
+	void moved(ColorBufferObject2DBase* from, ColorBufferObject2DBase* to);
+
+	ResidencyCounters counters(ResidencyType type) const;
+	ResidencyCounters total() const;
+};
+
+extern ResidencyManager residency;
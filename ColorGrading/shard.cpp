@@ -0,0 +1,405 @@
+#include "shard.h"
+#include "alerts.h"
+#include <QTimer>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+// how often the coordinator prints progress
+const int SHARD_PROGRESS_MS = 2000;
+
+ProcessShardWorker::ProcessShardWorker(const QString& program, const QStringList& arguments)
+	: _program(program), _arguments(arguments)
+{
+	// stdout is the protocol, the worker's log goes straight to ours
+	_process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	QObject::connect(&_process, &QProcess::readyReadStandardOutput, [this]()
+	{
+		_received += _process.readAllStandardOutput();
+		int newline;
+		while ((newline = _received.indexOf('\n')) != -1)
+		{
+			QByteArray line = _received.left(newline).trimmed();
+			_received.remove(0, newline + 1);
+			if (!line.isEmpty() && onLine)
+				onLine(line);
+		}
+	});
+	QObject::connect(&_process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), [this](int, QProcess::ExitStatus)
+	{
+		if (onExit)
+			onExit();
+	});
+	// finished is not emitted for a process that never started
+	QObject::connect(&_process, &QProcess::errorOccurred, [this](QProcess::ProcessError error)
+	{
+		if (error == QProcess::FailedToStart && onExit)
+			onExit();
+	});
+}
+
+ProcessShardWorker::~ProcessShardWorker()
+{
+	onLine = nullptr;
+	onExit = nullptr;
+	if (_process.state() != QProcess::NotRunning)
+	{
+		_process.closeWriteChannel();
+		if (!_process.waitForFinished(1000))
+			_process.kill();
+		_process.waitForFinished(1000);
+	}
+}
+
+void ProcessShardWorker::start()
+{
+	_received.clear();
+	_process.start(_program, _arguments);
+	// commands written before the process runs would be lost
+	_process.waitForStarted();
+}
+
+void ProcessShardWorker::send(const QByteArray& line)
+{
+	_process.write(line + "\n");
+}
+
+QString ProcessShardWorker::name() const
+{
+	return QString("pid %1").arg(_process.processId());
+}
+
+ShardCoordinator::ShardCoordinator(int numFrames, std::vector<std::unique_ptr<ShardWorker>> workers)
+	: _attempts(numFrames, 0), _numFrames(numFrames)
+{
+	int count = (int)workers.size();
+	_workers.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		_workers[i].transport = std::move(workers[i]);
+		_workers[i].transport->onLine = [this, i](const QByteArray& line) { _receive(i, line); };
+		_workers[i].transport->onExit = [this, i]() { _exited(i); };
+
+		// equal contiguous ranges to start with, handed out in order by _assign()
+		int begin = (int)((qint64)numFrames * i / count);
+		int end = (int)((qint64)numFrames * (i + 1) / count);
+		if (begin < end)
+			_pending.push_back({ begin, end });
+	}
+}
+
+void ShardCoordinator::_receive(int index, const QByteArray& line)
+{
+	Worker& worker = _workers[index];
+	QList<QByteArray> words = line.split(' ');
+	const QByteArray& command = words[0];
+
+	if (command == "done" && words.size() == 3)
+	{
+		int frame = words[1].toInt();
+		worker.begin = std::max(worker.begin, frame + 1);
+		++worker.frames;
+		worker.gradeMs += words[2].toDouble();
+		++_done;
+	}
+	else if (command == "failed" && words.size() == 2)
+	{
+		int frame = words[1].toInt();
+		worker.begin = std::max(worker.begin, frame + 1);
+		_failFrame(frame);
+	}
+	else if (command == "shrunk" && words.size() == 2 && worker.stealFor != -1)
+	{
+		int end = words[1].toInt();
+		Worker& thief = _workers[worker.stealFor];
+		int stolenEnd = worker.stealEnd;
+		// a thief that exited in the meantime may have been restarted with other work
+		bool waiting = thief.stealing && thief.running;
+		worker.end = end;
+		worker.stealFor = -1;
+		thief.stealing = false;
+		if (end < stolenEnd)
+		{
+			if (waiting)
+			{
+				thief.begin = end;
+				thief.end = stolenEnd;
+				thief.busy = true;
+				thief.transport->send(QString("range %1 %2").arg(end).arg(stolenEnd).toLatin1());
+			}
+			else
+				_pending.push_back({ end, stolenEnd });
+		}
+	}
+	else if (command == "idle")
+		worker.busy = false;
+	else
+	{
+		QString name = worker.transport->name();
+		CONVERT_QSTRING(name, text);
+		warningd("Unexpected message from shard worker %s: %s", text, line.constData());
+	}
+
+	_assignIdle();
+	if (_loop && _finished())
+		_loop->quit();
+}
+
+void ShardCoordinator::_exited(int index)
+{
+	Worker& worker = _workers[index];
+	worker.running = false;
+	QString name = worker.transport->name();
+	CONVERT_QSTRING(name, text);
+
+	if (worker.busy && worker.begin < worker.end)
+	{
+		warningd("Shard worker %s exited at frame %d", text, worker.begin);
+		// the frame in progress may be what took the worker down, it counts as an attempt
+		_failFrame(worker.begin);
+		if (worker.begin + 1 < worker.end)
+			_pending.push_back({ worker.begin + 1, worker.end });
+	}
+	worker.busy = false;
+	worker.stealing = false;
+	// a shrink that will never be answered, the frames it would have freed were requeued above
+	if (worker.stealFor != -1)
+	{
+		_workers[worker.stealFor].stealing = false;
+		worker.stealFor = -1;
+	}
+
+	if (!_finished() && worker.restarts < SHARD_MAX_RESTARTS)
+	{
+		++worker.restarts;
+		worker.transport->start();
+		worker.running = true;
+	}
+	else if (!_finished())
+		warningd("Shard worker %s exited too often, not restarting it", text);
+
+	_assignIdle();
+
+	bool anyRunning = false;
+	for (const Worker& w : _workers)
+		anyRunning |= w.running;
+	if (!anyRunning && !_finished())
+	{
+		errord("All shard workers are gone, %d frames were not graded", _numFrames - _done - _failed);
+		_failed = _numFrames - _done;
+	}
+	if (_loop && _finished())
+		_loop->quit();
+}
+
+void ShardCoordinator::_assign(int index)
+{
+	Worker& worker = _workers[index];
+	// a worker that is being shrunk gets new work once it answered
+	if (!worker.running || worker.busy || worker.stealing || worker.stealFor != -1)
+		return;
+
+	if (!_pending.empty())
+	{
+		std::pair<int, int> range = _pending.front();
+		_pending.pop_front();
+		worker.begin = range.first;
+		worker.end = range.second;
+		worker.busy = true;
+		worker.transport->send(QString("range %1 %2").arg(range.first).arg(range.second).toLatin1());
+		return;
+	}
+	_steal(index);
+}
+
+void ShardCoordinator::_assignIdle()
+{
+	for (int i = 0; i < (int)_workers.size(); ++i)
+		_assign(i);
+}
+
+bool ShardCoordinator::_steal(int thief)
+{
+	// the largest range left, not counting the frame its worker is on
+	int victim = -1;
+	int most = 0;
+	for (int i = 0; i < (int)_workers.size(); ++i)
+	{
+		const Worker& worker = _workers[i];
+		if (i == thief || !worker.running || !worker.busy || worker.stealFor != -1)
+			continue;
+		int left = worker.end - worker.begin - 1;
+		if (left > most)
+		{
+			most = left;
+			victim = i;
+		}
+	}
+	if (victim == -1 || most < SHARD_MIN_STEAL)
+		return false;
+
+	Worker& worker = _workers[victim];
+	int split = worker.end - most / 2;
+	worker.stealFor = thief;
+	worker.stealEnd = worker.end;
+	_workers[thief].stealing = true;
+	worker.transport->send(QString("shrink %1").arg(split).toLatin1());
+	return true;
+}
+
+void ShardCoordinator::_failFrame(int frame)
+{
+	if (frame < 0 || frame >= _numFrames)
+		return;
+	if (++_attempts[frame] < SHARD_MAX_ATTEMPTS)
+		_pending.push_back({ frame, frame + 1 });
+	else
+	{
+		errord("Frame %d failed %d times, giving up on it", frame, SHARD_MAX_ATTEMPTS);
+		++_failed;
+	}
+}
+
+bool ShardCoordinator::_finished() const
+{
+	return _done + _failed >= _numFrames;
+}
+
+void ShardCoordinator::_report(bool final) const
+{
+	double wall = _clock.elapsed() / 1000.0;
+	if (!final)
+	{
+		infod("%d of %d frames graded, %d failed, %.1f s", _done, _numFrames, _failed, wall);
+		return;
+	}
+
+	// frames per second while grading, per worker. the sum of busy time over the wall time is how many workers
+	// were kept busy on average, utilization is that divided by the worker count.
+	double busy = 0.0;
+	for (int i = 0; i < (int)_workers.size(); ++i)
+	{
+		const Worker& worker = _workers[i];
+		double seconds = worker.gradeMs / 1000.0;
+		busy += seconds;
+		infod("Worker %d: %d frames, %.1f s grading, %.2f frames/s, %d restarts", i, worker.frames, seconds,
+			seconds > 0.0 ? worker.frames / seconds : 0.0, worker.restarts);
+	}
+	if (wall > 0.0)
+		infod("%d frames in %.1f s: %.2f frames/s, %.1f of %d workers busy on average (%.0f%% utilization)", _done, wall, _done / wall,
+			busy / wall, (int)_workers.size(), 100.0 * busy / (wall * _workers.size()));
+}
+
+int ShardCoordinator::run()
+{
+	if (_finished() || _workers.empty())
+		return _numFrames - _done;
+
+	_clock.start();
+	for (Worker& worker : _workers)
+		worker.running = true;
+	for (Worker& worker : _workers)
+		worker.transport->start();
+	_assignIdle();
+
+	QEventLoop loop;
+	QTimer progress;
+	QObject::connect(&progress, &QTimer::timeout, [this]() { _report(false); });
+	progress.start(SHARD_PROGRESS_MS);
+	_loop = &loop;
+	if (!_finished())
+		loop.exec();
+	_loop = nullptr;
+	progress.stop();
+
+	for (Worker& worker : _workers)
+	{
+		worker.transport->onExit = nullptr;
+		if (worker.running)
+			worker.transport->send("quit");
+	}
+	_report(true);
+	return _failed;
+}
+
+int runShardWorker(std::function<bool(int frame)> gradeFrame)
+{
+	std::mutex mutex;
+	std::condition_variable wake;
+	int cursor = 0;
+	int end = 0;
+	bool quit = false;
+
+	std::mutex outputMutex;
+	auto report = [&](const char* fmt, int a, double b)
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		fprintf(stdout, fmt, a, b);
+		fflush(stdout);
+	};
+
+	// commands arrive while a frame is graded, a shrink has to be answered with the frame in progress known
+	std::thread reader([&]()
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), stdin))
+		{
+			int a, b;
+			std::unique_lock<std::mutex> lock(mutex);
+			if (sscanf(line, "range %d %d", &a, &b) == 2)
+			{
+				cursor = a;
+				end = b;
+			}
+			else if (sscanf(line, "shrink %d", &a) == 1)
+			{
+				// frames up to the cursor are started or done already
+				end = std::max(std::min(a, end), cursor);
+				int shrunk = end;
+				lock.unlock();
+				report("shrunk %d\n", shrunk, 0.0);
+				continue;
+			}
+			else if (!strncmp(line, "quit", 4))
+				break;
+			lock.unlock();
+			wake.notify_one();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+		wake.notify_one();
+	});
+
+	for (;;)
+	{
+		int frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return quit || cursor < end; });
+			if (quit)
+				break;
+			frame = cursor++;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		bool graded = gradeFrame(frame);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		flushLog();
+		if (graded)
+			report("done %d %.1f\n", frame, ms);
+		else
+			report("failed %d\n", frame, 0.0);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (cursor >= end)
+			report("idle\n", 0, 0.0);
+	}
+
+	// the loop only ends once the reader set quit, on "quit" or when the coordinator closed stdin
+	reader.join();
+	return 0;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QProcess>
+#include <QStringList>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/*
+Splits the frames of a batch over worker processes.
+
+Every worker starts with an equal, contiguous range of frames. A worker that runs out of work steals the back half
+of the largest range that is left, so slow workers don't hold up the end of the batch. Frames that fail are retried,
+on whichever worker is free, up to SHARD_MAX_ATTEMPTS times. A worker that dies has its unfinished frames handed out again
+and is restarted.
+
+Coordinator and workers talk in lines of text, a worker reads commands and writes reports:
+
+	coordinator -> worker
+	range <begin> <end>	grade frames begin to end (exclusive) in order
+	shrink <end>	stop at end instead, the worker answers with the end it can still honor
+	quit
+	worker -> coordinator
+	done <frame> <ms>
+	failed <frame>
+	shrunk <end>
+	idle	the range is finished
+
+ShardWorker is the transport. Workers run as local processes for now, a socket transport can implement the same interface.
+*/
+
+const int SHARD_MAX_ATTEMPTS = 3;
+const int SHARD_MAX_RESTARTS = 3;
+// ranges smaller than this are not worth stealing
+const int SHARD_MIN_STEAL = 2;
+
+class ShardWorker
+{
+public:
+	std::function<void(const QByteArray& line)> onLine;
+	std::function<void()> onExit;
+
+	virtual ~ShardWorker() {}
+	virtual void start() = 0;
+	virtual void send(const QByteArray& line) = 0;
+	virtual QString name() const = 0;
+};
+
+// a copy of this executable with --shard-worker
+class ProcessShardWorker : public ShardWorker
+{
+protected:
+	QProcess _process;
+	QString _program;
+	QStringList _arguments;
+	QByteArray _received;
+
+public:
+	ProcessShardWorker(const QString& program, const QStringList& arguments);
+	~ProcessShardWorker();
+
+	virtual void start() override;
+	virtual void send(const QByteArray& line) override;
+	virtual QString name() const override;
+};
+
+class ShardCoordinator
+{
+protected:
+	struct Worker
+	{
+		std::unique_ptr<ShardWorker> transport;
+		bool running = false;
+		bool busy = false;
+		int begin = 0; // first frame that has not been reported yet
+		int end = 0;
+		int stealFor = -1; // worker waiting for the frames a shrink will free up
+		int stealEnd = 0; // end of the range before the shrink
+		bool stealing = false; // waiting for another worker to shrink
+		int restarts = 0;
+
+		// throughput
+		int frames = 0;
+		double gradeMs = 0.0;
+	};
+
+	std::vector<Worker> _workers;
+	std::deque<std::pair<int, int>> _pending;
+	std::vector<int> _attempts;
+	int _done = 0;
+	int _failed = 0;
+	int _numFrames;
+	QElapsedTimer _clock;
+	QEventLoop* _loop = nullptr;
+
+	void _receive(int index, const QByteArray& line);
+	void _exited(int index);
+	void _assign(int index);
+	void _assignIdle();
+	bool _steal(int thief);
+	void _failFrame(int frame);
+	bool _finished() const;
+	void _report(bool final) const;
+
+public:
+	ShardCoordinator(int numFrames, std::vector<std::unique_ptr<ShardWorker>> workers);
+
+	// run until every frame is graded or has failed too often, returns the number of frames that failed
+	int run();
+};
+
+// worker side, grades the ranges sent on stdin and reports on stdout. gradeFrame returns false on failure.
+int runShardWorker(std::function<bool(int frame)> gradeFrame);
@@ -0,0 +1,160 @@
+#include "sourcebin.h"
+#include "hdrimage.h"
+#include <QDir>
+#include <QImageReader>
+#include <QtCore/qfloat16.h>
+#include <algorithm>
+#include <cstring>
+
+static bool anyHdr(const QStringList& shots)
+{
+	return std::any_of(shots.begin(), shots.end(), [](const QString& shot) { return isHdrImageFile(shot); });
+}
+
+SourceBin::SourceBin(const QStringList& shots, int maxLayers, bool half) :
+	_shots(shots),
+	_shotLayers(shots.size(), -1),
+	_texture(half || anyHdr(shots) ? ColorBufferFormat::RGBA16F : ColorBufferFormat::SRGB8_ALPHA8, 1, 1, 1)
+{
+	// the resolution comes from the header, shots are only decoded once they are shown
+	QSize size = shots.isEmpty() ? QSize(1, 1) : (isHdrImageFile(shots[0]) ? pfmSize(shots[0]) : QImageReader(shots[0]).size());
+	if (!size.isValid())
+		size = QSize(1, 1);
+	int layers = shots.size() < maxLayers ? shots.size() : maxLayers;
+	layers = layers < 1 ? 1 : layers;
+	_texture.setSize(size.width(), size.height(), layers);
+	// mip levels for the viewer when it is zoomed out
+	_texture.generateMipMaps();
+	// under a texture budget the shots are read from their files again, see layer()
+	_texture.setReloadable(true);
+	_layerShots.resize(layers, -1);
+	_layerLastUse.resize(layers, 0);
+}
+
+QStringList SourceBin::shotsIn(const QString& directory)
+{
+	QStringList filters;
+	for (const QByteArray& extension : QImageReader::supportedImageFormats())
+		filters << "*." + QString(extension);
+	filters << "*.pfm";
+	QDir dir(directory);
+	QStringList shots;
+	for (const QString& name : dir.entryList(filters, QDir::Files, QDir::Name))
+		shots << dir.filePath(name);
+	return shots;
+}
+
+void SourceBin::_upload(int shot, int layer)
+{
+	if (isHalf())
+	{
+		_uploadHalf(shot, layer);
+		return;
+	}
+	QImage img(_shots[shot]);
+	if (img.isNull())
+	{
+		CONVERT_QSTRING(_shots[shot], text);
+		warning("Could not read shot '%s'", text);
+		img = QImage(_texture.width(), _texture.height(), QImage::Format_RGBA8888);
+		img.fill(Qt::black);
+	}
+	if (img.width() != _texture.width() || img.height() != _texture.height())
+		img = img.scaled(_texture.width(), _texture.height(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+	// decoders mostly give 32 bit (A)RGB or RGBA8888, those are converted row by row below, anything else as a whole image first
+	QImage::Format format = img.format();
+	if (format != QImage::Format_RGB32 && format != QImage::Format_ARGB32 && format != QImage::Format_RGBA8888)
+	{
+		img = img.convertToFormat(QImage::Format_RGBA8888);
+		format = QImage::Format_RGBA8888;
+	}
+
+	// GL rows go bottom to top, flipped and converted into a pooled staging block instead of a new converted image per upload
+	int rowBytes = img.width() * 4;
+	PooledBuffer staging = bufferPool.lease((size_t)rowBytes * img.height());
+	for (int y = 0; y < img.height(); ++y)
+	{
+		unsigned char* dst = staging.data() + (size_t)y * rowBytes;
+		if (format == QImage::Format_RGBA8888)
+		{
+			memcpy(dst, img.constScanLine(img.height() - 1 - y), rowBytes);
+			continue;
+		}
+		const QRgb* src = (const QRgb*)img.constScanLine(img.height() - 1 - y);
+		bool opaque = format == QImage::Format_RGB32;
+		for (int x = 0; x < img.width(); ++x, dst += 4)
+		{
+			dst[0] = (unsigned char)qRed(src[x]);
+			dst[1] = (unsigned char)qGreen(src[x]);
+			dst[2] = (unsigned char)qBlue(src[x]);
+			dst[3] = opaque ? 255 : (unsigned char)qAlpha(src[x]);
+		}
+	}
+	_texture.setLayer(layer, staging.data());
+	// this regenerates the levels of every layer, uploads are rare enough for that
+	_texture.generateMipMaps();
+}
+
+void SourceBin::_uploadHalf(int shot, int layer)
+{
+	FloatImage img;
+	if (!loadFloatImage(_shots[shot], img))
+	{
+		CONVERT_QSTRING(_shots[shot], text);
+		warning("Could not read shot '%s'", text);
+		img = FloatImage(_texture.width(), _texture.height());
+	}
+	int width = _texture.width();
+	int height = _texture.height();
+	bool scaled = img.width != width || img.height != height;
+
+	// flipped to GL rows and converted in one pass, scaling bilinearly like the 8 bit path does smoothly
+	int rowBytes = width * 4 * (int)sizeof(qfloat16);
+	PooledBuffer staging = bufferPool.lease((size_t)rowBytes * height);
+	for (int y = 0; y < height; ++y)
+	{
+		qfloat16* dst = (qfloat16*)(staging.data() + (size_t)y * rowBytes);
+		int sourceY = height - 1 - y;
+		for (int x = 0; x < width; ++x, dst += 4)
+		{
+			float scaledColor[4];
+			const float* src = scaledColor;
+			if (scaled)
+				sampleBilinear(img, (x + 0.5f) / width, (sourceY + 0.5f) / height, scaledColor);
+			else
+				src = img.pixel(x, sourceY);
+			for (int c = 0; c < 4; ++c)
+				dst[c] = qfloat16(src[c]);
+		}
+	}
+	_texture.setLayer(layer, staging.data());
+	_texture.generateMipMaps();
+}
+
+int SourceBin::layer(int shot)
+{
+	if (shot < 0 || shot >= size())
+		return 0;
+	// evicted by the residency manager, every layer has to be uploaded again
+	if (!_texture.resident())
+	{
+		std::fill(_shotLayers.begin(), _shotLayers.end(), -1);
+		std::fill(_layerShots.begin(), _layerShots.end(), -1);
+	}
+	int layer = _shotLayers[shot];
+	if (layer == -1)
+	{
+		// take a free layer, or the least recently used one
+		layer = 0;
+		for (int i = 1; i < (int)_layerShots.size(); ++i)
+			if (_layerShots[layer] != -1 && (_layerShots[i] == -1 || _layerLastUse[i] < _layerLastUse[layer]))
+				layer = i;
+		if (_layerShots[layer] != -1)
+			_shotLayers[_layerShots[layer]] = -1;
+		_upload(shot, layer);
+		_layerShots[layer] = shot;
+		_shotLayers[shot] = layer;
+	}
+	_layerLastUse[layer] = ++_clock;
+	return layer;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "buffers.h"
+#include <QStringList>
+#include <cstdint>
+#include <vector>
+
+// Most shots a source bin keeps on the GPU at once, 16 1080p shots take 128 MB, or 256 MB as half floats
+const int SOURCE_BIN_LAYERS = 16;
+
+/*
+Shots for the preview, streamed into the layers of one texture array.
+
+A shot is decoded and uploaded to a layer the first time it is shown and keeps that layer
+until it is the least recently shown shot and the layer is needed for another one.
+Switching between shots that are on the GPU is only a change of the layer uniform, nothing is rebound or uploaded.
+All layers share the resolution of the first shot, other shots are scaled to it.
+The texture has mip levels for viewing the shots zoomed out.
+
+Shots are stored as SRGB8_ALPHA8, or as linear RGBA16F when there are HDR shots among them (see hdrimage.h)
+or half floats are asked for. 8 bit shots in a half float bin are decoded to linear on upload,
+the shaders read linear values either way.
+*/
+class SourceBin
+{
+protected:
+	QStringList _shots;
+	std::vector<int> _shotLayers; // -1 when the shot is not on the GPU
+	std::vector<int> _layerShots; // -1 when the layer is free
+	std::vector<int64_t> _layerLastUse;
+	int64_t _clock = 0;
+	ColorBufferObject2DArray _texture;
+
+	void _upload(int shot, int layer);
+	void _uploadHalf(int shot, int layer);
+
+public:
+	SourceBin(const QStringList& shots, int maxLayers = SOURCE_BIN_LAYERS, bool half = false);
+
+	// every image in a directory, sorted by name
+	static QStringList shotsIn(const QString& directory);
+
+	inline int size() const { return _shots.size(); }
+	inline const QString& shot(int index) const { return _shots[index]; }
+
+	// the layer that holds the shot, uploads it if needed. Call before the texture is used in a frame,
+	// it may have been evicted (see residency.h). Requires a current GL context.
+	int layer(int shot);
+	inline ColorBufferObject2DArray& texture() { return _texture; }
+	inline bool isHalf() { return _texture.format() == ColorBufferFormat::RGBA16F; }
+};
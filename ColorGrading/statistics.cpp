@@ -0,0 +1,241 @@
+#include "statistics.h"
+#include <cstring>
+#include <thread>
+#include <vector>
+
+float ImageStatistics::lumaPercentile(float fraction) const
+{
+	double wanted = fraction * (double)pixels;
+	double below = 0.0;
+	for (int bin = 0; bin < STATISTICS_BINS; ++bin)
+	{
+		if (histogram[bin] && below + histogram[bin] >= wanted)
+		{
+			float t = (float)((wanted - below) / histogram[bin]);
+			float root = (bin + (t < 0.0f ? 0.0f : t)) / STATISTICS_BINS;
+			return root * root;
+		}
+		below += histogram[bin];
+	}
+	return 1.0f;
+}
+
+// sums of a band of rows, combined into the statistics once all bands are done
+struct StatisticsBand
+{
+	double sum[3] = {};
+	float minimum[3] = { 3.0e38f, 3.0e38f, 3.0e38f };
+	float maximum[3] = {};
+	uint32_t histogram[STATISTICS_BINS] = {};
+};
+
+static void bandStatistics(const FloatImage& image, int y0, int y1, StatisticsBand& band)
+{
+	for (int y = y0; y < y1; ++y)
+	{
+		// sums per row stay small enough for floats
+		float sum[3] = {};
+		const float* src = image.pixel(0, y);
+		for (int x = 0; x < image.width; ++x, src += 4)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				sum[c] += src[c];
+				band.minimum[c] = src[c] < band.minimum[c] ? src[c] : band.minimum[c];
+				band.maximum[c] = src[c] > band.maximum[c] ? src[c] : band.maximum[c];
+			}
+			++band.histogram[statisticsBin(src[0] * 0.2126f + src[1] * 0.7152f + src[2] * 0.0722f)];
+		}
+		for (int c = 0; c < 3; ++c)
+			band.sum[c] += sum[c];
+	}
+}
+
+static ImageStatistics combineBands(const std::vector<StatisticsBand>& bands, int64_t pixels)
+{
+	ImageStatistics result;
+	result.pixels = pixels;
+	if (!pixels)
+		return result;
+	double sum[3] = {};
+	for (int c = 0; c < 3; ++c)
+	{
+		result.minimum[c] = 3.0e38f;
+		result.maximum[c] = 0.0f;
+	}
+	for (const StatisticsBand& band : bands)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			sum[c] += band.sum[c];
+			result.minimum[c] = band.minimum[c] < result.minimum[c] ? band.minimum[c] : result.minimum[c];
+			result.maximum[c] = band.maximum[c] > result.maximum[c] ? band.maximum[c] : result.maximum[c];
+		}
+		for (int bin = 0; bin < STATISTICS_BINS; ++bin)
+			result.histogram[bin] += band.histogram[bin];
+	}
+	for (int c = 0; c < 3; ++c)
+		result.mean[c] = (float)(sum[c] / pixels);
+	return result;
+}
+
+ImageStatistics computeStatistics(const FloatImage& image, int threads)
+{
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency() ? (int)std::thread::hardware_concurrency() : 1;
+	threads = threads < image.height ? threads : (image.height ? image.height : 1);
+
+	std::vector<StatisticsBand> bands(threads);
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; ++i)
+		workers.emplace_back(bandStatistics, std::cref(image), image.height * i / threads, image.height * (i + 1) / threads, std::ref(bands[i]));
+	// the calling thread takes the first band
+	bandStatistics(image, 0, image.height / threads, bands[0]);
+	for (std::thread& worker : workers)
+		worker.join();
+
+	return combineBands(bands, (int64_t)image.width * image.height);
+}
+
+// layout of the Statistics buffer in statistics.glsl, std430, followed by a vec4 sum per work group
+struct GpuStatisticsHeader
+{
+	uint32_t histogram[STATISTICS_BINS];
+	// float bits, for values that are never negative they sort like the floats
+	uint32_t minimum[3];
+	uint32_t maximum[3];
+	uint32_t padding[2];
+};
+static_assert(sizeof(GpuStatisticsHeader) % 16 == 0, "the vec4 sums that follow have to be 16 byte aligned");
+
+int gpuStatisticsBufferSize(int groups)
+{
+	return (int)(sizeof(GpuStatisticsHeader) + groups * 4 * sizeof(float));
+}
+
+char* gpuStatisticsInitialData(int groups)
+{
+	int size = gpuStatisticsBufferSize(groups);
+	char* data = new char[size];
+	memset(data, 0, size);
+	GpuStatisticsHeader* header = (GpuStatisticsHeader*)data;
+	const float largest = 3.0e38f;
+	for (int c = 0; c < 3; ++c)
+		memcpy(&header->minimum[c], &largest, sizeof(float));
+	return data;
+}
+
+ImageStatistics gpuStatisticsResult(const unsigned char* buffer, int groups, int64_t pixels)
+{
+	const GpuStatisticsHeader* header = (const GpuStatisticsHeader*)buffer;
+	const float* sums = (const float*)(buffer + sizeof(GpuStatisticsHeader));
+
+	// one band per work group, the extremes and histogram are combined on the GPU already
+	std::vector<StatisticsBand> bands(1);
+	StatisticsBand& band = bands[0];
+	for (int group = 0; group < groups; ++group)
+		for (int c = 0; c < 3; ++c)
+			band.sum[c] += sums[group * 4 + c];
+	memcpy(band.minimum, header->minimum, sizeof(band.minimum));
+	memcpy(band.maximum, header->maximum, sizeof(band.maximum));
+	memcpy(band.histogram, header->histogram, sizeof(band.histogram));
+	return combineBands(bands, pixels);
+}
+
+static inline float luma(const float* color) { return color[0] * 0.2126f + color[1] * 0.7152f + color[2] * 0.0722f; }
+
+// how far the white balance of a temperature is from neutralizing a color, in log chroma
+static float balanceError(const float* color, float temperature)
+{
+	float white[3];
+	colorFromKelvin(temperature, white);
+	float error = 0.0f;
+	for (int c = 0; c < 3; c += 2)
+	{
+		// green is the reference, the temperature has no say over the overall brightness
+		float wanted = logf((color[c] + 1.0e-4f) / (color[1] + 1.0e-4f));
+		float got = logf((white[c] + 1.0e-4f) / (white[1] + 1.0e-4f));
+		error += (wanted - got) * (wanted - got);
+	}
+	return error;
+}
+
+// temperature whose white point is closest to the mean color, so dividing by it makes the image average to grey
+static float autoTemperature(const ImageStatistics& statistics)
+{
+	// photographic temperatures are between 15 and 150, scanned on a log scale then refined around the best step
+	const float LOWEST = 15.0f;
+	const float HIGHEST = 150.0f;
+	const int STEPS = 64;
+	float step = powf(HIGHEST / LOWEST, 1.0f / STEPS);
+	float best = 66.0f;
+	float bestError = balanceError(statistics.mean, best);
+	for (int i = 0; i <= STEPS; ++i)
+	{
+		float temperature = LOWEST * powf(step, (float)i);
+		float error = balanceError(statistics.mean, temperature);
+		if (error < bestError)
+		{
+			best = temperature;
+			bestError = error;
+		}
+	}
+	float low = best / step;
+	float high = best * step;
+	for (int i = 0; i < 24; ++i)
+	{
+		float a = low + (high - low) / 3.0f;
+		float b = high - (high - low) / 3.0f;
+		if (balanceError(statistics.mean, a) < balanceError(statistics.mean, b))
+			high = b;
+		else
+			low = a;
+	}
+	return (low + high) * 0.5f;
+}
+
+GradingSettings autoGrade(const ImageStatistics& statistics, const GradingSettings& base, int parts)
+{
+	GradingSettings settings = base;
+	if (!statistics.pixels)
+		return settings;
+
+	// the pivot comes first, the contrast curve moves the black and white points
+	if (parts & AUTO_PIVOT)
+	{
+		float median = statistics.lumaPercentile(0.5f);
+		settings.pivot = median < 0.05f ? 0.05f : (median > 0.95f ? 0.95f : median);
+	}
+
+	if (parts & AUTO_BALANCE)
+		settings.temperature = autoTemperature(statistics);
+
+	if (parts & AUTO_LEVELS)
+	{
+		// white balance scales every channel, how much that brightens luma is taken from the mean color
+		float whitePoint[3];
+		colorFromKelvin(settings.temperature, whitePoint);
+		float balanced[3];
+		for (int c = 0; c < 3; ++c)
+			balanced[c] = statistics.mean[c] / (whitePoint[c] > 1.0e-4f ? whitePoint[c] : 1.0e-4f);
+		float meanLuma = luma(statistics.mean);
+		float scale = meanLuma > 0.0f ? luma(balanced) / meanLuma : 1.0f;
+
+		// where the black and white points are by the time they reach the wheels
+		float black = contrastCurve(settings, statistics.lumaPercentile(AUTO_BLACK_POINT)) * scale;
+		float white = contrastCurve(settings, statistics.lumaPercentile(AUTO_WHITE_POINT)) * scale;
+		if (white - black > 1.0e-3f)
+		{
+			// v * (1 + gain - lift) + lift + offset, with black going to 0 and white to 1
+			float offset = (settings.offset.x() + settings.offset.y() + settings.offset.z()) / 3.0f;
+			float slope = 1.0f / (white - black);
+			float lift = -offset - black * slope;
+			float gain = slope - 1.0f + lift;
+			float liftTint = (base.lift.x() + base.lift.y() + base.lift.z()) / 3.0f;
+			float gainTint = (base.gain.x() + base.gain.y() + base.gain.z()) / 3.0f;
+			settings.lift = base.lift + QVector3D(1.0f, 1.0f, 1.0f) * (lift - liftTint);
+			settings.gain = base.gain + QVector3D(1.0f, 1.0f, 1.0f) * (gain - gainTint);
+		}
+	}
+	return settings;
+}
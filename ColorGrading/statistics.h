@@ -0,0 +1,79 @@
+#pragma once
+
+#include "grading.h"
+#include <cmath>
+#include <cstdint>
+
+/*
+Statistics of a linear image that the auto grading tools are derived from.
+
+Luma is the rec 709 luma of the linear color. The histogram bins are spaced on the square root of luma,
+so the shadows get about as many bins as the highlights and the bin of a pixel costs a sqrt.
+The mean color is the grey world estimate of the light: a scene that averages to grey looks tinted by the light it was lit with.
+
+The CPU version reads every pixel. The GPU version in statistics.glsl reads a level of the source mip chain
+no larger than STATISTICS_MAX_SIZE, the levels above it already averaged the image down. The mean is the same,
+extremes and percentiles come out a little smoothed, which is what the auto tools want anyway.
+Debug builds of the preview check the GPU version against the CPU version whenever the image changes.
+*/
+
+const int STATISTICS_BINS = 256;
+
+// longest side of the mip level the GPU reads
+const int STATISTICS_MAX_SIZE = 1024;
+
+// work group size of statistics.glsl, every invocation of a group flushes one histogram bin
+const int STATISTICS_GROUP_SIZE = 16;
+static_assert(STATISTICS_GROUP_SIZE * STATISTICS_GROUP_SIZE == STATISTICS_BINS, "statistics.glsl flushes one bin per invocation");
+
+struct ImageStatistics
+{
+	int64_t pixels = 0;
+	float mean[3] = {};
+	float minimum[3] = {};
+	float maximum[3] = {};
+	uint32_t histogram[STATISTICS_BINS] = {};
+
+	inline float meanLuma() const { return mean[0] * 0.2126f + mean[1] * 0.7152f + mean[2] * 0.0722f; }
+
+	// luma that the given fraction (0 to 1) of the pixels is darker than, interpolated within its bin
+	float lumaPercentile(float fraction) const;
+};
+
+// histogram bin of a linear luma value, statistics.glsl does the same
+inline int statisticsBin(float luma)
+{
+	int bin = (int)(sqrtf(luma > 0.0f ? luma : 0.0f) * STATISTICS_BINS);
+	return bin < STATISTICS_BINS ? bin : STATISTICS_BINS - 1;
+}
+
+// every pixel, split into bands of rows over threads, 0 uses one per core
+ImageStatistics computeStatistics(const FloatImage& image, int threads = 0);
+
+// size of the buffer statistics.glsl writes to for a dispatch of the given number of work groups
+int gpuStatisticsBufferSize(int groups);
+// what the buffer should hold before the dispatch, the caller owns the result like ShaderStorageBufferObject::setData() wants
+char* gpuStatisticsInitialData(int groups);
+// combine the per group results of statistics.glsl
+ImageStatistics gpuStatisticsResult(const unsigned char* buffer, int groups, int64_t pixels);
+
+// percentiles that become black and white with auto levels, some pixels are allowed to clip
+const float AUTO_BLACK_POINT = 0.005f;
+const float AUTO_WHITE_POINT = 0.995f;
+
+// parts of a grade that autoGrade() derives, combine with |
+enum AutoGradeParts
+{
+	AUTO_BALANCE = 1, // temperature from the grey world estimate
+	AUTO_LEVELS = 2, // lift and gain that map the black and white points to 0 and 1
+	AUTO_PIVOT = 4, // contrast pivot at the median luma
+	AUTO_ALL = AUTO_BALANCE | AUTO_LEVELS | AUTO_PIVOT,
+};
+
+/*
+The base grade with the chosen parts replaced by values derived from the statistics of its source.
+Levels account for the contrast curve and white balance of the grade in front of the wheels, the tints of the lift
+and gain wheels are kept and only their neutral part moves.
+The temperature slider only moves along the blue to orange axis, green or magenta casts are left alone.
+*/
+GradingSettings autoGrade(const ImageStatistics& statistics, const GradingSettings& base, int parts = AUTO_ALL);
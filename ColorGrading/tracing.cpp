@@ -0,0 +1,120 @@
+#include "tracing.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> tracingEnabled(false);
+// events that started before this are hidden from dumps, so clearing never touches the rings of other threads
+std::atomic<int64_t> traceClearedAt(0);
+
+struct TraceEvent
+{
+	const char* name;
+	int64_t beginUs;
+	int64_t durationUs; // -1 for instant events
+};
+
+struct TraceRing
+{
+	int threadId;
+	std::atomic<uint64_t> head;
+	TraceEvent events[TRACE_RING_SIZE];
+
+	TraceRing(int threadId) : threadId(threadId), head(0) {}
+
+	void push(const char* name, int64_t beginUs, int64_t durationUs)
+	{
+		uint64_t index = head.load(std::memory_order_relaxed);
+		events[index % TRACE_RING_SIZE] = { name, beginUs, durationUs };
+		head.store(index + 1, std::memory_order_release);
+	}
+};
+
+// rings are registered once per thread and never freed, so dumping stays valid after a thread exits
+std::mutex traceRingsLock;
+std::vector<TraceRing*> traceRings;
+
+TraceRing& localRing()
+{
+	thread_local TraceRing* ring = nullptr;
+	if (!ring)
+	{
+		std::lock_guard<std::mutex> guard(traceRingsLock);
+		ring = new TraceRing((int)traceRings.size());
+		traceRings.push_back(ring);
+	}
+	return *ring;
+}
+
+int64_t traceNow()
+{
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void setTracing(bool enabled)
+{
+	// make sure the time base starts before the first event
+	traceNow();
+	tracingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void traceComplete(const char* name, int64_t beginUs, int64_t endUs)
+{
+	if (!isTracing())
+		return;
+	localRing().push(name, beginUs, endUs - beginUs);
+}
+
+void traceInstant(const char* name)
+{
+	if (!isTracing())
+		return;
+	localRing().push(name, traceNow(), -1);
+}
+
+bool dumpTrace(const char* filePath)
+{
+	FILE* fh = fopen(filePath, "wb");
+	if (!fh)
+		return false;
+
+	std::vector<TraceRing*> rings;
+	{
+		std::lock_guard<std::mutex> guard(traceRingsLock);
+		rings = traceRings;
+	}
+
+	int64_t clearedAt = traceClearedAt.load(std::memory_order_relaxed);
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", fh);
+	bool first = true;
+	for (TraceRing* ring : rings)
+	{
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		// the oldest slots may be overwritten while we read if the owner keeps recording, skip a margin of them
+		uint64_t tail = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE + TRACE_RING_SIZE / 16 : 0;
+		for (uint64_t i = tail; i < head; ++i)
+		{
+			const TraceEvent& event = ring->events[i % TRACE_RING_SIZE];
+			if (event.beginUs < clearedAt)
+				continue;
+			if (event.durationUs < 0)
+				fprintf(fh, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%lld}",
+					first ? "" : ",\n", event.name, ring->threadId, (long long)event.beginUs);
+			else
+				fprintf(fh, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+					first ? "" : ",\n", event.name, ring->threadId, (long long)event.beginUs, (long long)event.durationUs);
+			first = false;
+		}
+	}
+	fputs("]}\n", fh);
+	fclose(fh);
+	return true;
+}
+
+void clearTrace()
+{
+	traceClearedAt.store(traceNow(), std::memory_order_relaxed);
+}
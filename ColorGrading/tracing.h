@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+Lightweight span tracing, dumped as Chrome trace event JSON (load it in chrome://tracing or ui.perfetto.dev).
+
+Every thread records into its own fixed size ring buffer, so recording never takes a lock.
+Only the owning thread writes to a ring, it publishes events by bumping an atomic head,
+dumpTrace() reads all rings from whichever thread calls it.
+When the ring is full the oldest events get overwritten.
+
+When tracing is disabled a span costs a single relaxed atomic load.
+Span names are expected to be string literals, only the pointer is stored.
+*/
+
+const int TRACE_RING_SIZE = 1 << 16;
+
+extern std::atomic<bool> tracingEnabled;
+
+inline bool isTracing() { return tracingEnabled.load(std::memory_order_relaxed); }
+void setTracing(bool enabled);
+
+// microseconds since the first call, the time base of all events
+int64_t traceNow();
+
+// record a span that has already ended, use this when begin and end live in different functions
+void traceComplete(const char* name, int64_t beginUs, int64_t endUs);
+// record a zero duration event
+void traceInstant(const char* name);
+
+// write all recorded events to a file, returns false if the file could not be written
+bool dumpTrace(const char* filePath);
+// forget all recorded events
+void clearTrace();
+
+class ScopedTrace
+{
+	const char* _name;
+	int64_t _begin;
+
+public:
+	inline ScopedTrace(const char* name) : _name(isTracing() ? name : nullptr), _begin(_name ? traceNow() : 0) {}
+	inline ~ScopedTrace() { if (_name) traceComplete(_name, _begin, traceNow()); }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(NAME) ScopedTrace TRACE_CONCAT(_traceScope, __LINE__)(NAME)
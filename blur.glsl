@@ -0,0 +1,52 @@
+#version 430
+// Box blur along one axis, one invocation walks an entire row or column.
+// It keeps a running sum of the window, so every output pixel costs one add and one subtract
+// regardless of the radius. Run it horizontally and vertically for a 2D box blur,
+// repeat that a few times to approach a gaussian.
+layout(local_size_x = 64) in;
+#ifdef SOURCE_ARRAY
+// the first pass reads a layer of the source bin
+uniform sampler2DArray uSource;
+uniform int uSourceLayer = 0;
+#define SOURCE_SIZE textureSize(uSource, 0).xy
+#define SOURCE_FETCH(texel) texelFetch(uSource, ivec3(texel, uSourceLayer), 0)
+#else
+uniform sampler2D uSource;
+#define SOURCE_SIZE textureSize(uSource, 0)
+#define SOURCE_FETCH(texel) texelFetch(uSource, texel, 0)
+#endif
+layout(rgba16f, binding = 0) uniform writeonly image2D uTarget;
+uniform ivec2 uAxis = ivec2(1, 0); // (1, 0) blurs rows, (0, 1) blurs columns
+uniform int uRadius = 1;
+// texels to write as (x0, y0, x1, y1) with x1 and y1 exclusive, reads still reach outside it
+uniform ivec4 uRegion = ivec4(0, 0, 1 << 30, 1 << 30);
+
+void main()
+{
+	ivec2 size = SOURCE_SIZE;
+	ivec2 regionMin = max(uRegion.xy, ivec2(0));
+	ivec2 regionMax = min(uRegion.zw, size);
+	ivec2 across = ivec2(1) - uAxis;
+	int len = size.x * uAxis.x + size.y * uAxis.y;
+	int begin = regionMin.x * uAxis.x + regionMin.y * uAxis.y;
+	int end = regionMax.x * uAxis.x + regionMax.y * uAxis.y;
+	int lines = (regionMax.x - regionMin.x) * across.x + (regionMax.y - regionMin.y) * across.y;
+	int line = int(gl_GlobalInvocationID.x);
+	if (line >= lines)
+		return;
+	ivec2 origin = across * (regionMin + line);
+	
+	// edges are clamped, like GL_CLAMP_TO_EDGE
+	#define FETCH(i) SOURCE_FETCH(origin + uAxis * clamp(i, 0, len - 1))
+	
+	vec4 sum = vec4(0.0);
+	for (int i = begin - uRadius; i <= begin + uRadius; ++i)
+		sum += FETCH(i);
+	
+	float norm = 1.0 / float(uRadius * 2 + 1);
+	for (int i = begin; i < end; ++i)
+	{
+		imageStore(uTarget, origin + uAxis * i, sum * norm);
+		sum += FETCH(i + uRadius + 1) - FETCH(i - uRadius);
+	}
+}
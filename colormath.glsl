@@ -0,0 +1,42 @@
+// Color math shared by the shaders, included with #include "colormath.glsl", see readWithIncludes() in materials.cpp
+
+#define sat(x) clamp(x,0.,1.)
+
+/// Color conversions ///
+// https://gist.github.com/sugi-cho/6a01cae436acddd72bdf
+vec3 rgb2hsv(vec3 c)
+{
+    vec4 K=vec4(0,-1/3.,2/3.,-1),
+    p=mix(vec4(c.bg,K.wz),vec4(c.gb,K.xy),step(c.b,c.g)),
+    q=mix(vec4(p.xyw,c.r),vec4(c.r,p.yzx),step(p.x,c.r));
+    float d=q.x-min(q.w,q.y),e=1.0e-10;
+    return vec3(abs(q.z+(q.w-q.y)/(6*d+e)),d/(q.x+e),q.x);
+}
+vec3 hsv2rgb(vec3 c){return c.z*mix(vec3(1),sat(abs(fract(vec3(1,2/3.,1/3.)+c.x)*6-3)-1),c.y);}
+vec3 rgb2hsv(float r,float g,float b){return rgb2hsv(vec3(r,g,b));}
+vec3 hsv2rgb(float h,float s,float v){return hsv2rgb(vec3(h,s,v));}
+
+// from http://www.tannerhelland.com/4435/convert-temperature-rgb-algorithm-code/
+vec3 colorFromKelvin(float temperature) // photographic temperature values are between 15 to 150
+{
+    float r, g, b;
+    if(temperature <= 66.0)
+    {
+        r = 1.0;
+        g = sat((99.4708025861 * log(temperature) - 161.1195681661) / 255.0);
+        if(temperature < 19.0)
+            b = 0.0;
+        else
+            b = sat((138.5177312231 * log(temperature - 10.0) - 305.0447927307) / 255.0);
+    }
+    else
+    {
+        r = sat((329.698727446 / 255.0) * pow(temperature - 60.0, -0.1332047592));
+        g = sat((288.1221695283  / 255.0) * pow(temperature - 60.0, -0.0755148492));
+        b = 1.0;
+    }
+    return vec3(r, g, b);
+}
+
+// Rec. 709 weights, the same as the CPU grade in grading.cpp
+float Luma(vec3 color) { return dot(color, vec3(0.2126, 0.7152, 0.0722)); }
@@ -1,46 +1,56 @@
-#version 410
-uniform vec2 uResolution;
-uniform sampler2D uImages[1];
+#version 430
+// where the image is in the widget, in pixels from the lower left corner, see CCPreview in main.cpp
+uniform vec2 uImageOrigin;
+uniform vec2 uImageSize;
+uniform sampler2DArray uSources; // every layer holds a shot, see SourceBin
+uniform int uSourceLayer = 0;
+uniform sampler2D uBlurred; // box blurred source, see blur.glsl
+uniform sampler2D uPyramid; // gaussian pyramid of the source in the mip levels, see pyramid.glsl
+uniform sampler3D uLook; // imported LUT, indexed with the display encoded grade, see LutFile
+uniform int uLookSize = 0; // 0 without one
+uniform sampler2D uOutputShaper; // output transform as a 1D shaper LUT, see outputtransform.h
 out vec4 outColor;
 
-#define sat(x) clamp(x,0.,1.)
+#include "colormath.glsl"
 
-/// Color conversions ///
-// https://gist.github.com/sugi-cho/6a01cae436acddd72bdf
-vec3 rgb2hsv(vec3 c)
-{
-    vec4 K=vec4(0,-1/3.,2/3.,-1),
-    p=mix(vec4(c.bg,K.wz),vec4(c.gb,K.xy),step(c.b,c.g)),
-    q=mix(vec4(p.xyw,c.r),vec4(c.r,p.yzx),step(p.x,c.r));
-    float d=q.x-min(q.w,q.y),e=1.0e-10;
-    return vec3(abs(q.z+(q.w-q.y)/(6*d+e)),d/(q.x+e),q.x);
-}
-vec3 hsv2rgb(vec3 c){return c.z*mix(vec3(1),sat(abs(fract(vec3(1,2/3.,1/3.)+c.x)*6-3)-1),c.y);}
-vec3 rgb2hsv(float r,float g,float b){return rgb2hsv(vec3(r,g,b));}
-vec3 hsv2rgb(float h,float s,float v){return hsv2rgb(vec3(h,s,v));}
+#define CLARITY_BANDS 6
+#define OUTPUT_SHAPER_SIZE 4096
+#define OUTPUT_SHAPER_FIRST ((127 - 20) << 7)
 
-// from http://www.tannerhelland.com/4435/convert-temperature-rgb-algorithm-code/
-vec3 colorFromKelvin(float temperature) // photographic temperature values are between 15 to 150
+#ifdef WEDGE
+// one grade per instance, laid out like WedgeVariant in main.cpp, see wedge.glsl
+struct Variant
 {
-    float r, g, b;
-    if(temperature <= 66.0)
-    {
-        r = 1.0;
-        g = sat((99.4708025861 * log(temperature) - 161.1195681661) / 255.0);
-        if(temperature < 19.0)
-            b = 0.0;
-        else
-            b = sat((138.5177312231 * log(temperature - 10.0) - 305.0447927307) / 255.0);
-    }
-    else
-    {
-        r = sat((329.698727446 / 255.0) * pow(temperature - 60.0, -0.1332047592));
-        g = sat((288.1221695283  / 255.0) * pow(temperature - 60.0, -0.0755148492));
-        b = 1.0;
-    }
-    return vec3(r, g, b);
-}
+    vec4 lift;
+    vec4 gamma;
+    vec4 gain;
+    vec4 offset;
+    float contrast;
+    float contrastPivot;
+    float saturation;
+    float hue;
+    float temperature;
+    float unsharpMask;
+    int clarity;
+    float clarityGains[CLARITY_BANDS];
+};
+layout(std430, binding = 0) readonly buffer Variants { Variant variants[]; };
+in vec2 vUV;
+flat in int vVariant;
 
+#define uLift variants[vVariant].lift.xyz
+#define uGamma variants[vVariant].gamma.xyz
+#define uGain variants[vVariant].gain.xyz
+#define uOffset variants[vVariant].offset.xyz
+#define uContrast variants[vVariant].contrast
+#define uContrastPivot variants[vVariant].contrastPivot
+#define uSaturation variants[vVariant].saturation
+#define uHue variants[vVariant].hue
+#define uTemperature variants[vVariant].temperature
+#define uUnsharpMask variants[vVariant].unsharpMask
+#define uClarity (variants[vVariant].clarity != 0)
+#define uClarityGains variants[vVariant].clarityGains
+#else
 uniform vec3 uLift = vec3(0.0);
 uniform vec3 uGamma = vec3(0.0);
 uniform vec3 uGain = vec3(0.0);
@@ -54,49 +64,71 @@ uniform float uHue = 0.0;
 uniform float uTemperature = 66.0;
 uniform float uUnsharpMask = 0.0;
 
-float Luma(vec3 color) { return dot(color, vec3(0.2126, 0.7152, 0.0722)); }
+uniform bool uClarity = false;
+uniform float uClarityGains[CLARITY_BANDS];
+#endif
 
-// https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
-vec3 ACESFilm( vec3 x )
+// same lookup as shapeOutput() in outputtransform.h, the texture filtering does the interpolation
+float ShapeOutput(float x)
 {
-    const float a = 2.51;
-    const float b = 0.03;
-    const float c = 2.43;
-    const float d = 0.59;
-    const float e = 0.14;
-    return sat((x*(a*x+b))/(x*(c*x+d)+e));
+	if (!(x > 0.0))
+		return 0.0;
+	uint bits = floatBitsToUint(x);
+	int index = int(bits >> 16) - OUTPUT_SHAPER_FIRST;
+	if (index < 0)
+		return texelFetch(uOutputShaper, ivec2(0, 0), 0).x * x * 1048576.0;
+	// past the last entry the edge clamps
+	float t = float(bits & 0xFFFFu) / 65536.0;
+	return texture(uOutputShaper, vec2((float(index) + t + 0.5) / float(OUTPUT_SHAPER_SIZE), 0.5)).x;
 }
 
-// Good & fast sRgb approximation from http://chilliant.blogspot.com.au/2012/08/srgb-approximations-for-hlsl.html
-vec3 LinearToSRGB(vec3 rgb)
+vec3 ShapeOutput(vec3 v)
 {
-    rgb=max(rgb,vec3(0,0,0));
-    return max(1.055*pow(rgb,vec3(0.416666667))-0.055,0.0);
+	return vec3(ShapeOutput(v.x), ShapeOutput(v.y), ShapeOutput(v.z));
 }
 
 void main()
 {
-	vec2 uv = gl_FragCoord.xy / uResolution;
-	ivec2 texel = ivec2(gl_FragCoord.xy);
-	vec3 v = texture(uImages[0], uv).xyz;
+#ifdef WEDGE
+	vec2 uv = vUV;
+#else
+	vec2 uv = (gl_FragCoord.xy - uImageOrigin) / uImageSize;
+#endif
+	// zoomed out the source is read from the mip level that matches the screen, detail finer than a pixel would alias
+	float lod = max(textureQueryLod(uSources, uv).y, 0.0);
+	vec3 v = textureLod(uSources, vec3(uv, uSourceLayer), lod).xyz;
 	
-	// unsharp mask
-	vec4 blurry = 0.25 * (texture(uImages[0], vec2(texel - ivec2(1, 0)) / uResolution) 
-					    + texture(uImages[0], vec2(texel - ivec2(0, 1)) / uResolution)
-						+ texture(uImages[0], vec2(texel + ivec2(1, 0)) / uResolution) 
-						+ texture(uImages[0], vec2(texel + ivec2(0, 1)) / uResolution));
-	v += (v - blurry.xyz) * uUnsharpMask;
-	v = sat(v);
+	// clarity, every laplacian band (the difference between 2 pyramid levels) gets its own gain
+	// bands finer than the mip level that is shown are left out
+	if (uClarity)
+	{
+		vec3 coarser = textureLod(uPyramid, uv, lod).xyz;
+		for (int i = 0; i < CLARITY_BANDS; ++i)
+		{
+			vec3 finer = coarser;
+			coarser = textureLod(uPyramid, uv, max(float(i + 1), lod)).xyz;
+			v += (finer - coarser) * (uClarityGains[i] - 1.0);
+		}
+	}
+	
+	// unsharp mask, the blur is computed once per image and radius so changing the amount is free
+	vec3 blurry = texture(uBlurred, uv).xyz;
+	// overshoots are clipped at white, HDR values brighter than that are only kept from growing
+	v = clamp(v + (v - blurry) * uUnsharpMask, vec3(0.0), max(v, vec3(1.0)));
 
 	// contrast
 	// contrast below 1, just fades from the pivot to the color
+	vec3 unfaded = v;
 	v = mix(vec3(uContrastPivot), v, sat(uContrast));
 	
 	vec3 p = vec3(1.0 / sat(2.0 - uContrast));
 	vec3 dark = pow(v / uContrastPivot, p) * uContrastPivot;
 	vec3 ip = vec3(1.0 - uContrastPivot);
 	vec3 light = 1.0 - pow(1.0 / ip - v / ip, p) * ip;
-	v = mix(dark, light, greaterThan(v, vec3(uContrastPivot)));
+	vec3 curve = mix(dark, light, greaterThan(v, vec3(uContrastPivot)));
+	// above white the curve goes on as a straight line, HDR highlights keep their distance to it
+	float white = uContrast < 1.0 ? mix(uContrastPivot, 1.0, sat(uContrast)) : 1.0;
+	v = mix(curve, white + (unfaded - 1.0) * sat(uContrast), greaterThan(unfaded, vec3(1.0)));
 	
 	// saturation
 	float luma = Luma(v);
@@ -112,8 +144,15 @@ void main()
 	// three way color corrector
 	v = pow(max(vec3(0.0), v * (1.0 + uGain - uLift) + uLift + uOffset), max(vec3(0.0), 1.0 - uGamma));
 	
-	// convert to gamma space
-    v = LinearToSRGB(v); // ACESFilm(v * uExposure)
+	// output transform, sRGB, rec 709, ACES filmic, PQ or HLG depending on the table that is bound
+	v = ShapeOutput(v);
+
+	// imported look, the remap puts the first and last LUT entries on the centers of the edge texels
+	if (uLookSize > 0)
+	{
+		float n = float(uLookSize);
+		v = texture(uLook, sat(v) * ((n - 1.0) / n) + 0.5 / n).xyz;
+	}
 
 	outColor = vec4(v, 1.0);
 }
@@ -0,0 +1,43 @@
+#version 430
+// Builds one level of a gaussian pyramid, the levels are the mip levels of the target.
+// Level 0 is a plain copy of the source, every next level is a half resolution pass over the previous level
+// with a separable [1 3 3 1] / 8 kernel. grading.glsl derives the laplacian bands from neighbouring levels.
+layout(local_size_x = 8, local_size_y = 8) in;
+#ifdef SOURCE_ARRAY
+// the copy to level 0 reads a layer of the source bin
+uniform sampler2DArray uSource;
+uniform int uSourceLayer = 0;
+#define SOURCE_SIZE(level) textureSize(uSource, level).xy
+#define SOURCE_FETCH(texel, level) texelFetch(uSource, ivec3(texel, uSourceLayer), level)
+#else
+uniform sampler2D uSource;
+#define SOURCE_SIZE(level) textureSize(uSource, level)
+#define SOURCE_FETCH(texel, level) texelFetch(uSource, texel, level)
+#endif
+uniform int uSourceLevel = 0;
+uniform bool uDownsample = true;
+layout(rgba16f, binding = 0) uniform writeonly image2D uTarget;
+// texels of the target level to write as (x0, y0, x1, y1) with x1 and y1 exclusive
+uniform ivec4 uRegion = ivec4(0, 0, 1 << 30, 1 << 30);
+
+void main()
+{
+	ivec2 texel = uRegion.xy + ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, min(uRegion.zw, imageSize(uTarget)))))
+		return;
+	
+	if (!uDownsample)
+	{
+		imageStore(uTarget, texel, SOURCE_FETCH(texel, uSourceLevel));
+		return;
+	}
+	
+	// edges are clamped, like GL_CLAMP_TO_EDGE
+	ivec2 last = SOURCE_SIZE(uSourceLevel) - 1;
+	const float weights[4] = float[](1.0, 3.0, 3.0, 1.0);
+	vec4 sum = vec4(0.0);
+	for (int y = 0; y < 4; ++y)
+		for (int x = 0; x < 4; ++x)
+			sum += SOURCE_FETCH(clamp(texel * 2 + ivec2(x - 1, y - 1), ivec2(0), last), uSourceLevel) * (weights[x] * weights[y]);
+	imageStore(uTarget, texel, sum / 64.0);
+}
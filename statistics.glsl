@@ -0,0 +1,77 @@
+#version 430
+// Image statistics for the auto grading tools, see statistics.h.
+// Reads one level of the source mip chain, the levels above it already averaged the image down.
+// Every work group reduces its tile in shared memory, the tiles are combined with atomics for the histogram
+// and extremes. There are no float atomics, so the sum of every group is left for the CPU to add up.
+layout(local_size_x = 16, local_size_y = 16) in;
+uniform sampler2DArray uSource;
+uniform int uSourceLayer = 0;
+uniform int uSourceLevel = 0;
+
+#include "colormath.glsl"
+
+// must match statistics.h, a work group has one invocation per bin
+#define BINS 256
+#define GROUP_INVOCATIONS 256
+
+layout(std430, binding = 0) buffer Statistics
+{
+	uint histogram[BINS];
+	// float bits, for values that are never negative they sort like the floats
+	uint minimum[3];
+	uint maximum[3];
+	uint padding[2];
+	vec4 sums[];
+};
+
+shared uint groupHistogram[BINS];
+shared vec3 groupSum[GROUP_INVOCATIONS];
+shared vec3 groupMinimum[GROUP_INVOCATIONS];
+shared vec3 groupMaximum[GROUP_INVOCATIONS];
+
+void main()
+{
+	uint local = gl_LocalInvocationIndex;
+	groupHistogram[local] = 0u;
+	memoryBarrierShared();
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	bool inside = all(lessThan(texel, textureSize(uSource, uSourceLevel).xy));
+	vec3 color = inside ? max(texelFetch(uSource, ivec3(texel, uSourceLayer), uSourceLevel).rgb, 0.0) : vec3(0.0);
+	if (inside)
+	{
+		float luma = Luma(color);
+		atomicAdd(groupHistogram[min(int(sqrt(luma) * BINS), BINS - 1)], 1u);
+	}
+	groupSum[local] = color;
+	groupMinimum[local] = inside ? color : vec3(3.0e38);
+	groupMaximum[local] = color;
+	memoryBarrierShared();
+	barrier();
+
+	// tree reduction, every step halves the invocations that still add
+	for (uint stride = GROUP_INVOCATIONS / 2; stride > 0u; stride >>= 1)
+	{
+		if (local < stride)
+		{
+			groupSum[local] += groupSum[local + stride];
+			groupMinimum[local] = min(groupMinimum[local], groupMinimum[local + stride]);
+			groupMaximum[local] = max(groupMaximum[local], groupMaximum[local + stride]);
+		}
+		memoryBarrierShared();
+		barrier();
+	}
+
+	if (groupHistogram[local] != 0u)
+		atomicAdd(histogram[local], groupHistogram[local]);
+	if (local == 0u)
+	{
+		sums[gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x] = vec4(groupSum[0], 0.0);
+		for (int c = 0; c < 3; ++c)
+		{
+			atomicMin(minimum[c], floatBitsToUint(groupMinimum[0][c]));
+			atomicMax(maximum[c], floatBitsToUint(groupMaximum[0][c]));
+		}
+	}
+}
@@ -0,0 +1,19 @@
+#version 430
+// Vertex shader for the WEDGE variant of grading.glsl.
+// Draw a 4 vertex triangle strip per variant without any vertex data,
+// every instance covers its own cell of a uColumns x uRows contact sheet, the first variant top left.
+uniform int uColumns = 1;
+uniform int uRows = 1;
+uniform vec2 uGap = vec2(0.0); // space between the cells in normalized device coordinates
+out vec2 vUV;
+flat out int vVariant;
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 cell = vec2(gl_InstanceID % uColumns, uRows - 1 - gl_InstanceID / uColumns);
+	vec2 cellSize = 2.0 / vec2(uColumns, uRows);
+	vUV = corner;
+	vVariant = gl_InstanceID;
+	gl_Position = vec4(cell * cellSize - 1.0 + uGap * 0.5 + corner * (cellSize - uGap), 0.0, 1.0);
+}